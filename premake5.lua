@@ -4,6 +4,11 @@ workspace "Fractal-Renderer"
 
 outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 
+newoption {
+    trigger = "trace",
+    description = "Record timeline zones for Chrome tracing, see src/trace/trace.h"
+}
+
 project "Fractal-Renderer"
     language "C"
     location "src"
@@ -19,6 +24,11 @@ project "Fractal-Renderer"
         "src/**.c",
     }
 
+    removefiles {
+        "src/cli/**",
+        "src/bench/**"
+    }
+
     objdir ("bin-int/" .. outputdir .. "/%{prj.name}")
     targetdir ("bin/" .. outputdir)
     targetprefix ""
@@ -49,9 +59,136 @@ project "Fractal-Renderer"
         optimize "On"
         defines { "NDEBUG" }
 
+    filter "options:trace"
+        defines { "TRACE_ENABLED" }
+
     filter "system:windows"
         systemversion "latest"
 
         links {
             "gdi32", "kernel32", "user32", "opengl32"
         }
+
+-- Headless batch renderer, builds without the window and OpenGL code
+project "Fractal-Renderer-CLI"
+    language "C"
+    location "src"
+    kind "ConsoleApp"
+
+    includedirs {
+        "src",
+        "src/third_party"
+    }
+
+    files {
+        "src/**.h",
+        "src/**.c",
+    }
+
+    removefiles {
+        "src/main.c",
+        "src/gfx/**",
+        "src/bench/**"
+    }
+
+    objdir ("bin-int/" .. outputdir .. "/%{prj.name}")
+    targetdir ("bin/" .. outputdir)
+    targetprefix ""
+
+    warnings "Extra"
+    architecture "x64"
+    toolset "clang"
+
+    filter { "action:*gmake*" } 
+        buildoptions { "-msse4.1 -mpclmul" }
+
+    filter "system:linux"
+        links {
+            "m", "pthread"
+        }
+
+    filter { "system:windows", "action:*gmake*", "configurations:debug" }
+        linkoptions { "-g" }
+
+    filter "configurations:debug"
+        symbols "On"
+
+        defines {
+            "DEBUG"
+        }
+
+    filter "configurations:release"
+        optimize "On"
+        defines { "NDEBUG" }
+
+    filter "options:trace"
+        defines { "TRACE_ENABLED" }
+
+    filter "system:windows"
+        systemversion "latest"
+
+        links {
+            "kernel32"
+        }
+
+-- Benchmark of the render kernels, see src/bench/main.c
+project "Fractal-Renderer-Bench"
+    language "C"
+    location "src"
+    kind "ConsoleApp"
+
+    includedirs {
+        "src",
+        "src/third_party"
+    }
+
+    files {
+        "src/**.h",
+        "src/**.c",
+    }
+
+    removefiles {
+        "src/main.c",
+        "src/gfx/**",
+        "src/cli/**"
+    }
+
+    objdir ("bin-int/" .. outputdir .. "/%{prj.name}")
+    targetdir ("bin/" .. outputdir)
+    targetprefix ""
+
+    warnings "Extra"
+    architecture "x64"
+    toolset "clang"
+
+    filter { "action:*gmake*" } 
+        buildoptions { "-msse4.1 -mpclmul" }
+
+    filter "system:linux"
+        links {
+            "m", "pthread"
+        }
+
+    filter { "system:windows", "action:*gmake*", "configurations:debug" }
+        linkoptions { "-g" }
+
+    filter "configurations:debug"
+        symbols "On"
+
+        defines {
+            "DEBUG"
+        }
+
+    filter "configurations:release"
+        optimize "On"
+        defines { "NDEBUG" }
+
+    filter "options:trace"
+        defines { "TRACE_ENABLED" }
+
+    filter "system:windows"
+        systemversion "latest"
+
+        links {
+            "kernel32"
+        }
@@ -4,5 +4,6 @@
 #include "mg_arena/mg_arena.h"
 #include "base/base_defs.h"
 #include "base/base_str.h"
+#include "base/base_atomic.h"
 
 #endif // BASE_H
@@ -0,0 +1,86 @@
+#ifndef BASE_ATOMIC_H
+#define BASE_ATOMIC_H
+
+#include "base_defs.h"
+
+// Small set of sequentially consistent atomics.
+// All of the atomic_add functions return the previous value,
+// and atomic_cas writes the current value into expected on failure
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+#include <intrin.h>
+
+static inline u32 atomic_load_u32(volatile u32* ptr) {
+    u32 val = *ptr;
+    _ReadWriteBarrier();
+    return val;
+}
+static inline u64 atomic_load_u64(volatile u64* ptr) {
+    u64 val = *ptr;
+    _ReadWriteBarrier();
+    return val;
+}
+static inline void atomic_store_u32(volatile u32* ptr, u32 val) {
+    _InterlockedExchange((volatile long*)ptr, (long)val);
+}
+static inline void atomic_store_u64(volatile u64* ptr, u64 val) {
+    _InterlockedExchange64((volatile __int64*)ptr, (__int64)val);
+}
+static inline u32 atomic_add_u32(volatile u32* ptr, u32 val) {
+    return (u32)_InterlockedExchangeAdd((volatile long*)ptr, (long)val);
+}
+static inline u64 atomic_add_u64(volatile u64* ptr, u64 val) {
+    return (u64)_InterlockedExchangeAdd64((volatile __int64*)ptr, (__int64)val);
+}
+static inline b32 atomic_cas_u32(volatile u32* ptr, u32* expected, u32 desired) {
+    u32 prev = (u32)_InterlockedCompareExchange((volatile long*)ptr, (long)desired, (long)*expected);
+    b32 success = prev == *expected;
+    *expected = prev;
+    return success;
+}
+static inline b32 atomic_cas_u64(volatile u64* ptr, u64* expected, u64 desired) {
+    u64 prev = (u64)_InterlockedCompareExchange64((volatile __int64*)ptr, (__int64)desired, (__int64)*expected);
+    b32 success = prev == *expected;
+    *expected = prev;
+    return success;
+}
+static inline void atomic_pause(void) {
+    _mm_pause();
+}
+
+#else
+
+static inline u32 atomic_load_u32(volatile u32* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+static inline u64 atomic_load_u64(volatile u64* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+static inline void atomic_store_u32(volatile u32* ptr, u32 val) {
+    __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+static inline void atomic_store_u64(volatile u64* ptr, u64 val) {
+    __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST);
+}
+static inline u32 atomic_add_u32(volatile u32* ptr, u32 val) {
+    return __atomic_fetch_add(ptr, val, __ATOMIC_SEQ_CST);
+}
+static inline u64 atomic_add_u64(volatile u64* ptr, u64 val) {
+    return __atomic_fetch_add(ptr, val, __ATOMIC_SEQ_CST);
+}
+static inline b32 atomic_cas_u32(volatile u32* ptr, u32* expected, u32 desired) {
+    return __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline b32 atomic_cas_u64(volatile u64* ptr, u64* expected, u64 desired) {
+    return __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline void atomic_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+#endif
+
+#endif // BASE_ATOMIC_H
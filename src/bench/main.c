@@ -0,0 +1,1154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base/base.h"
+#include "os/os.h"
+#include "os/os_thread_pool.h"
+
+#include "math/math_complex.h"
+#include "math/math_fixed.h"
+#include "render/render.h"
+#include "export/export.h"
+
+#include "fpng/fpng.h"
+
+// Benchmark of the render kernels.
+// Renders a fixed catalog of views at every resolution and thread count asked for,
+// and writes the results as JSON, so the numbers of two builds or two machines can be compared:
+//     Fractal-Renderer-Bench -o before.json
+//     Fractal-Renderer-Bench --baseline before.json -o after.json
+// With a baseline, every case that got slower by more than the tolerance is reported,
+// and the exit code is 1 if there was any.
+//
+// Every case is rendered once to warm up, then timed repeats times, and the fastest run counts.
+// Views only depend on their catalog entry, so the checksum of the iteration counts
+// only changes when a kernel computes something different.
+// Giter/s counts the iterations an escape time loop without any interior checks
+// would run, so checks that skip the inside of the set show up as a higher rate.
+// Imbalance is how much longer the busiest worker ran tasks than the average one,
+// 0.1 means the slowest thread finished about 10% after the others would have
+//
+// --check renders the views instead of timing them, and compares the counts of two ways
+// of rendering them that have to agree. Every count that differs is reported,
+// and the exit code is 1 if there was any:
+//     kernels    every vector kernel the cpu supports against the scalar one
+//     interior   renders with the cardioid, bulb and periodicity checks against
+//                plain escape time renders without them
+//     raw        the last frames of a zoom into every view, exported with raw files,
+//                against the raw files colored again the way the CLI's --recolor does.
+//                The files are written to the current directory and removed after
+//
+// --case picks what is timed, render by default:
+//     render     the views of the catalog
+//     pool       empty tasks through thread_pool_add_task and thread_pool_parallel_for,
+//                so the overhead per task shows up as Mtasks/s
+//     colorize   cycle and histogram palettes on the counts of every view, with the
+//                scalar and the AVX2 colorizer. The counts are rendered once before
+//                the timed runs, so only the colorize pass is measured
+
+// Bits after the point of the catalog centers, the same as the interactive view
+#define CENTER_FRAC_BITS 1088
+
+#define MAX_RESOLUTIONS 16
+#define MAX_THREAD_COUNTS 16
+#define MAX_CASES 1024
+#define MAX_LINE_SIZE 1024
+
+// Bits of --check
+#define BENCH_CHECK_KERNELS (1 << 0)
+#define BENCH_CHECK_INTERIOR (1 << 1)
+#define BENCH_CHECK_RAW (1 << 2)
+
+// Frames of every zoom of the raw check, and where they go
+#define RAW_CHECK_FRAMES 3
+#define RAW_CHECK_PNG_FORMAT "bench_check_%.4u.png"
+#define RAW_CHECK_RAW_FORMAT "bench_check_%.4u.raw"
+
+// Bits of --case
+#define BENCH_CASE_RENDER (1 << 0)
+#define BENCH_CASE_POOL (1 << 1)
+#define BENCH_CASE_COLORIZE (1 << 2)
+
+// Empty tasks every pool case runs
+#define POOL_TASKS (1 << 18)
+// Queue size of the pool cases, so a whole batch of add_task fits
+#define POOL_QUEUE_SIZE 1024
+
+typedef struct {
+    const char* name;
+    const char* center_r;
+    const char* center_i;
+    f64 dim;
+    u32 iterations;
+} bench_view;
+
+static const bench_view views[] = {
+    // The whole set, mostly pixels that escape within a few iterations
+    { "full", "-0.75", "0", 3.5, 1024 },
+    // Boundary of seahorse valley, long escapes next to short ones
+    { "seahorse", "-0.743643887037151", "0.131825904205330", 5e-3, 4096 },
+    // The period 3 minibrot on the real axis, most pixels never escape
+    { "interior", "-1.754877666246693", "0", 0.05, 16384 },
+    // As deep as the f64 kernels go (see RENDER_DD_MAX_DIM)
+    { "deep", "-0.743643887037158704752191506114774", "0.131825904205311970493132056385139", 1e-12, 8192 },
+};
+
+#define NUM_VIEWS (sizeof(views) / sizeof(views[0]))
+
+typedef struct {
+    u32 view;
+    u32 width;
+    u32 height;
+    u32 threads;
+
+    f64 wall_ms;
+    f64 median_ms;
+    f64 mpixels_per_s;
+    f64 giters_per_s;
+    f64 imbalance;
+    u64 checksum;
+
+    // Only set when the baseline has the same case
+    b32 has_baseline;
+    f64 baseline_ms;
+    b32 checksum_changed;
+} bench_result;
+
+typedef struct {
+    b32 parallel_for;
+    // Tasks given to the pool before waiting for them
+    u32 batch;
+} bench_pool_case;
+
+static const bench_pool_case pool_cases[] = {
+    // Small batches are dominated by waking up the workers and waiting for them
+    { false, 64 },
+    { false, POOL_QUEUE_SIZE },
+    { true, 64 },
+    { true, POOL_QUEUE_SIZE },
+    { true, POOL_TASKS },
+};
+
+#define NUM_POOL_CASES (sizeof(pool_cases) / sizeof(pool_cases[0]))
+
+typedef struct {
+    u32 view;
+    u32 width;
+    u32 height;
+    u32 threads;
+    render_color_mode mode;
+    render_kernel kernel;
+
+    f64 wall_ms;
+    f64 median_ms;
+    f64 mpixels_per_s;
+    // Of the colors, the kernels have to agree
+    u64 checksum;
+} bench_colorize_result;
+
+static const render_kernel colorize_kernels[] = { RENDER_KERNEL_SCALAR, RENDER_KERNEL_AVX2 };
+
+#define NUM_COLORIZE_KERNELS (sizeof(colorize_kernels) / sizeof(colorize_kernels[0]))
+
+typedef struct {
+    u32 pool_case;
+    u32 threads;
+
+    f64 wall_ms;
+    f64 median_ms;
+    f64 mtasks_per_s;
+} bench_pool_result;
+
+static void mga_err(mga_error err) {
+    fprintf(stderr, "MGA ERROR %d: %s\n", err.code, err.msg);
+}
+
+static void print_usage(const char* name) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -s, --size <w>x<h>      resolution to render at, can be given more than once\n"
+        "                          (default 640x360 and 1920x1080)\n"
+        "  -t, --threads <n>       worker threads, can be given more than once\n"
+        "                          (default 1 and all cpus)\n"
+        "  -v, --view <name>       only render this view of the catalog, can be given more than once\n"
+        "  -n, --repeats <n>       timed runs of every case (default 3)\n"
+        "      --affinity <name>   pin the workers to cpus, none, compact or scatter (default none)\n"
+        "  -k, --kernel <name>     auto, scalar, avx2 or avx512 (default auto)\n"
+        "  -m, --method <name>     tiles or subdivide (default tiles)\n"
+        "  -o, --out <path>        JSON output (default stdout)\n"
+        "      --baseline <path>   JSON output of an earlier run to compare against\n"
+        "      --tolerance <x>     percent a case can get slower before it is reported (default 5)\n"
+        "      --check <name>      compare counts instead of timing, can be given more than once:\n"
+        "                          kernels, interior, raw\n"
+        "      --case <name>       what to time, can be given more than once (default render):\n"
+        "                          render, pool, colorize\n"
+        "views:",
+        name
+    );
+    for (u32 i = 0; i < NUM_VIEWS; i++) {
+        fprintf(stderr, " %s", views[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+static b32 arg_is(const char* arg, const char* short_name, const char* long_name) {
+    return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+static b32 parse_u32(const char* str, u32* out) {
+    char* end = NULL;
+    unsigned long value = strtoul(str, &end, 10);
+
+    if (end == str || *end != '\0' || value == 0 || value > 0xffffffff) {
+        return false;
+    }
+
+    *out = (u32)value;
+    return true;
+}
+
+static b32 parse_size(const char* str, u32* width, u32* height) {
+    char* end = NULL;
+    unsigned long w = strtoul(str, &end, 10);
+    if (end == str || *end != 'x') {
+        return false;
+    }
+
+    const char* h_str = end + 1;
+    unsigned long h = strtoul(h_str, &end, 10);
+    if (end == h_str || *end != '\0' || w == 0 || h == 0 || w > 65536 || h > 65536) {
+        return false;
+    }
+
+    *width = (u32)w;
+    *height = (u32)h;
+    return true;
+}
+
+static const char* affinity_names[THREAD_AFFINITY_COUNT] = { "none", "compact", "scatter" };
+
+static b32 parse_affinity(const char* str, thread_affinity* out) {
+    for (u32 i = 0; i < THREAD_AFFINITY_COUNT; i++) {
+        if (strcmp(str, affinity_names[i]) == 0) {
+            *out = (thread_affinity)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void bench_view_desc(
+    render_desc* desc, u32 view, u32 width, u32 height,
+    const complex_fixedpt* center, render_kernel kernel, render_method method
+) {
+    *desc = (render_desc){
+        .width = width,
+        .height = height,
+        .dim = { views[view].dim, views[view].dim * (f64)height / (f64)width },
+        .center = { fixedpt_to_f64(&center->r), fixedpt_to_f64(&center->i) },
+        .iterations = views[view].iterations,
+        .kernel = kernel,
+        .method = method,
+        .interior_checks = true
+    };
+}
+
+static i32 compare_f64(const void* a, const void* b) {
+    f64 x = *(const f64*)a;
+    f64 y = *(const f64*)b;
+
+    return (x > y) - (x < y);
+}
+
+// FNV-1a over the bytes of the counts or colors
+static u64 bench_checksum(const void* data, u64 size) {
+    const u8* bytes = (const u8*)data;
+    u64 hash = 0xcbf29ce484222325ull;
+
+    for (u64 i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static u64 bench_iterations(const f32* iters, u64 count) {
+    u64 total = 0;
+
+    // A count of n took n + 1 iterations to escape,
+    // pixels that never escaped are at iterations - 1
+    for (u64 i = 0; i < count; i++) {
+        total += (u64)iters[i] + 1;
+    }
+
+    return total;
+}
+
+static void bench_run(
+    bench_result* result, thread_pool* tp, f32* iters, u64* busy_start, u64* busy_end,
+    const render_desc* desc, const complex_fixedpt* center, u32 repeats
+) {
+    u32 num_threads = thread_pool_num_threads(tp);
+    u64 count = (u64)desc->width * desc->height;
+
+    // Faults in the pages of the buffer and warms the caches,
+    // it is also the run the checksum and iterations come from
+    render_mandelbrot_auto(tp, iters, desc, center);
+
+    result->checksum = bench_checksum(iters, count * sizeof(f32));
+    u64 iterations = bench_iterations(iters, count);
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+    f64* times = MGA_PUSH_ARRAY(scratch.arena, f64, repeats);
+
+    f64 best_ms = 0.0;
+    for (u32 i = 0; i < repeats; i++) {
+        thread_pool_busy_usec(tp, busy_start);
+        u64 start = os_now_usec();
+
+        render_mandelbrot_auto(tp, iters, desc, center);
+
+        times[i] = (f64)(os_now_usec() - start) / 1000.0;
+        thread_pool_busy_usec(tp, busy_end);
+
+        if (i != 0 && times[i] >= best_ms) {
+            continue;
+        }
+        best_ms = times[i];
+
+        u64 max_busy = 0;
+        u64 total_busy = 0;
+        for (u32 t = 0; t < num_threads; t++) {
+            u64 busy = busy_end[t] - busy_start[t];
+
+            max_busy = MAX(max_busy, busy);
+            total_busy += busy;
+        }
+
+        result->imbalance = total_busy == 0 ? 0.0 :
+            (f64)max_busy * (f64)num_threads / (f64)total_busy - 1.0;
+    }
+
+    qsort(times, repeats, sizeof(f64), compare_f64);
+
+    // Runs too short for the clock still get a rate
+    f64 secs = MAX(best_ms, 1e-3) / 1000.0;
+
+    result->wall_ms = best_ms;
+    result->median_ms = times[repeats / 2];
+    result->mpixels_per_s = (f64)count / secs / 1e6;
+    result->giters_per_s = (f64)iterations / secs / 1e9;
+
+    mga_scratch_release(scratch);
+}
+
+static void pool_empty_task(void* arg) {
+    UNUSED(arg);
+}
+
+static void pool_empty_range(void* ctx, u64 begin, u64 end) {
+    UNUSED(ctx);
+    UNUSED(begin);
+    UNUSED(end);
+}
+
+static void pool_run_tasks(thread_pool* tp, const bench_pool_case* pool_case) {
+    for (u32 done = 0; done < POOL_TASKS; done += pool_case->batch) {
+        if (pool_case->parallel_for) {
+            thread_pool_parallel_for(tp, 0, pool_case->batch, 1, pool_empty_range, NULL);
+        } else {
+            for (u32 i = 0; i < pool_case->batch; i++) {
+                thread_pool_add_task(tp, (thread_task){ .func = pool_empty_task });
+            }
+            thread_pool_wait(tp);
+        }
+    }
+}
+
+static void bench_pool_run(bench_pool_result* result, thread_pool* tp, u32 repeats) {
+    const bench_pool_case* pool_case = &pool_cases[result->pool_case];
+
+    pool_run_tasks(tp, pool_case);
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+    f64* times = MGA_PUSH_ARRAY(scratch.arena, f64, repeats);
+
+    for (u32 i = 0; i < repeats; i++) {
+        u64 start = os_now_usec();
+        pool_run_tasks(tp, pool_case);
+        times[i] = (f64)(os_now_usec() - start) / 1000.0;
+    }
+
+    qsort(times, repeats, sizeof(f64), compare_f64);
+
+    result->wall_ms = times[0];
+    result->median_ms = times[repeats / 2];
+    result->mtasks_per_s = (f64)POOL_TASKS / (MAX(times[0], 1e-3) / 1000.0) / 1e6;
+
+    mga_scratch_release(scratch);
+}
+
+// Colors the same counts repeats times, after a run that warms the caches
+// and that the checksum comes from
+static void bench_colorize_run(
+    bench_colorize_result* result, thread_pool* tp, pixel8* image, const f32* iters, u32 iterations, u32 repeats
+) {
+    u64 count = (u64)result->width * result->height;
+
+    render_palette palette = { 0 };
+    render_palette_build(&palette, &(render_palette_desc){
+        .mode = result->mode,
+        .kernel = result->kernel
+    });
+
+    render_colorize(tp, image, iters, count, iterations, &palette);
+    result->checksum = bench_checksum(image, count * sizeof(pixel8));
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+    f64* times = MGA_PUSH_ARRAY(scratch.arena, f64, repeats);
+
+    for (u32 i = 0; i < repeats; i++) {
+        u64 start = os_now_usec();
+        render_colorize(tp, image, iters, count, iterations, &palette);
+        times[i] = (f64)(os_now_usec() - start) / 1000.0;
+    }
+
+    qsort(times, repeats, sizeof(f64), compare_f64);
+
+    result->wall_ms = times[0];
+    result->median_ms = times[repeats / 2];
+    result->mpixels_per_s = (f64)count / (MAX(times[0], 1e-3) / 1000.0) / 1e6;
+
+    mga_scratch_release(scratch);
+}
+
+// Compares the bits of the counts of two renders of the same view, and prints
+// how many differ and by how much. Returns the number of counts that differ
+static u64 bench_compare(
+    const f32* expected, const f32* actual, u32 width, u32 height,
+    u32 view, const char* expected_name, const char* actual_name
+) {
+    u64 count = (u64)width * height;
+    u64 num_different = 0;
+    u64 first = 0;
+    f64 max_diff = 0.0;
+
+    for (u64 i = 0; i < count; i++) {
+        if (memcmp(&expected[i], &actual[i], sizeof(f32)) == 0) {
+            continue;
+        }
+
+        if (num_different == 0) {
+            first = i;
+        }
+        num_different++;
+
+        f64 diff = (f64)actual[i] - (f64)expected[i];
+        max_diff = MAX(max_diff, diff < 0.0 ? -diff : diff);
+    }
+
+    fprintf(
+        stderr, "%-9s %5ux%-5u %s against %s: ",
+        views[view].name, width, height, actual_name, expected_name
+    );
+
+    if (num_different == 0) {
+        fprintf(stderr, "same\n");
+    } else {
+        fprintf(
+            stderr, "%llu of %llu counts differ by up to %g, the first at %llu,%llu (%.9g instead of %.9g)\n",
+            (unsigned long long)num_different, (unsigned long long)count, max_diff,
+            (unsigned long long)(first % width), (unsigned long long)(first / width),
+            (f64)actual[first], (f64)expected[first]
+        );
+    }
+
+    return num_different;
+}
+
+// Renders the view with every kernel the cpu supports and compares them to the scalar kernel.
+// Returns the number of renders that differ
+static u32 bench_check_kernels(
+    thread_pool* tp, f32* expected, f32* actual, u32 view, u32 width, u32 height,
+    const complex_fixedpt* center, render_method method
+) {
+    render_desc desc = { 0 };
+    bench_view_desc(&desc, view, width, height, center, RENDER_KERNEL_SCALAR, method);
+    render_mandelbrot_auto(tp, expected, &desc, center);
+
+    u32 num_failed = 0;
+
+    for (u32 k = RENDER_KERNEL_SCALAR + 1; k < RENDER_KERNEL_COUNT; k++) {
+        string8 name = render_kernel_name((render_kernel)k);
+
+        if (render_kernel_resolve((render_kernel)k) != (render_kernel)k) {
+            fprintf(
+                stderr, "%-9s %5ux%-5u %.*s: not supported by this cpu\n",
+                views[view].name, width, height, (int)name.size, (char*)name.str
+            );
+            continue;
+        }
+
+        desc.kernel = (render_kernel)k;
+        render_mandelbrot_auto(tp, actual, &desc, center);
+
+        char actual_name[32] = { 0 };
+        snprintf(actual_name, sizeof(actual_name), "%.*s", (int)name.size, (char*)name.str);
+
+        num_failed += bench_compare(expected, actual, width, height, view, "scalar", actual_name) != 0;
+    }
+
+    return num_failed;
+}
+
+// Renders the view with and without interior checks, which only skip iterations
+// of points that never escape, so the counts have to be the same.
+// Returns the number of renders that differ
+static u32 bench_check_interior(
+    thread_pool* tp, f32* expected, f32* actual, u32 view, u32 width, u32 height,
+    const complex_fixedpt* center, render_kernel kernel, render_method method
+) {
+    render_desc desc = { 0 };
+    bench_view_desc(&desc, view, width, height, center, kernel, method);
+
+    desc.interior_checks = false;
+    render_mandelbrot_auto(tp, expected, &desc, center);
+
+    desc.interior_checks = true;
+    render_mandelbrot_auto(tp, actual, &desc, center);
+
+    return bench_compare(expected, actual, width, height, view, "no interior checks", "interior checks") != 0;
+}
+
+// Colors the raw file at raw_path and compares it to the png at png_path.
+// Returns the number of pixels that differ, or count if either file cannot be read
+static u64 bench_compare_recolor(
+    thread_pool* tp, mg_arena* arena, const char* raw_path, const char* png_path,
+    const render_palette* palette, u32 width, u32 height
+) {
+    u64 count = (u64)width * height;
+    mga_temp temp = mga_temp_begin(arena);
+
+    export_raw_file raw = { 0 };
+    os_file_map png_file = { 0 };
+    fpng_img png = { 0 };
+
+    b32 opened = export_raw_open(&raw, raw_path);
+    b32 decoded = os_file_map_open(&png_file, png_path) &&
+        fpng_decode_memory(temp.arena, (string8){ .str = (u8*)png_file.data, .size = png_file.size }, &png, 4) == FPNG_DECODE_SUCCESS;
+
+    u64 num_different = count;
+    if (opened && decoded && raw.header.width == width && raw.header.height == height &&
+        png.width == width && png.height == height) {
+        f32* iters = MGA_PUSH_ARRAY(temp.arena, f32, count);
+        pixel8* image = MGA_PUSH_ARRAY(temp.arena, pixel8, count);
+
+        export_raw_read(tp, &raw, iters);
+        render_colorize(tp, image, iters, count, raw.header.iterations, palette);
+
+        num_different = 0;
+        for (u64 i = 0; i < count; i++) {
+            num_different += memcmp(&image[i], png.data + i * sizeof(pixel8), sizeof(pixel8)) != 0;
+        }
+    }
+
+    if (opened) {
+        export_raw_close(&raw);
+    }
+    if (png_file.data != NULL) {
+        os_file_map_close(&png_file);
+    }
+    mga_temp_end(temp);
+
+    return num_different;
+}
+
+// Exports the last frames of a zoom into the view with raw files, with both palettes,
+// and checks that coloring the raw files again gives the pixels of the pngs.
+// Returns the number of frames that differ
+static u32 bench_check_raw(
+    thread_pool* tp, mg_arena* arena, u32 view, u32 width, u32 height,
+    const complex_fixedpt* center, render_kernel kernel, render_method method
+) {
+    mga_temp temp = mga_temp_begin(arena);
+    exporter* ex = exporter_create(temp.arena, tp, width, height, 3);
+
+    u32 num_failed = 0;
+
+    for (u32 m = 0; m < RENDER_COLOR_COUNT; m++) {
+        render_palette palette = { 0 };
+        render_palette_build(&palette, &(render_palette_desc){
+            .mode = (render_color_mode)m,
+            .kernel = kernel
+        });
+
+        export_desc desc = {
+            .center = center,
+            .zoom_factor = 2.0,
+            .max_dim = 4.0,
+            .path_format = RAW_CHECK_PNG_FORMAT,
+            .raw_path_format = RAW_CHECK_RAW_FORMAT,
+            .palette = &palette
+        };
+        bench_view_desc(&desc.view, view, width, height, center, kernel, method);
+
+        u32 length = export_sequence_length(&desc);
+        desc.first_frame = length - MIN(length, RAW_CHECK_FRAMES);
+
+        u32 num_frames = exporter_zoom(ex, &desc);
+
+        for (u32 f = desc.first_frame; f < desc.first_frame + num_frames; f++) {
+            char png_path[64] = { 0 };
+            char raw_path[64] = { 0 };
+            snprintf(png_path, sizeof(png_path), RAW_CHECK_PNG_FORMAT, f);
+            snprintf(raw_path, sizeof(raw_path), RAW_CHECK_RAW_FORMAT, f);
+
+            u64 num_different = bench_compare_recolor(tp, temp.arena, raw_path, png_path, &palette, width, height);
+
+            fprintf(
+                stderr, "%-9s %5ux%-5u frame %u, %s palette, recolored raw file against png: ",
+                views[view].name, width, height, f, m == RENDER_COLOR_HISTOGRAM ? "histogram" : "cycle"
+            );
+            if (num_different == 0) {
+                fprintf(stderr, "same\n");
+            } else {
+                fprintf(
+                    stderr, "%llu of %llu pixels differ\n",
+                    (unsigned long long)num_different, (unsigned long long)width * height
+                );
+                num_failed++;
+            }
+
+            remove(png_path);
+            remove(raw_path);
+        }
+    }
+
+    exporter_destroy(ex);
+    mga_temp_end(temp);
+
+    return num_failed;
+}
+
+// Reads the results of an earlier run, which has one case per line (see bench_write)
+static u32 bench_read_baseline(const char* path, bench_result* results, u32 max_results) {
+#ifdef PLATFORM_WIN32
+    FILE* f = NULL;
+    fopen_s(&f, path, "rb");
+#else
+    FILE* f = fopen(path, "rb");
+#endif
+
+    if (f == NULL) {
+        return 0;
+    }
+
+    u32 num_results = 0;
+    char line[MAX_LINE_SIZE] = { 0 };
+
+    while (num_results < max_results && fgets(line, sizeof(line), f) != NULL) {
+        char name[64] = { 0 };
+        bench_result result = { 0 };
+        unsigned long long checksum = 0;
+
+        i32 matched = sscanf(
+            line,
+            " { \"view\": \"%63[^\"]\", \"width\": %u, \"height\": %u, \"threads\": %u,"
+            " \"wall_ms\": %lf, \"median_ms\": %lf, \"mpixels_per_s\": %lf, \"giters_per_s\": %lf,"
+            " \"imbalance\": %lf, \"checksum\": \"%llx\"",
+            name, &result.width, &result.height, &result.threads,
+            &result.wall_ms, &result.median_ms, &result.mpixels_per_s, &result.giters_per_s,
+            &result.imbalance, &checksum
+        );
+        if (matched != 10) {
+            continue;
+        }
+
+        result.checksum = checksum;
+        result.view = NUM_VIEWS;
+        for (u32 i = 0; i < NUM_VIEWS; i++) {
+            if (strcmp(name, views[i].name) == 0) {
+                result.view = i;
+            }
+        }
+
+        if (result.view != NUM_VIEWS) {
+            results[num_results++] = result;
+        }
+    }
+
+    fclose(f);
+
+    return num_results;
+}
+
+static void bench_write(
+    FILE* f, string8 kernel, const char* method, thread_affinity affinity, u32 repeats,
+    const bench_result* results, u32 num_results, const bench_pool_result* pool_results, u32 num_pool_results,
+    const bench_colorize_result* colorize_results, u32 num_colorize_results
+) {
+    fprintf(f, "{\n");
+    fprintf(f, "    \"kernel\": \"%.*s\",\n", (int)kernel.size, (char*)kernel.str);
+    fprintf(f, "    \"method\": \"%s\",\n", method);
+    fprintf(f, "    \"affinity\": \"%s\",\n", affinity_names[affinity]);
+    fprintf(f, "    \"cpus\": %u,\n", os_num_cpus());
+    fprintf(f, "    \"repeats\": %u,\n", repeats);
+    fprintf(f, "    \"results\": [\n");
+
+    for (u32 i = 0; i < num_results; i++) {
+        const bench_result* r = &results[i];
+
+        fprintf(
+            f,
+            "        { \"view\": \"%s\", \"width\": %u, \"height\": %u, \"threads\": %u,"
+            " \"wall_ms\": %.3f, \"median_ms\": %.3f, \"mpixels_per_s\": %.3f, \"giters_per_s\": %.4f,"
+            " \"imbalance\": %.4f, \"checksum\": \"%016llx\"",
+            views[r->view].name, r->width, r->height, r->threads,
+            r->wall_ms, r->median_ms, r->mpixels_per_s, r->giters_per_s,
+            r->imbalance, (unsigned long long)r->checksum
+        );
+        if (r->has_baseline) {
+            fprintf(
+                f, ", \"baseline_ms\": %.3f, \"speedup\": %.4f, \"checksum_changed\": %s",
+                r->baseline_ms, r->baseline_ms / MAX(r->wall_ms, 1e-3),
+                r->checksum_changed ? "true" : "false"
+            );
+        }
+        fprintf(f, " }%s\n", i + 1 < num_results ? "," : "");
+    }
+
+    fprintf(f, "    ],\n");
+    fprintf(f, "    \"pool\": [\n");
+
+    for (u32 i = 0; i < num_pool_results; i++) {
+        const bench_pool_result* r = &pool_results[i];
+        const bench_pool_case* pool_case = &pool_cases[r->pool_case];
+
+        fprintf(
+            f,
+            "        { \"api\": \"%s\", \"batch\": %u, \"threads\": %u,"
+            " \"wall_ms\": %.3f, \"median_ms\": %.3f, \"mtasks_per_s\": %.3f }%s\n",
+            pool_case->parallel_for ? "parallel_for" : "add_task", pool_case->batch, r->threads,
+            r->wall_ms, r->median_ms, r->mtasks_per_s, i + 1 < num_pool_results ? "," : ""
+        );
+    }
+
+    fprintf(f, "    ],\n");
+    fprintf(f, "    \"colorize\": [\n");
+
+    for (u32 i = 0; i < num_colorize_results; i++) {
+        const bench_colorize_result* r = &colorize_results[i];
+        string8 kernel_name = render_kernel_name(r->kernel);
+
+        fprintf(
+            f,
+            "        { \"view\": \"%s\", \"width\": %u, \"height\": %u, \"threads\": %u,"
+            " \"mode\": \"%s\", \"kernel\": \"%.*s\", \"wall_ms\": %.3f, \"median_ms\": %.3f,"
+            " \"mpixels_per_s\": %.3f, \"checksum\": \"%016llx\" }%s\n",
+            views[r->view].name, r->width, r->height, r->threads,
+            r->mode == RENDER_COLOR_HISTOGRAM ? "histogram" : "cycle",
+            (int)kernel_name.size, (char*)kernel_name.str, r->wall_ms, r->median_ms,
+            r->mpixels_per_s, (unsigned long long)r->checksum, i + 1 < num_colorize_results ? "," : ""
+        );
+    }
+
+    fprintf(f, "    ]\n");
+    fprintf(f, "}\n");
+}
+
+int main(int argc, char** argv) {
+    u32 widths[MAX_RESOLUTIONS] = { 640, 1920 };
+    u32 heights[MAX_RESOLUTIONS] = { 360, 1080 };
+    u32 num_resolutions = 0;
+    u32 thread_counts[MAX_THREAD_COUNTS] = { 0 };
+    u32 num_thread_counts = 0;
+    b32 view_enabled[NUM_VIEWS] = { 0 };
+    b32 views_given = false;
+    u32 repeats = 3;
+    thread_affinity affinity = THREAD_AFFINITY_NONE;
+    render_kernel kernel = RENDER_KERNEL_AUTO;
+    render_method method = RENDER_METHOD_TILES;
+    const char* out_path = NULL;
+    const char* baseline_path = NULL;
+    f64 tolerance = 5.0;
+    u32 checks = 0;
+    u32 cases = 0;
+
+    for (i32 i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        b32 valid = true;
+
+        // Every option takes a value
+        if (i + 1 >= argc) {
+            valid = false;
+        } else if (arg_is(arg, "-s", "--size")) {
+            valid = num_resolutions < MAX_RESOLUTIONS &&
+                parse_size(argv[++i], &widths[num_resolutions], &heights[num_resolutions]);
+            num_resolutions++;
+        } else if (arg_is(arg, "-t", "--threads")) {
+            valid = num_thread_counts < MAX_THREAD_COUNTS &&
+                parse_u32(argv[++i], &thread_counts[num_thread_counts]);
+            num_thread_counts++;
+        } else if (arg_is(arg, "-v", "--view")) {
+            const char* name = argv[++i];
+            valid = false;
+            for (u32 v = 0; v < NUM_VIEWS; v++) {
+                if (strcmp(name, views[v].name) == 0) {
+                    view_enabled[v] = true;
+                    valid = true;
+                }
+            }
+            views_given = true;
+        } else if (arg_is(arg, "-n", "--repeats")) {
+            valid = parse_u32(argv[++i], &repeats);
+        } else if (strcmp(arg, "--affinity") == 0) {
+            valid = parse_affinity(argv[++i], &affinity);
+        } else if (arg_is(arg, "-k", "--kernel")) {
+            string8 name = str8_from_cstr((u8*)argv[++i]);
+            valid = false;
+            for (u32 k = 0; k < RENDER_KERNEL_COUNT; k++) {
+                if (str8_equals(name, render_kernel_name((render_kernel)k))) {
+                    kernel = (render_kernel)k;
+                    valid = true;
+                }
+            }
+        } else if (arg_is(arg, "-m", "--method")) {
+            string8 name = str8_from_cstr((u8*)argv[++i]);
+            if (str8_equals(name, STR8("tiles"))) {
+                method = RENDER_METHOD_TILES;
+            } else if (str8_equals(name, STR8("subdivide"))) {
+                method = RENDER_METHOD_SUBDIVIDE;
+            } else {
+                valid = false;
+            }
+        } else if (arg_is(arg, "-o", "--out")) {
+            out_path = argv[++i];
+        } else if (strcmp(arg, "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if (strcmp(arg, "--check") == 0) {
+            const char* name = argv[++i];
+            if (strcmp(name, "kernels") == 0) {
+                checks |= BENCH_CHECK_KERNELS;
+            } else if (strcmp(name, "interior") == 0) {
+                checks |= BENCH_CHECK_INTERIOR;
+            } else if (strcmp(name, "raw") == 0) {
+                checks |= BENCH_CHECK_RAW;
+            } else {
+                valid = false;
+            }
+        } else if (strcmp(arg, "--case") == 0) {
+            const char* name = argv[++i];
+            if (strcmp(name, "render") == 0) {
+                cases |= BENCH_CASE_RENDER;
+            } else if (strcmp(name, "pool") == 0) {
+                cases |= BENCH_CASE_POOL;
+            } else if (strcmp(name, "colorize") == 0) {
+                cases |= BENCH_CASE_COLORIZE;
+            } else {
+                valid = false;
+            }
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            char* end = NULL;
+            tolerance = strtod(argv[++i], &end);
+            valid = *end == '\0' && tolerance >= 0.0;
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "invalid argument \"%s\"\n", arg);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (num_resolutions == 0) {
+        num_resolutions = 2;
+    }
+    if (num_thread_counts == 0) {
+        thread_counts[num_thread_counts++] = 1;
+        if (os_num_cpus() > 1) {
+            thread_counts[num_thread_counts++] = os_num_cpus();
+        }
+    }
+    if (cases == 0) {
+        cases = BENCH_CASE_RENDER;
+    }
+    if (!views_given) {
+        for (u32 v = 0; v < NUM_VIEWS; v++) {
+            view_enabled[v] = true;
+        }
+    }
+
+    u64 max_pixels = 0;
+    u32 max_threads = 0;
+    for (u32 i = 0; i < num_resolutions; i++) {
+        max_pixels = MAX(max_pixels, (u64)widths[i] * heights[i]);
+    }
+    for (u32 i = 0; i < num_thread_counts; i++) {
+        max_threads = MAX(max_threads, thread_counts[i]);
+    }
+
+    // Checks compare against a second buffer, and colorize cases color into an image.
+    // The raw check also holds the buffers of an exporter, and a frame read back
+    // from each of the files
+    u64 raw_check_size = (checks & BENCH_CHECK_RAW) ? (3 * 2 + 4) * sizeof(f32) * max_pixels : 0;
+    mg_arena* perm_arena = mga_create(&(mga_desc){
+        .desired_max_size = MGA_MiB(64) + (2 * sizeof(f32) + sizeof(pixel8)) * max_pixels + raw_check_size,
+        .desired_block_size = MGA_KiB(256),
+        .error_callback = mga_err
+    });
+
+    fpng_init();
+
+    f32* iters = MGA_PUSH_ARRAY(perm_arena, f32, max_pixels);
+    u64* busy_start = MGA_PUSH_ZERO_ARRAY(perm_arena, u64, max_threads);
+    u64* busy_end = MGA_PUSH_ZERO_ARRAY(perm_arena, u64, max_threads);
+
+    complex_fixedpt* centers = MGA_PUSH_ZERO_ARRAY(perm_arena, complex_fixedpt, NUM_VIEWS);
+    for (u32 v = 0; v < NUM_VIEWS; v++) {
+        centers[v] = complex_fixedpt_create(perm_arena, fixedpt_limbs_for_bits(CENTER_FRAC_BITS));
+
+        fixedpt_from_str8(&centers[v].r, str8_from_cstr((u8*)views[v].center_r));
+        fixedpt_from_str8(&centers[v].i, str8_from_cstr((u8*)views[v].center_i));
+    }
+
+    if (checks != 0) {
+        f32* expected = MGA_PUSH_ARRAY(perm_arena, f32, max_pixels);
+        thread_pool* tp = thread_pool_create(perm_arena, max_threads, 128);
+        u32 num_failed = 0;
+
+        for (u32 v = 0; v < NUM_VIEWS; v++) {
+            for (u32 s = 0; s < num_resolutions && view_enabled[v]; s++) {
+                if (checks & BENCH_CHECK_KERNELS) {
+                    num_failed += bench_check_kernels(tp, expected, iters, v, widths[s], heights[s], &centers[v], method);
+                }
+                if (checks & BENCH_CHECK_INTERIOR) {
+                    num_failed += bench_check_interior(tp, expected, iters, v, widths[s], heights[s], &centers[v], kernel, method);
+                }
+                if (checks & BENCH_CHECK_RAW) {
+                    num_failed += bench_check_raw(tp, perm_arena, v, widths[s], heights[s], &centers[v], kernel, method);
+                }
+            }
+        }
+
+        thread_pool_destroy(tp);
+        mga_destroy(perm_arena);
+
+        if (num_failed > 0) {
+            fprintf(stderr, "%u renders differ\n", num_failed);
+        }
+
+        return num_failed > 0 ? 1 : 0;
+    }
+
+    bench_result* results = MGA_PUSH_ZERO_ARRAY(perm_arena, bench_result, MAX_CASES);
+    u32 num_results = 0;
+
+    bench_pool_result* pool_results = MGA_PUSH_ZERO_ARRAY(perm_arena, bench_pool_result, MAX_CASES);
+    u32 num_pool_results = 0;
+
+    bench_colorize_result* colorize_results = MGA_PUSH_ZERO_ARRAY(perm_arena, bench_colorize_result, MAX_CASES);
+    u32 num_colorize_results = 0;
+
+    bench_result* baseline = MGA_PUSH_ZERO_ARRAY(perm_arena, bench_result, MAX_CASES);
+    u32 num_baseline = 0;
+    if (baseline_path != NULL) {
+        num_baseline = bench_read_baseline(baseline_path, baseline, MAX_CASES);
+
+        if (num_baseline == 0) {
+            fprintf(stderr, "%s: no results to compare against\n", baseline_path);
+            mga_destroy(perm_arena);
+            return 1;
+        }
+    }
+
+    string8 kernel_name = render_kernel_name(render_kernel_resolve(kernel));
+    const char* method_name = method == RENDER_METHOD_SUBDIVIDE ? "subdivide" : "tiles";
+    fprintf(stderr, "render kernel: %.*s, method: %s\n", (int)kernel_name.size, (char*)kernel_name.str, method_name);
+
+    u32 regressions = 0;
+
+    for (u32 t = 0; t < num_thread_counts && (cases & BENCH_CASE_RENDER); t++) {
+        thread_pool* tp = thread_pool_create(perm_arena, thread_counts[t], 128);
+        if (affinity != THREAD_AFFINITY_NONE && !thread_pool_set_affinity(tp, affinity)) {
+            fprintf(stderr, "cannot pin the worker threads, they run unpinned\n");
+        }
+
+        for (u32 v = 0; v < NUM_VIEWS; v++) {
+            if (!view_enabled[v]) {
+                continue;
+            }
+
+            for (u32 s = 0; s < num_resolutions && num_results < MAX_CASES; s++) {
+                const bench_view* view = &views[v];
+
+                render_desc desc = { 0 };
+                bench_view_desc(&desc, v, widths[s], heights[s], &centers[v], kernel, method);
+
+                bench_result* result = &results[num_results++];
+                *result = (bench_result){
+                    .view = v,
+                    .width = widths[s],
+                    .height = heights[s],
+                    .threads = thread_counts[t]
+                };
+
+                bench_run(result, tp, iters, busy_start, busy_end, &desc, &centers[v], repeats);
+
+                fprintf(
+                    stderr, "%-9s %5ux%-5u %3u threads: %9.2f ms, %8.2f Mpixels/s, %7.3f Giter/s, imbalance %.3f",
+                    view->name, result->width, result->height, result->threads,
+                    result->wall_ms, result->mpixels_per_s, result->giters_per_s, result->imbalance
+                );
+
+                for (u32 b = 0; b < num_baseline; b++) {
+                    const bench_result* base = &baseline[b];
+                    if (base->view != v || base->width != result->width ||
+                        base->height != result->height || base->threads != result->threads) {
+                        continue;
+                    }
+
+                    result->has_baseline = true;
+                    result->baseline_ms = base->wall_ms;
+                    result->checksum_changed = base->checksum != result->checksum;
+
+                    f64 change = (result->wall_ms / MAX(base->wall_ms, 1e-3) - 1.0) * 100.0;
+                    fprintf(stderr, ", %+.1f%% vs baseline", change);
+
+                    if (change > tolerance) {
+                        fprintf(stderr, " (slower)");
+                        regressions++;
+                    }
+                    if (result->checksum_changed) {
+                        fprintf(stderr, " (different output)");
+                    }
+                }
+
+                fprintf(stderr, "\n");
+            }
+        }
+
+        thread_pool_destroy(tp);
+    }
+
+    for (u32 t = 0; t < num_thread_counts && (cases & BENCH_CASE_POOL); t++) {
+        thread_pool* tp = thread_pool_create(perm_arena, thread_counts[t], POOL_QUEUE_SIZE);
+        if (affinity != THREAD_AFFINITY_NONE && !thread_pool_set_affinity(tp, affinity)) {
+            fprintf(stderr, "cannot pin the worker threads, they run unpinned\n");
+        }
+
+        for (u32 c = 0; c < NUM_POOL_CASES && num_pool_results < MAX_CASES; c++) {
+            bench_pool_result* result = &pool_results[num_pool_results++];
+            *result = (bench_pool_result){
+                .pool_case = c,
+                .threads = thread_counts[t]
+            };
+
+            bench_pool_run(result, tp, repeats);
+
+            fprintf(
+                stderr, "%-12s batch %-6u %3u threads: %9.2f ms, %8.2f Mtasks/s\n",
+                pool_cases[c].parallel_for ? "parallel_for" : "add_task", pool_cases[c].batch,
+                result->threads, result->wall_ms, result->mtasks_per_s
+            );
+        }
+
+        thread_pool_destroy(tp);
+    }
+
+    if (cases & BENCH_CASE_COLORIZE) {
+        pixel8* image = MGA_PUSH_ARRAY(perm_arena, pixel8, max_pixels);
+
+        if (!fpng_cpu_supports_avx2()) {
+            fprintf(stderr, "avx2 colorize: not supported by this cpu\n");
+        }
+
+        for (u32 t = 0; t < num_thread_counts; t++) {
+            thread_pool* tp = thread_pool_create(perm_arena, thread_counts[t], 128);
+            if (affinity != THREAD_AFFINITY_NONE && !thread_pool_set_affinity(tp, affinity)) {
+                fprintf(stderr, "cannot pin the worker threads, they run unpinned\n");
+            }
+
+            for (u32 v = 0; v < NUM_VIEWS; v++) {
+                for (u32 s = 0; s < num_resolutions && view_enabled[v]; s++) {
+                    render_desc desc = { 0 };
+                    bench_view_desc(&desc, v, widths[s], heights[s], &centers[v], kernel, method);
+                    render_mandelbrot_auto(tp, iters, &desc, &centers[v]);
+
+                    for (u32 m = 0; m < RENDER_COLOR_COUNT; m++) {
+                        u64 scalar_checksum = 0;
+
+                        for (u32 k = 0; k < NUM_COLORIZE_KERNELS && num_colorize_results < MAX_CASES; k++) {
+                            if (render_kernel_resolve(colorize_kernels[k]) != colorize_kernels[k]) {
+                                continue;
+                            }
+
+                            bench_colorize_result* result = &colorize_results[num_colorize_results++];
+                            *result = (bench_colorize_result){
+                                .view = v,
+                                .width = widths[s],
+                                .height = heights[s],
+                                .threads = thread_counts[t],
+                                .mode = (render_color_mode)m,
+                                .kernel = colorize_kernels[k]
+                            };
+
+                            bench_colorize_run(result, tp, image, iters, desc.iterations, repeats);
+
+                            string8 name = render_kernel_name(result->kernel);
+                            fprintf(
+                                stderr, "%-9s %5ux%-5u %3u threads: %-9s %-6.*s %9.2f ms, %8.2f Mpixels/s",
+                                views[v].name, result->width, result->height, result->threads,
+                                m == RENDER_COLOR_HISTOGRAM ? "histogram" : "cycle",
+                                (int)name.size, (char*)name.str, result->wall_ms, result->mpixels_per_s
+                            );
+
+                            if (result->kernel == RENDER_KERNEL_SCALAR) {
+                                scalar_checksum = result->checksum;
+                            } else if (result->checksum != scalar_checksum) {
+                                fprintf(stderr, " (different colors than scalar)");
+                            }
+
+                            fprintf(stderr, "\n");
+                        }
+                    }
+                }
+            }
+
+            thread_pool_destroy(tp);
+        }
+    }
+
+    b32 written = true;
+    if (out_path == NULL) {
+        bench_write(stdout, kernel_name, method_name, affinity, repeats, results, num_results, pool_results, num_pool_results, colorize_results, num_colorize_results);
+    } else {
+#ifdef PLATFORM_WIN32
+        FILE* f = NULL;
+        fopen_s(&f, out_path, "wb");
+#else
+        FILE* f = fopen(out_path, "wb");
+#endif
+
+        if (f != NULL) {
+            bench_write(f, kernel_name, method_name, affinity, repeats, results, num_results, pool_results, num_pool_results, colorize_results, num_colorize_results);
+            written = fclose(f) == 0;
+        } else {
+            written = false;
+        }
+    }
+
+    if (!written) {
+        fprintf(stderr, "%s: failed to write results\n", out_path);
+    }
+    if (regressions > 0) {
+        fprintf(stderr, "%u cases slower than the baseline by more than %.1f%%\n", regressions, tolerance);
+    }
+
+    mga_destroy(perm_arena);
+
+    return (!written || regressions > 0) ? 1 : 0;
+}
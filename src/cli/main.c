@@ -0,0 +1,802 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base/base.h"
+#include "os/os.h"
+#include "os/os_thread_pool.h"
+
+#include "math/math_complex.h"
+#include "math/math_fixed.h"
+#include "render/render.h"
+#include "export/export.h"
+#include "trace/trace.h"
+
+#include "fpng/fpng.h"
+
+// Headless renderer, for batch jobs on machines without a display.
+// Only links against libc, libm and pthreads.
+//
+// Single image:
+//     Fractal-Renderer-CLI --center -0.743643887 0.131825904 --dim 1e-6 --iterations 4096 -o out.png
+// Batch, one image per stdin line of "re im dim iterations path",
+// with the thread pool and buffers shared between all of them:
+//     Fractal-Renderer-CLI --width 3840 --height 2160 --batch < jobs.txt
+// Coloring raw iteration files (see export.h) without rendering them again,
+// with - reading "raw_path png_path" lines from stdin:
+//     Fractal-Renderer-CLI --recolor frame.raw -o frame.png
+//     Fractal-Renderer-CLI --recolor - < frames.txt
+// Zoom sequences, from the widest view down to the one given, with one %u in the path
+// for the frame index. Frames only depend on their index, so a range of them can be
+// exported on its own, and several processes or machines can share a sequence:
+//     Fractal-Renderer-CLI --center -0.743643887 0.131825904 --dim 1e-6 --zoom frames/%.4u.png
+//     Fractal-Renderer-CLI ... --zoom frames/%.4u.png --first-frame 20 --num-frames 20
+// With --raw every frame also gets a raw file, which --recolor colors again:
+//     Fractal-Renderer-CLI ... --zoom frames/%.4u.png --raw
+//     Fractal-Renderer-CLI --recolor frames/0012.raw --period 20 -o 0012.png
+// Keeping the iteration counts of every render in a tile cache file, which later runs
+// and other processes rendering at the same time take whatever overlaps from:
+//     Fractal-Renderer-CLI --cache tiles.cache --batch < jobs.txt
+// Builds with tracing (see trace.h) can write a timeline of every stage with --trace trace.json
+
+// Bits after the point for parsed centers, the same as the interactive view
+#define CENTER_FRAC_BITS 1088
+
+#define MAX_LINE_SIZE 16384
+
+// Memory part of the tile cache, the file is as big as --cache-size
+#define CACHE_MEMORY_SIZE MGA_MiB(128)
+
+// Zones kept per thread with --trace
+#define TRACE_EVENTS_PER_THREAD (1 << 18)
+
+// Frames of a zoom sequence in flight at once, one per stage of the exporter
+#define ZOOM_BUFFERS 3
+
+typedef struct {
+    thread_pool* tp;
+    render_desc desc;
+
+    f32* iters;
+    pixel8* image;
+    complex_fixedpt center;
+
+    render_palette palette;
+    render_aa_desc aa;
+
+    // NULL without --cache
+    render_cache* cache;
+
+    // Also write the iteration counts of every render
+    b32 write_raw;
+    u8* raw;
+
+    u32 num_images;
+    u64 pixels;
+    u64 render_usec;
+    u64 colorize_usec;
+    u64 encode_usec;
+    u64 write_usec;
+} cli_state;
+
+static void mga_err(mga_error err) {
+    fprintf(stderr, "MGA ERROR %d: %s\n", err.code, err.msg);
+}
+
+static void print_usage(const char* name) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -w, --width <n>         image width (default 1920)\n"
+        "  -h, --height <n>        image height (default 1080)\n"
+        "  -c, --center <re> <im>  view center, decimals of any length (default 0 0)\n"
+        "  -d, --dim <x>           view width in the complex plane (default 4)\n"
+        "  -i, --iterations <n>    maximum iterations (default 1024)\n"
+        "  -k, --kernel <name>     auto, scalar, avx2 or avx512 (default auto)\n"
+        "  -m, --method <name>     tiles or subdivide (default tiles)\n"
+        "      --period <x>        iterations per cycle of the palette (default 62.8)\n"
+        "      --offset <x>        shifts the palette by a fraction of a cycle\n"
+        "      --exposure <x>      multiplies every color (default 1)\n"
+        "      --histogram         spread the palette evenly over the escaped pixels\n"
+        "      --cycles <x>        cycles of the palette over the image with --histogram (default 1)\n"
+        "  -a, --aa <n>            anti-alias edges with n x n samples per pixel\n"
+        "      --aa-threshold <x>  spread of neighbouring iterations that gets anti-aliased (default 4)\n"
+        "      --cache <path>      keep iteration counts in a tile cache file shared between runs\n"
+        "      --cache-size <n>    size of a new tile cache file in MiB (default 1024)\n"
+        "  -t, --threads <n>       worker threads (default all cpus)\n"
+        "      --affinity <name>   pin the workers to cpus, none, compact or scatter (default none)\n"
+        "  -o, --out <path>        output png (default out.png)\n"
+        "  -r, --raw               also write the iteration counts, to the output path with .raw,\n"
+        "                          or for every frame of a zoom sequence\n"
+        "      --recolor <path>    color a raw file instead of rendering,\n"
+        "                          - reads \"raw_path png_path\" jobs from stdin\n"
+        "  -b, --batch             read \"re im dim iterations path\" jobs from stdin\n"
+        "      --zoom <format>     export a zoom sequence that ends at the view, format is\n"
+        "                          the output path with one %%u for the frame index\n"
+        "      --zoom-factor <x>   zoom from one frame to the next (default 1.5)\n"
+        "      --max-dim <x>       dim of the widest frame (default 4)\n"
+        "      --first-frame <n>   first frame of the sequence to export (default 0)\n"
+        "      --num-frames <n>    frames to export from the first one (default all)\n",
+        name
+    );
+#ifdef TRACE_ENABLED
+    fprintf(stderr, "      --trace <path>      write a Chrome trace of every stage\n");
+#endif
+}
+
+static b32 arg_is(const char* arg, const char* short_name, const char* long_name) {
+    return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+static b32 parse_u32(const char* str, u32* out) {
+    char* end = NULL;
+    unsigned long value = strtoul(str, &end, 10);
+
+    if (end == str || *end != '\0' || value == 0 || value > 0xffffffff) {
+        return false;
+    }
+
+    *out = (u32)value;
+    return true;
+}
+
+// Same as parse_u32, but zero is valid
+static b32 parse_index(const char* str, u32* out) {
+    if (strcmp(str, "0") == 0) {
+        *out = 0;
+        return true;
+    }
+
+    return parse_u32(str, out);
+}
+
+static b32 parse_f64(const char* str, f64* out) {
+    char* end = NULL;
+    f64 value = strtod(str, &end);
+
+    if (end == str || *end != '\0' || !(value > 0.0)) {
+        return false;
+    }
+
+    *out = value;
+    return true;
+}
+
+static b32 parse_f32(const char* str, f32* out) {
+    f64 value = 0.0;
+    if (!parse_f64(str, &value)) {
+        return false;
+    }
+
+    *out = (f32)value;
+    return true;
+}
+
+static b32 parse_affinity(const char* str, thread_affinity* out) {
+    static const char* names[THREAD_AFFINITY_COUNT] = { "none", "compact", "scatter" };
+
+    for (u32 i = 0; i < THREAD_AFFINITY_COUNT; i++) {
+        if (strcmp(str, names[i]) == 0) {
+            *out = (thread_affinity)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The frame index is the only argument the format is given,
+// so it has to have exactly one conversion, and that one an unsigned integer
+static b32 valid_frame_format(const char* format) {
+    u32 num_conversions = 0;
+
+    for (const char* c = format; *c != '\0'; c++) {
+        if (*c != '%') {
+            continue;
+        }
+        if (c[1] == '%') {
+            c++;
+            continue;
+        }
+
+        c++;
+        while (*c == '0' || *c == '-' || *c == '.' || (*c >= '1' && *c <= '9')) {
+            c++;
+        }
+        if (*c != 'u') {
+            return false;
+        }
+
+        num_conversions++;
+    }
+
+    return num_conversions == 1;
+}
+
+static b32 write_file(const char* path, string8 data) {
+#ifdef PLATFORM_WIN32
+    FILE* f = NULL;
+    fopen_s(&f, path, "wb");
+#else
+    FILE* f = fopen(path, "wb");
+#endif
+
+    if (f == NULL) {
+        return false;
+    }
+
+    b32 ok = fwrite(data.str, 1, data.size, f) == data.size;
+    ok = (fclose(f) == 0) && ok;
+
+    return ok;
+}
+
+// Replaces a .png extension with .raw, or appends .raw
+static void raw_path_from_png(char* out, u64 out_size, const char* path) {
+    u64 len = strlen(path);
+    if (len >= 4 && strcmp(path + len - 4, ".png") == 0) {
+        len -= 4;
+    }
+
+    snprintf(out, out_size, "%.*s.raw", (int)len, path);
+}
+
+static b32 cli_render(cli_state* state, const char* center_r, const char* center_i, f64 dim, u32 iterations, const char* path) {
+    if (!fixedpt_from_str8(&state->center.r, str8_from_cstr((u8*)center_r)) ||
+        !fixedpt_from_str8(&state->center.i, str8_from_cstr((u8*)center_i))) {
+        fprintf(stderr, "%s: invalid center \"%s\" \"%s\"\n", path, center_r, center_i);
+        return false;
+    }
+
+    render_desc* desc = &state->desc;
+    desc->center = (complexd){ fixedpt_to_f64(&state->center.r), fixedpt_to_f64(&state->center.i) };
+    desc->dim = (complexd){ dim, dim * (f64)desc->height / (f64)desc->width };
+    desc->iterations = iterations;
+
+    // Cached views are moved onto the points of the cache, and the anti-aliasing
+    // and raw file have to agree with where the pixels ended up
+    render_cache_view cache_view = { 0 };
+    if (state->cache != NULL) {
+        render_cache_view_init(&cache_view, desc);
+    }
+
+    u64 start = os_now_usec();
+
+    TRACE_ZONE_BEGIN(render_zone, "render");
+    render_mandelbrot_cached(state->cache, state->tp, state->iters, desc, &state->center);
+    TRACE_ZONE_END(render_zone);
+
+    u64 rendered = os_now_usec();
+
+    TRACE_ZONE_BEGIN(color_zone, "colorize");
+    u64 refined = render_colorize_aa(state->tp, state->image, state->iters, desc, &state->center, &state->palette, &state->aa);
+    TRACE_ZONE_END(color_zone);
+
+    u64 colored = os_now_usec();
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    fpng_img img = {
+        .channels = 4,
+        .width = desc->width,
+        .height = desc->height,
+        .data = (u8*)state->image
+    };
+    string8 png = { 0 };
+    // The render pool is idle until the next image, so it encodes the bands
+    TRACE_ZONE_BEGIN(encode_zone, "encode");
+    b32 encoded = fpng_encode_image_to_memory_mt(scratch.arena, &img, &png, 0, state->tp);
+    TRACE_ZONE_END(encode_zone);
+
+    u64 encode_end = os_now_usec();
+
+    TRACE_ZONE_BEGIN(write_zone, "write");
+    b32 written = encoded && write_file(path, png);
+
+    char raw_path[1024] = { 0 };
+    if (written && state->write_raw) {
+        raw_path_from_png(raw_path, sizeof(raw_path), path);
+
+        string8 raw = { .str = state->raw, .size = export_raw_size(desc->width, desc->height) };
+        export_raw_pack(raw.str, state->iters, desc);
+
+        written = write_file(raw_path, raw);
+    }
+    TRACE_ZONE_END(write_zone);
+
+    u64 end = os_now_usec();
+
+    mga_scratch_release(scratch);
+
+    if (!encoded) {
+        fprintf(stderr, "%s: failed to encode png\n", path);
+        return false;
+    }
+    if (!written) {
+        fprintf(stderr, "%s: failed to write file\n", raw_path[0] != '\0' ? raw_path : path);
+        return false;
+    }
+
+    state->num_images++;
+    state->pixels += (u64)desc->width * desc->height;
+    state->render_usec += rendered - start;
+    state->colorize_usec += colored - rendered;
+    state->encode_usec += encode_end - colored;
+    state->write_usec += end - encode_end;
+
+    printf(
+        "%s: %ux%u, dim %g, %u iterations, render %.1f ms, colorize %.1f ms, encode %.1f ms, write %.1f ms",
+        path, desc->width, desc->height, dim, iterations,
+        (f64)(rendered - start) / 1000.0,
+        (f64)(colored - rendered) / 1000.0,
+        (f64)(encode_end - colored) / 1000.0,
+        (f64)(end - encode_end) / 1000.0
+    );
+    if (state->aa.samples > 1) {
+        printf(", %.1f%% anti-aliased", 100.0 * (f64)refined / (f64)((u64)desc->width * desc->height));
+    }
+    printf("\n");
+
+    return true;
+}
+
+static b32 cli_recolor(cli_state* state, const char* raw_path, const char* path) {
+    u64 start = os_now_usec();
+
+    export_raw_file file = { 0 };
+    if (!export_raw_open(&file, raw_path)) {
+        fprintf(stderr, "%s: not a raw iteration file\n", raw_path);
+        return false;
+    }
+
+    u32 width = file.header.width;
+    u32 height = file.header.height;
+    u64 image_size = sizeof(pixel8) * (u64)width * height;
+
+    // Raw files can be any size, so they do not use the buffers of the render
+    mg_arena* arena = mga_create(&(mga_desc){
+        .desired_max_size = MGA_MiB(1) + image_size * 4,
+        .desired_block_size = MGA_MiB(1)
+    });
+    f32* iters = MGA_PUSH_ARRAY(arena, f32, (u64)width * height);
+    pixel8* image = MGA_PUSH_ARRAY(arena, pixel8, (u64)width * height);
+
+    export_raw_read(state->tp, &file, iters);
+    render_colorize(state->tp, image, iters, (u64)width * height, file.header.iterations, &state->palette);
+    export_raw_close(&file);
+
+    u64 colored = os_now_usec();
+
+    fpng_img img = {
+        .channels = 4,
+        .width = width,
+        .height = height,
+        .data = (u8*)image
+    };
+    string8 png = { 0 };
+    b32 encoded = fpng_encode_image_to_memory_mt(arena, &img, &png, 0, state->tp);
+
+    u64 encode_end = os_now_usec();
+
+    b32 written = encoded && write_file(path, png);
+
+    u64 end = os_now_usec();
+
+    mga_destroy(arena);
+
+    if (!encoded) {
+        fprintf(stderr, "%s: failed to encode png\n", path);
+        return false;
+    }
+    if (!written) {
+        fprintf(stderr, "%s: failed to write file\n", path);
+        return false;
+    }
+
+    state->num_images++;
+    state->pixels += (u64)width * height;
+    state->colorize_usec += colored - start;
+    state->encode_usec += encode_end - colored;
+    state->write_usec += end - encode_end;
+
+    printf(
+        "%s: %ux%u, colorize %.1f ms, encode %.1f ms, write %.1f ms\n",
+        path, width, height,
+        (f64)(colored - start) / 1000.0,
+        (f64)(encode_end - colored) / 1000.0,
+        (f64)(end - encode_end) / 1000.0
+    );
+
+    return true;
+}
+
+// Splits line in place on whitespace, returns the number of tokens found
+static u32 split_line(char* line, char** tokens, u32 max_tokens) {
+    u32 num_tokens = 0;
+    char* c = line;
+
+    while (*c != '\0') {
+        while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n') {
+            *c++ = '\0';
+        }
+        if (*c == '\0') {
+            break;
+        }
+
+        if (num_tokens == max_tokens) {
+            return max_tokens + 1;
+        }
+        tokens[num_tokens++] = c;
+
+        while (*c != '\0' && *c != ' ' && *c != '\t' && *c != '\r' && *c != '\n') {
+            c++;
+        }
+    }
+
+    return num_tokens;
+}
+
+static u32 cli_run_recolor_batch(cli_state* state, mg_arena* arena) {
+    char* line = MGA_PUSH_ARRAY(arena, char, MAX_LINE_SIZE);
+    u32 failed = 0;
+    u32 line_num = 0;
+
+    while (fgets(line, MAX_LINE_SIZE, stdin) != NULL) {
+        line_num++;
+
+        char* tokens[2] = { 0 };
+        u32 num_tokens = split_line(line, tokens, 2);
+
+        if (num_tokens == 0 || tokens[0][0] == '#') {
+            continue;
+        }
+
+        if (num_tokens != 2) {
+            fprintf(stderr, "line %u: expected \"raw_path png_path\"\n", line_num);
+            failed++;
+            continue;
+        }
+
+        if (!cli_recolor(state, tokens[0], tokens[1])) {
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+static b32 cli_zoom(
+    cli_state* state, mg_arena* arena, export_desc* desc,
+    const char* center_r, const char* center_i, f64 dim, u32 iterations
+) {
+    if (!fixedpt_from_str8(&state->center.r, str8_from_cstr((u8*)center_r)) ||
+        !fixedpt_from_str8(&state->center.i, str8_from_cstr((u8*)center_i))) {
+        fprintf(stderr, "invalid center \"%s\" \"%s\"\n", center_r, center_i);
+        return false;
+    }
+
+    render_desc* view = &desc->view;
+    *view = state->desc;
+    view->center = (complexd){ fixedpt_to_f64(&state->center.r), fixedpt_to_f64(&state->center.i) };
+    view->dim = (complexd){ dim, dim * (f64)view->height / (f64)view->width };
+    view->iterations = iterations;
+
+    // Same as the paths of single images, with .raw in place of .png
+    char raw_path_format[1024] = { 0 };
+    if (state->write_raw) {
+        raw_path_from_png(raw_path_format, sizeof(raw_path_format), desc->path_format);
+        desc->raw_path_format = raw_path_format;
+    }
+
+    desc->center = &state->center;
+    desc->palette = &state->palette;
+    desc->aa = state->aa;
+
+    u32 length = export_sequence_length(desc);
+    if (desc->first_frame >= length) {
+        fprintf(stderr, "first frame %u is past the end of the sequence, which has %u frames\n", desc->first_frame, length);
+        return false;
+    }
+
+    exporter* ex = exporter_create(arena, state->tp, view->width, view->height, ZOOM_BUFFERS);
+
+    u64 start = os_now_usec();
+    u32 num_frames = exporter_zoom(ex, desc);
+    f64 secs = (f64)(os_now_usec() - start) / 1e6;
+
+    exporter_destroy(ex);
+
+    printf(
+        "frames %u to %u of %u in %.2f s, %.2f frames/s, %.2f Mpixels/s\n",
+        desc->first_frame, desc->first_frame + num_frames - 1, length, secs,
+        (f64)num_frames / secs, (f64)num_frames * view->width * view->height / secs / 1e6
+    );
+
+    return true;
+}
+
+static u32 cli_run_batch(cli_state* state, mg_arena* arena) {
+    char* line = MGA_PUSH_ARRAY(arena, char, MAX_LINE_SIZE);
+    u32 failed = 0;
+    u32 line_num = 0;
+
+    while (fgets(line, MAX_LINE_SIZE, stdin) != NULL) {
+        line_num++;
+
+        char* tokens[5] = { 0 };
+        u32 num_tokens = split_line(line, tokens, 5);
+
+        // Blank lines and comments
+        if (num_tokens == 0 || tokens[0][0] == '#') {
+            continue;
+        }
+
+        f64 dim = 0.0;
+        u32 iterations = 0;
+        if (num_tokens != 5 || !parse_f64(tokens[2], &dim) || !parse_u32(tokens[3], &iterations)) {
+            fprintf(stderr, "line %u: expected \"re im dim iterations path\"\n", line_num);
+            failed++;
+            continue;
+        }
+
+        if (!cli_render(state, tokens[0], tokens[1], dim, iterations, tokens[4])) {
+            failed++;
+        }
+    }
+
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    u32 width = 1920;
+    u32 height = 1080;
+    const char* center_r = "0";
+    const char* center_i = "0";
+    f64 dim = 4.0;
+    u32 iterations = 1024;
+    render_kernel kernel = RENDER_KERNEL_AUTO;
+    render_method method = RENDER_METHOD_TILES;
+    u32 num_threads = 0;
+    thread_affinity affinity = THREAD_AFFINITY_NONE;
+    const char* out_path = "out.png";
+    const char* recolor_path = NULL;
+    b32 write_raw = false;
+    b32 batch = false;
+    render_palette_desc palette_desc = { 0 };
+    render_aa_desc aa = { 0 };
+    const char* cache_path = NULL;
+    u32 cache_size_mib = 1024;
+    const char* trace_path = NULL;
+    export_desc zoom = {
+        .zoom_factor = 1.5,
+        .max_dim = 4.0
+    };
+
+    for (i32 i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        b32 valid = true;
+
+        // Every option except the flags takes at least one value
+        if (!arg_is(arg, "-b", "--batch") && !arg_is(arg, "-r", "--raw") &&
+            strcmp(arg, "--histogram") != 0 && i + 1 >= argc) {
+            valid = false;
+        } else if (arg_is(arg, "-w", "--width")) {
+            valid = parse_u32(argv[++i], &width);
+        } else if (arg_is(arg, "-h", "--height")) {
+            valid = parse_u32(argv[++i], &height);
+        } else if (arg_is(arg, "-c", "--center")) {
+            valid = i + 2 < argc;
+            if (valid) {
+                center_r = argv[++i];
+                center_i = argv[++i];
+            }
+        } else if (arg_is(arg, "-d", "--dim")) {
+            valid = parse_f64(argv[++i], &dim);
+        } else if (arg_is(arg, "-i", "--iterations")) {
+            valid = parse_u32(argv[++i], &iterations);
+        } else if (arg_is(arg, "-k", "--kernel")) {
+            string8 name = str8_from_cstr((u8*)argv[++i]);
+            valid = false;
+            for (u32 k = 0; k < RENDER_KERNEL_COUNT; k++) {
+                if (str8_equals(name, render_kernel_name((render_kernel)k))) {
+                    kernel = (render_kernel)k;
+                    valid = true;
+                }
+            }
+        } else if (arg_is(arg, "-m", "--method")) {
+            string8 name = str8_from_cstr((u8*)argv[++i]);
+            if (str8_equals(name, STR8("tiles"))) {
+                method = RENDER_METHOD_TILES;
+            } else if (str8_equals(name, STR8("subdivide"))) {
+                method = RENDER_METHOD_SUBDIVIDE;
+            } else {
+                valid = false;
+            }
+        } else if (strcmp(arg, "--period") == 0) {
+            valid = parse_f32(argv[++i], &palette_desc.period);
+        } else if (strcmp(arg, "--offset") == 0) {
+            valid = parse_f32(argv[++i], &palette_desc.offset);
+        } else if (strcmp(arg, "--exposure") == 0) {
+            valid = parse_f32(argv[++i], &palette_desc.exposure);
+        } else if (strcmp(arg, "--histogram") == 0) {
+            palette_desc.mode = RENDER_COLOR_HISTOGRAM;
+        } else if (strcmp(arg, "--cycles") == 0) {
+            valid = parse_f32(argv[++i], &palette_desc.cycles);
+        } else if (arg_is(arg, "-a", "--aa")) {
+            valid = parse_u32(argv[++i], &aa.samples);
+        } else if (strcmp(arg, "--aa-threshold") == 0) {
+            valid = parse_f32(argv[++i], &aa.threshold);
+        } else if (strcmp(arg, "--cache") == 0) {
+            cache_path = argv[++i];
+        } else if (strcmp(arg, "--cache-size") == 0) {
+            valid = parse_u32(argv[++i], &cache_size_mib);
+        } else if (arg_is(arg, "-t", "--threads")) {
+            valid = parse_u32(argv[++i], &num_threads);
+        } else if (strcmp(arg, "--affinity") == 0) {
+            valid = parse_affinity(argv[++i], &affinity);
+        } else if (arg_is(arg, "-o", "--out")) {
+            out_path = argv[++i];
+        } else if (arg_is(arg, "-r", "--raw")) {
+            write_raw = true;
+        } else if (strcmp(arg, "--recolor") == 0) {
+            recolor_path = argv[++i];
+        } else if (arg_is(arg, "-b", "--batch")) {
+            batch = true;
+        } else if (strcmp(arg, "--zoom") == 0) {
+            zoom.path_format = argv[++i];
+            valid = valid_frame_format(zoom.path_format);
+        } else if (strcmp(arg, "--zoom-factor") == 0) {
+            valid = parse_f64(argv[++i], &zoom.zoom_factor) && zoom.zoom_factor > 1.0;
+        } else if (strcmp(arg, "--max-dim") == 0) {
+            valid = parse_f64(argv[++i], &zoom.max_dim);
+        } else if (strcmp(arg, "--first-frame") == 0) {
+            valid = parse_index(argv[++i], &zoom.first_frame);
+        } else if (strcmp(arg, "--num-frames") == 0) {
+            valid = parse_u32(argv[++i], &zoom.num_frames);
+#ifdef TRACE_ENABLED
+        } else if (strcmp(arg, "--trace") == 0) {
+            trace_path = argv[++i];
+#endif
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "invalid argument \"%s\"\n", arg);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    u64 image_size = sizeof(pixel8) * (u64)width * height;
+
+    // The image, its iteration counts and the raw file are each about image_size,
+    // and every buffer of a zoom sequence has an image and its counts
+    mg_arena* perm_arena = mga_create(&(mga_desc){
+        .desired_max_size = MGA_MiB(64) + image_size * (3 + 2 * ZOOM_BUFFERS),
+        .desired_block_size = MGA_KiB(256),
+        .error_callback = mga_err
+    });
+
+    // The png, fpng's filtered copy of the image and its bands go on this thread's scratch arenas
+    mga_scratch_set_desc(&(mga_desc){
+        .desired_max_size = MGA_MiB(64) + image_size * 2,
+        .desired_block_size = MGA_KiB(256),
+        .error_callback = mga_err
+    });
+
+    fpng_init();
+
+    // Before the thread pool starts, so its workers get their names
+    if (trace_path != NULL) {
+        TRACE_INIT(TRACE_EVENTS_PER_THREAD);
+        TRACE_THREAD_NAME("main");
+    }
+
+    if (num_threads == 0) {
+        num_threads = os_num_cpus();
+    }
+
+    cli_state state = {
+        .tp = thread_pool_create(perm_arena, num_threads, 128),
+        .desc = {
+            .width = width,
+            .height = height,
+            .kernel = kernel,
+            .method = method,
+            .interior_checks = true
+        },
+        .iters = MGA_PUSH_ARRAY(perm_arena, f32, (u64)width * height),
+        .image = MGA_PUSH_ARRAY(perm_arena, pixel8, (u64)width * height),
+        .center = complex_fixedpt_create(perm_arena, fixedpt_limbs_for_bits(CENTER_FRAC_BITS)),
+        .aa = aa,
+        .write_raw = write_raw
+    };
+
+    if (affinity != THREAD_AFFINITY_NONE && !thread_pool_set_affinity(state.tp, affinity)) {
+        fprintf(stderr, "cannot pin the worker threads, they run unpinned\n");
+    }
+
+    // After pinning, so the pages of every part of the image are on the node that renders it
+    render_first_touch(state.tp, state.iters, width, height, sizeof(f32));
+    render_first_touch(state.tp, state.image, width, height, sizeof(pixel8));
+
+    palette_desc.kernel = kernel;
+    render_palette_build(&state.palette, &palette_desc);
+
+    if (write_raw) {
+        state.raw = MGA_PUSH_ARRAY(perm_arena, u8, export_raw_size(width, height));
+    }
+
+    if (cache_path != NULL) {
+        state.cache = render_cache_create(perm_arena, CACHE_MEMORY_SIZE);
+
+        if (!render_cache_open_file(state.cache, perm_arena, cache_path, (u64)cache_size_mib * MGA_MiB(1))) {
+            fprintf(stderr, "%s: cannot open tile cache, it may be from another version\n", cache_path);
+            render_cache_destroy(state.cache);
+            thread_pool_destroy(state.tp);
+            mga_destroy(perm_arena);
+            return 1;
+        }
+    }
+
+    string8 kernel_name = render_kernel_name(render_kernel_resolve(kernel));
+    printf("render kernel: %.*s, threads: %u\n", (int)kernel_name.size, (char*)kernel_name.str, num_threads);
+
+    u64 start = os_now_usec();
+
+    u32 failed = 0;
+    if (recolor_path != NULL && strcmp(recolor_path, "-") == 0) {
+        failed = cli_run_recolor_batch(&state, perm_arena);
+    } else if (recolor_path != NULL) {
+        failed = cli_recolor(&state, recolor_path, out_path) ? 0 : 1;
+    } else if (batch) {
+        failed = cli_run_batch(&state, perm_arena);
+    } else if (zoom.path_format != NULL) {
+        failed = cli_zoom(&state, perm_arena, &zoom, center_r, center_i, dim, iterations) ? 0 : 1;
+    } else if (!cli_render(&state, center_r, center_i, dim, iterations, out_path)) {
+        failed = 1;
+    }
+
+    f64 total_secs = (f64)(os_now_usec() - start) / 1e6;
+
+    if (state.num_images > 0) {
+        f64 total_usec = (f64)(state.render_usec + state.colorize_usec + state.encode_usec + state.write_usec);
+
+        printf(
+            "%u images in %.2f s, %.2f images/s, %.2f Mpixels/s "
+            "(render %.0f%%, colorize %.0f%%, encode %.0f%%, write %.0f%%)\n",
+            state.num_images, total_secs,
+            (f64)state.num_images / total_secs,
+            (f64)state.pixels / total_secs / 1e6,
+            100.0 * (f64)state.render_usec / total_usec,
+            100.0 * (f64)state.colorize_usec / total_usec,
+            100.0 * (f64)state.encode_usec / total_usec,
+            100.0 * (f64)state.write_usec / total_usec
+        );
+    }
+    if (state.cache != NULL) {
+        render_cache_stats stats = render_cache_get_stats(state.cache);
+        printf(
+            "tile cache: %llu hits in memory, %llu in the file, %llu misses, %llu tiles written\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.file_hits,
+            (unsigned long long)stats.misses, (unsigned long long)stats.file_writes
+        );
+    }
+    if (failed > 0) {
+        fprintf(stderr, "%u images failed\n", failed);
+    }
+#ifdef TRACE_ENABLED
+    // The render pool is idle, so every zone is in
+    if (trace_path != NULL && !trace_flush(trace_path)) {
+        fprintf(stderr, "%s: failed to write trace\n", trace_path);
+    }
+#endif
+
+    if (state.cache != NULL) {
+        render_cache_destroy(state.cache);
+    }
+    thread_pool_destroy(state.tp);
+    mga_destroy(perm_arena);
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,278 @@
+#include "export.h"
+#include "os/os.h"
+
+#include "fpng/fpng.h"
+#include "trace/trace.h"
+
+#include <stdio.h>
+
+typedef struct {
+    exporter* ex;
+
+    f32* iters;
+    pixel8* image;
+
+    // Only used for raw exports
+    b32 write_raw;
+    render_desc view;
+
+    // Holds the encoded files until they are written
+    mg_arena* file_arena;
+    string8 png;
+    string8 raw;
+
+    char path[256];
+    char raw_path[256];
+} export_slot;
+
+typedef struct _exporter {
+    thread_pool* tp;
+    u32 width;
+    u32 height;
+
+    // One thread each, so frames leave every stage in the order they entered it
+    thread_pool* encode_pool;
+    thread_pool* write_pool;
+    // Splits the encoding of each frame into bands of rows
+    thread_pool* band_pool;
+
+    u32 num_slots;
+    export_slot* slots;
+
+    // Counts the slots that are not in any stage
+    os_semaphore* free_slots;
+
+    mga_desc encode_scratch_desc;
+
+    // For exports without a palette
+    render_palette default_palette;
+} exporter;
+
+static void export_write_file(const char* path, string8 data) {
+#ifdef PLATFORM_WIN32
+    FILE* f = NULL;
+    fopen_s(&f, path, "wb");
+#else
+    FILE* f = fopen(path, "wb");
+#endif
+
+    if (f == NULL || fwrite(data.str, 1, data.size, f) != data.size) {
+        printf("failed to write %s\n", path);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+}
+
+static void export_write_task(void* void_slot) {
+    export_slot* slot = (export_slot*)void_slot;
+
+    TRACE_ZONE_BEGIN(zone, "write");
+    export_write_file(slot->path, slot->png);
+    if (slot->write_raw) {
+        export_write_file(slot->raw_path, slot->raw);
+    }
+    TRACE_ZONE_END(zone);
+
+    mga_reset(slot->file_arena);
+    os_semaphore_signal(slot->ex->free_slots);
+}
+
+static void export_encode_task(void* void_slot) {
+    export_slot* slot = (export_slot*)void_slot;
+    exporter* ex = slot->ex;
+
+    TRACE_ZONE_BEGIN(zone, "encode");
+
+    // fpng keeps a filtered copy of the image and the compressed bands on the scratch arenas of this thread,
+    // which have to be sized for the image before their first use
+    mga_scratch_set_desc(&ex->encode_scratch_desc);
+
+    fpng_img img = {
+        .channels = 4,
+        .width = ex->width,
+        .height = ex->height,
+        .data = (u8*)slot->image
+    };
+
+    slot->png = (string8){ 0 };
+    if (!fpng_encode_image_to_memory_mt(slot->file_arena, &img, &slot->png, 0, ex->band_pool)) {
+        printf("failed to encode %s\n", slot->path);
+    }
+
+    if (slot->write_raw) {
+        slot->raw.size = export_raw_size(ex->width, ex->height);
+        slot->raw.str = MGA_PUSH_ARRAY(slot->file_arena, u8, slot->raw.size);
+
+        export_raw_pack(slot->raw.str, slot->iters, &slot->view);
+    }
+
+    TRACE_ZONE_END(zone);
+
+    thread_pool_add_task(ex->write_pool, (thread_task){ .func = export_write_task, .arg = slot });
+}
+
+exporter* exporter_create(mg_arena* arena, thread_pool* tp, u32 width, u32 height, u32 num_buffers) {
+    exporter* ex = MGA_PUSH_ZERO_STRUCT(arena, exporter);
+
+    u64 image_size = sizeof(pixel8) * (u64)width * height;
+
+    ex->tp = tp;
+    ex->width = width;
+    ex->height = height;
+
+    // The queues never hold more than one task per slot, so adding never has to wait
+    ex->encode_pool = thread_pool_create(arena, 1, num_buffers);
+    ex->write_pool = thread_pool_create(arena, 1, num_buffers);
+    // Only one frame is encoded at a time, and it makes about two bands per thread
+    u32 num_band_threads = thread_pool_num_threads(tp);
+    ex->band_pool = thread_pool_create(arena, num_band_threads, num_band_threads * 2);
+
+    ex->num_slots = num_buffers;
+    ex->slots = MGA_PUSH_ZERO_ARRAY(arena, export_slot, num_buffers);
+    for (u32 i = 0; i < num_buffers; i++) {
+        export_slot* slot = &ex->slots[i];
+
+        slot->ex = ex;
+        slot->iters = MGA_PUSH_ARRAY(arena, f32, (u64)width * height);
+        slot->image = MGA_PUSH_ARRAY(arena, pixel8, (u64)width * height);
+
+        // Both are written by the render pool, tile by tile and in chunks of rows
+        render_first_touch(tp, slot->iters, width, height, sizeof(f32));
+        render_first_touch(tp, slot->image, width, height, sizeof(pixel8));
+
+        // An incompressible image comes out a little larger than it went in,
+        // and the raw file is about the size of the image
+        slot->file_arena = mga_create(&(mga_desc){
+            .desired_max_size = MGA_MiB(1) + image_size * 3,
+            .desired_block_size = MGA_KiB(256)
+        });
+    }
+
+    ex->free_slots = os_semaphore_create(arena, num_buffers);
+
+    ex->encode_scratch_desc = (mga_desc){
+        .desired_max_size = MGA_MiB(64) + image_size * 2,
+        .desired_block_size = MGA_KiB(256)
+    };
+
+    render_palette_build(&ex->default_palette, &(render_palette_desc){ 0 });
+
+    return ex;
+}
+
+void exporter_destroy(exporter* ex) {
+    thread_pool_destroy(ex->encode_pool);
+    thread_pool_destroy(ex->write_pool);
+    thread_pool_destroy(ex->band_pool);
+
+    for (u32 i = 0; i < ex->num_slots; i++) {
+        mga_destroy(ex->slots[i].file_arena);
+    }
+
+    os_semaphore_destroy(ex->free_slots);
+}
+
+u32 export_sequence_length(const export_desc* desc) {
+    if (!(desc->zoom_factor > 1.0) || !(desc->view.dim.r > 0.0)) {
+        return 1;
+    }
+
+    // Steps through the same products as export_frame_dim,
+    // so the count agrees with the dims exactly
+    u32 length = 1;
+    complexd dim = desc->view.dim;
+    while (dim.r < desc->max_dim) {
+        dim = complexd_scale(dim, desc->zoom_factor);
+        length++;
+    }
+
+    return length;
+}
+
+complexd export_frame_dim(const export_desc* desc, u32 frame) {
+    u32 length = export_sequence_length(desc);
+
+    complexd dim = desc->view.dim;
+    for (u32 i = frame + 1; i < length; i++) {
+        dim = complexd_scale(dim, desc->zoom_factor);
+    }
+
+    return dim;
+}
+
+u32 exporter_zoom(exporter* ex, const export_desc* desc) {
+    u32 length = export_sequence_length(desc);
+
+    u32 first_frame = MIN(desc->first_frame, length);
+    u32 end_frame = length;
+    if (desc->num_frames != 0) {
+        end_frame = MIN(end_frame, first_frame + desc->num_frames);
+    }
+
+    render_desc view = desc->view;
+    view.width = ex->width;
+    view.height = ex->height;
+
+    const render_palette* palette = desc->palette != NULL ? desc->palette : &ex->default_palette;
+
+    // Frames that reuse the one before them go from the deepest to the widest,
+    // so every frame is taken from a sharper render of its center.
+    // The previous frame is still in its slot, because it is only encoded and written,
+    // but a single slot would have it overwritten by the frame that reads it
+    b32 reuse = desc->reuse_frames && ex->num_slots > 1;
+    const f32* prev = NULL;
+    complexd prev_dim = { 0 };
+
+    for (u32 i = 0; i < end_frame - first_frame; i++) {
+        u32 frame = reuse ? end_frame - 1 - i : first_frame + i;
+
+        // Slots are freed in the order they were filled,
+        // so the one this wait gives back is always the oldest
+        TRACE_ZONE_BEGIN(wait_zone, "wait for slot");
+        os_semaphore_wait(ex->free_slots);
+        TRACE_ZONE_END(wait_zone);
+        export_slot* slot = &ex->slots[i % ex->num_slots];
+
+        view.dim = export_frame_dim(desc, frame);
+
+        slot->write_raw = desc->raw_path_format != NULL;
+        slot->view = view;
+        if (slot->write_raw) {
+            snprintf(slot->raw_path, sizeof(slot->raw_path), desc->raw_path_format, frame);
+        }
+
+        TRACE_ZONE_BEGIN(render_zone, "render frame");
+        if (reuse) {
+            render_mandelbrot_reuse(ex->tp, slot->iters, &view, desc->center, prev, prev_dim);
+            prev = slot->iters;
+            prev_dim = view.dim;
+        } else {
+            render_mandelbrot_auto(ex->tp, slot->iters, &view, desc->center);
+        }
+        TRACE_ZONE_END(render_zone);
+
+        TRACE_ZONE_BEGIN(color_zone, "colorize frame");
+        render_colorize_aa(ex->tp, slot->image, slot->iters, &view, desc->center, palette, &desc->aa);
+        TRACE_ZONE_END(color_zone);
+
+        if (desc->frame_rendered != NULL) {
+            TRACE_ZONE_BEGIN(callback_zone, "frame rendered");
+            desc->frame_rendered(desc->ctx, frame, slot->image);
+            TRACE_ZONE_END(callback_zone);
+        }
+
+        snprintf(slot->path, sizeof(slot->path), desc->path_format, frame);
+        thread_pool_add_task(ex->encode_pool, (thread_task){ .func = export_encode_task, .arg = slot });
+    }
+
+    // Taking every slot back means the last frame has been written
+    for (u32 i = 0; i < ex->num_slots; i++) {
+        os_semaphore_wait(ex->free_slots);
+    }
+    for (u32 i = 0; i < ex->num_slots; i++) {
+        os_semaphore_signal(ex->free_slots);
+    }
+
+    return end_frame - first_frame;
+}
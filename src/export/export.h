@@ -0,0 +1,142 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "base/base.h"
+#include "os/os.h"
+#include "os/os_thread_pool.h"
+#include "math/math_fixed.h"
+#include "render/render.h"
+
+// Zoom sequence export
+// Every frame goes through three stages: rendering and coloring on the caller's thread pool,
+// png encoding on a dedicated thread (which splits each frame into bands
+// for a pool of its own), and writing on another one.
+// Frame N + 1 renders while frame N is encoded and frame N - 1 is written,
+// so a sequence takes about as long as its slowest stage.
+// Frames cycle through a fixed ring of pixel buffers, which bounds how far
+// the render stage can run ahead of the others.
+//
+// The frame count is known before anything renders, so every frame is
+// written straight to its final index, with frame 0 being the widest view.
+// Frames only depend on their index, any subset can be rendered in any order,
+// unless they reuse the frames before them (see reuse_frames).
+typedef struct _exporter exporter;
+
+typedef void (export_frame_func)(void* ctx, u32 frame, const pixel8* image);
+
+typedef struct {
+    // The deepest frame, which is the last one in the sequence.
+    // width and height are ignored
+    render_desc view;
+    // Overrides view.center for deep views when it is not NULL
+    const complex_fixedpt* center;
+
+    // dim is scaled by zoom_factor from one frame to the one before it.
+    // Frame 0 is the first with a dim of at least max_dim.
+    // zoom_factor has to be above 1
+    f64 zoom_factor;
+    f64 max_dim;
+
+    // printf format of the output paths, with one %u for the frame index
+    const char* path_format;
+    // Same for raw iteration files (see below), which are only written when this is not NULL
+    const char* raw_path_format;
+
+    // NULL uses the default palette
+    const render_palette* palette;
+    // Anti-aliasing of every frame, zero disables it
+    render_aa_desc aa;
+
+    // Renders the range from the deepest frame to the widest, and fills the middle of
+    // every frame from the one rendered before it (see render_mandelbrot_reuse), so only
+    // the outer ring and the pixels that could not be interpolated are rendered.
+    // Interpolated pixels are close to a plain render but not the same,
+    // and frames then depend on the range they were exported in.
+    // Needs at least two buffers, frame_rendered gets the frames in reverse order
+    b32 reuse_frames;
+
+    // Range of frames to export, num_frames == 0 exports to the end of the sequence.
+    // Splitting the sequence into ranges lets several processes share an export
+    u32 first_frame;
+    u32 num_frames;
+
+    // Called on the exporting thread when a frame has finished rendering,
+    // before it is encoded. Can be NULL
+    export_frame_func* frame_rendered;
+    void* ctx;
+} export_desc;
+
+// num_buffers is the number of frames that can be in flight at once,
+// three keeps every stage busy
+exporter* exporter_create(mg_arena* arena, thread_pool* tp, u32 width, u32 height, u32 num_buffers);
+void exporter_destroy(exporter* ex);
+
+// Length of the whole sequence, ignoring first_frame and num_frames
+u32 export_sequence_length(const export_desc* desc);
+complexd export_frame_dim(const export_desc* desc, u32 frame);
+
+// Blocks until every frame in the range has been written,
+// returns the number of frames written.
+// Nothing else may use the thread pool during the export
+u32 exporter_zoom(exporter* ex, const export_desc* desc);
+
+// Raw iteration files
+// Keep the iteration count of every pixel of a frame, so a sequence can be
+// colored again without rendering it again.
+// The file is an export_raw_header followed by the image in square tiles,
+// left to right then top to bottom. Every tile is tile_size * tile_size pixels,
+// the ones on the right and bottom edges are padded. Within a tile each channel
+// is a row major block of f32, in the order of the channel flags.
+// Tiles keep every read of a region to a few contiguous runs of the file,
+// which is what lets a mapped file be streamed instead of read up front.
+// The header is written as is, so the files are little endian
+
+#define EXPORT_RAW_VERSION 1
+#define EXPORT_RAW_TILE_SIZE 64
+
+typedef enum {
+    // The iteration count, iterations - 1 for pixels that never escaped
+    EXPORT_RAW_CHANNEL_ITERATIONS = 1 << 0,
+} export_raw_channel;
+
+typedef struct {
+    // "FRACRAW" and a zero
+    u8 magic[8];
+    u32 version;
+    // export_raw_channel flags
+    u32 channels;
+
+    u32 width;
+    u32 height;
+    u32 tile_size;
+    // Iteration limit of the render
+    u32 iterations;
+
+    // The view that was rendered, for reference
+    f64 center_r, center_i;
+    f64 dim_r, dim_i;
+} export_raw_header;
+
+typedef struct {
+    os_file_map map;
+
+    export_raw_header header;
+    u32 tiles_x;
+    u32 tiles_y;
+    const f32* tiles;
+} export_raw_file;
+
+u64 export_raw_size(u32 width, u32 height);
+// Writes the header and tiles of an image to out, which has to hold export_raw_size bytes.
+// desc is only used for the header
+void export_raw_pack(u8* out, const f32* iters, const render_desc* desc);
+
+// Maps the file, and checks its header and size
+b32 export_raw_open(export_raw_file* file, const char* path);
+void export_raw_close(export_raw_file* file);
+
+// Copies the iteration counts into iters, which has to hold width * height f32,
+// one row of tiles per task on the thread pool. Color them with render_colorize
+void export_raw_read(thread_pool* tp, const export_raw_file* file, f32* iters);
+
+#endif // EXPORT_H
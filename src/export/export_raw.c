@@ -0,0 +1,139 @@
+#include "export.h"
+
+#include <string.h>
+
+static const u8 raw_magic[8] = { 'F', 'R', 'A', 'C', 'R', 'A', 'W', 0 };
+
+static u32 raw_num_tiles(u32 size) {
+    return (size + EXPORT_RAW_TILE_SIZE - 1) / EXPORT_RAW_TILE_SIZE;
+}
+
+u64 export_raw_size(u32 width, u32 height) {
+    u64 tile_pixels = EXPORT_RAW_TILE_SIZE * EXPORT_RAW_TILE_SIZE;
+
+    return sizeof(export_raw_header) + sizeof(f32) * tile_pixels * raw_num_tiles(width) * raw_num_tiles(height);
+}
+
+void export_raw_pack(u8* out, const f32* iters, const render_desc* desc) {
+    u32 width = desc->width;
+    u32 height = desc->height;
+
+    export_raw_header header = {
+        .version = EXPORT_RAW_VERSION,
+        .channels = EXPORT_RAW_CHANNEL_ITERATIONS,
+        .width = width,
+        .height = height,
+        .tile_size = EXPORT_RAW_TILE_SIZE,
+        .iterations = desc->iterations,
+        .center_r = desc->center.r,
+        .center_i = desc->center.i,
+        .dim_r = desc->dim.r,
+        .dim_i = desc->dim.i
+    };
+    memcpy(header.magic, raw_magic, sizeof(raw_magic));
+    memcpy(out, &header, sizeof(header));
+
+    f32* tile = (f32*)(out + sizeof(header));
+
+    for (u32 tile_y = 0; tile_y < raw_num_tiles(height); tile_y++) {
+        for (u32 tile_x = 0; tile_x < raw_num_tiles(width); tile_x++) {
+            u32 x0 = tile_x * EXPORT_RAW_TILE_SIZE;
+            u32 y0 = tile_y * EXPORT_RAW_TILE_SIZE;
+            u32 tile_w = MIN(EXPORT_RAW_TILE_SIZE, width - x0);
+            u32 tile_h = MIN(EXPORT_RAW_TILE_SIZE, height - y0);
+
+            for (u32 y = 0; y < EXPORT_RAW_TILE_SIZE; y++) {
+                f32* row = tile + y * EXPORT_RAW_TILE_SIZE;
+
+                if (y < tile_h) {
+                    memcpy(row, iters + x0 + (u64)(y0 + y) * width, sizeof(f32) * tile_w);
+                    memset(row + tile_w, 0, sizeof(f32) * (EXPORT_RAW_TILE_SIZE - tile_w));
+                } else {
+                    memset(row, 0, sizeof(f32) * EXPORT_RAW_TILE_SIZE);
+                }
+            }
+
+            tile += EXPORT_RAW_TILE_SIZE * EXPORT_RAW_TILE_SIZE;
+        }
+    }
+}
+
+b32 export_raw_open(export_raw_file* file, const char* path) {
+    *file = (export_raw_file){ 0 };
+
+    if (!os_file_map_open(&file->map, path)) {
+        return false;
+    }
+
+    if (file->map.size < sizeof(export_raw_header)) {
+        export_raw_close(file);
+        return false;
+    }
+
+    export_raw_header* header = &file->header;
+    memcpy(header, file->map.data, sizeof(*header));
+
+    if (memcmp(header->magic, raw_magic, sizeof(raw_magic)) != 0 ||
+        header->version != EXPORT_RAW_VERSION ||
+        header->channels != EXPORT_RAW_CHANNEL_ITERATIONS ||
+        header->tile_size != EXPORT_RAW_TILE_SIZE ||
+        header->width == 0 || header->height == 0 ||
+        file->map.size < export_raw_size(header->width, header->height)) {
+        export_raw_close(file);
+        return false;
+    }
+
+    file->tiles_x = raw_num_tiles(header->width);
+    file->tiles_y = raw_num_tiles(header->height);
+    file->tiles = (const f32*)(file->map.data + sizeof(*header));
+
+    return true;
+}
+
+void export_raw_close(export_raw_file* file) {
+    os_file_map_close(&file->map);
+
+    *file = (export_raw_file){ 0 };
+}
+
+typedef struct {
+    const export_raw_file* file;
+    f32* iters;
+} raw_read_job;
+
+static void raw_read_rows(void* void_job, u64 start_tile_y, u64 end_tile_y) {
+    raw_read_job* job = (raw_read_job*)void_job;
+    const export_raw_file* file = job->file;
+    const export_raw_header* header = &file->header;
+
+    for (u32 tile_y = (u32)start_tile_y; tile_y < end_tile_y; tile_y++) {
+        u32 y0 = tile_y * EXPORT_RAW_TILE_SIZE;
+        u32 tile_h = MIN(EXPORT_RAW_TILE_SIZE, header->height - y0);
+
+        // The tiles of a row are next to each other in the file,
+        // so each row of tiles is one contiguous run of it
+        for (u32 tile_x = 0; tile_x < file->tiles_x; tile_x++) {
+            const f32* tile = file->tiles + (u64)(tile_x + tile_y * file->tiles_x) * EXPORT_RAW_TILE_SIZE * EXPORT_RAW_TILE_SIZE;
+
+            u32 x0 = tile_x * EXPORT_RAW_TILE_SIZE;
+            u32 tile_w = MIN(EXPORT_RAW_TILE_SIZE, header->width - x0);
+
+            for (u32 y = 0; y < tile_h; y++) {
+                memcpy(
+                    job->iters + x0 + (u64)(y0 + y) * header->width,
+                    tile + y * EXPORT_RAW_TILE_SIZE,
+                    sizeof(f32) * tile_w
+                );
+            }
+        }
+    }
+}
+
+void export_raw_read(thread_pool* tp, const export_raw_file* file, f32* iters) {
+    raw_read_job job = {
+        .file = file,
+        .iters = iters
+    };
+
+    thread_pool_parallel_for(tp, 0, file->tiles_y, 1, raw_read_rows, &job);
+}
@@ -1,12 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "base/base.h"
+#include "os/os.h"
 #include "os/os_thread_pool.h"
 #include "gfx/gfx.h"
 
 #include "math/math_vec.h"
 #include "math/math_complex.h"
+#include "render/render.h"
+#include "export/export.h"
+#include "trace/trace.h"
 
 #if defined(PLATFORM_WIN32)
 #    define UNICODE
@@ -34,105 +40,60 @@ typedef struct {
     f64 x, y, w, h;
 } rect64;
 
-typedef struct {
-    u8 r, g, b, a;
-} pixel8;
+static thread_pool* tp = NULL;
+
+// Precision of the view center, enough for any dim an f64 can hold
+#define CENTER_FRAC_BITS 1088
+
+// Views the left button zoomed in from, the middle button goes back to them
+#define VIEW_HISTORY_SIZE 64
+// Iteration counts of recent views, so going back to them or zooming out is instant
+#define RENDER_CACHE_SIZE MGA_MiB(512)
+// With --cache they are also kept across sessions, in a file in the per-user cache
+// directory that is shared with any other renderer using it
+#define RENDER_CACHE_APP_NAME "Fractal-Renderer"
+#define RENDER_CACHE_FILE_NAME "tile_cache.bin"
+// Size of a new file in MiB, --cache-size changes it
+#define RENDER_CACHE_FILE_SIZE_MIB 256
+
+// Zones kept per thread when built with tracing. Every export and the exit write
+// the zones since the previous write to a file of their own,
+// so closing the window does not replace the trace of an export
+#define TRACE_EVENTS_PER_THREAD (1 << 16)
+#define TRACE_PATH_FORMAT "trace_%.4u.json"
 
 typedef struct {
-    pixel8* out;
-    u32 img_width;
-    u32 img_height;
-    u32 start_y;
-    u32 height;
-    complexd complex_dim;
-    complexd complex_center;
+    complex_fixedpt center;
+    complexd dim;
     u32 iterations;
-} mandelbrot_args;
+} view_history_entry;
 
-void render_mandelbrot_section(void* void_args) {
-    mandelbrot_args* args = (mandelbrot_args*)void_args;
-    
-    for (u32 y = args->start_y; y < args->start_y + args->height; y++) {
-        for (u32 x = 0; x < args->img_width; x++) {
-            #if 1
-            complexd z = { 0 };
-            complexd c = {
-                (((f64)x / (f64)args->img_width) - 0.5) * args->complex_dim.r + args->complex_center.r,
-                (((f64)y / (f64)args->img_height) - 0.5) * args->complex_dim.i + args->complex_center.i
-            };
-            #else
-            complexd c = { 0.975, -1.175 };
-            complexd z = {
-                (((f64)x / (f64)args->img_width) - 0.5) * args->complex_dim.r + args->complex_center.r,
-                (((f64)y / (f64)args->img_height) - 0.5) * args->complex_dim.i + args->complex_center.i
-            };
-            #endif
-
-            f32 n = (f32)args->iterations - 1.0;
-
-            for (u32 i = 0; i < args->iterations; i++) {
-                //z = (complexd){ fabs(z.r), fabs(z.i) };
-                z = complexd_add(complexd_mul(z, z), c);
-
-                if (z.r * z.r + z.i * z.i > 4.0) {
-                    n = (f32)i;
-                    break;
-                }
-            }
-
-            u32 j = x + y * args->img_width;
-            if (n == (f32)args->iterations - 1.0) {
-                args->out[j] = (pixel8){ 0, 0, 0, 255 };
-            } else {
-                args->out[j] = (pixel8){
-                    .r = (u8)((sinf(0.1 * n) * 0.5f + 0.5f) * 255.0f),
-                    .g = (u8)((sinf(0.1 * n + 4.188) * 0.5f + 0.5f) * 255.0f),
-                    .b = (u8)((sinf(0.1 * n + 2.904) * 0.5f + 0.5f) * 255.0f),
-                    .a = 255
-                };
-                //u32 col = (u32)((n / args->iterations) * 254.0) + 1;
-                //args->out[j] = (pixel8){ col, col, col, 255 };
-            }
-        }
-    }
-}
-
-#define NUM_THREADS 8
-static thread_pool* tp = NULL;
-void render_mandelbrot(pixel8* out, u32 img_width, u32 img_height, complexd complex_dim, complexd complex_center, u32 iterations) {
-    mga_temp scratch = mga_scratch_get(NULL, 0);
+void draw(gfx_window* win);
 
-    u32 y_step = img_height / NUM_THREADS;
-    
-    for (u32 i = 0; i < NUM_THREADS; i++) {
-        mandelbrot_args* args = MGA_PUSH_ZERO_STRUCT(scratch.arena, mandelbrot_args);
-        *args = (mandelbrot_args){
-            .out = out,
-            .img_width = img_width,
-            .img_height = img_height,
-            .start_y = y_step * i,
-            .height = y_step,
-            .complex_dim = complex_dim,
-            .complex_center = complex_center,
-            .iterations = iterations
-        };
+static void export_frame_rendered(void* ctx, u32 frame, const pixel8* image) {
+    gfx_window* win = (gfx_window*)ctx;
 
-        //render_mandelbrot_section(args);
-        thread_pool_add_task(
-            tp,
-            (thread_task){
-                .func = render_mandelbrot_section,
-                .arg = args
-            }
-        );
-    }
+    TRACE_ZONE_BEGIN(zone, "upload");
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, IMG_WIDTH, IMG_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, image);
+    TRACE_ZONE_END(zone);
 
-    thread_pool_wait(tp);
+    draw(win);
 
-    mga_scratch_release(scratch);
+    printf("image %u\n", frame);
 }
 
-void draw(gfx_window* win);
+static void flush_trace(void) {
+#ifdef TRACE_ENABLED
+    static u32 num_traces = 0;
+
+    char path[64] = { 0 };
+    snprintf(path, sizeof(path), TRACE_PATH_FORMAT, num_traces++);
+
+    if (trace_flush(path)) {
+        printf("trace written to %s\n", path);
+    }
+#endif
+}
 
 void mga_err(mga_error err) {
     printf("MGA ERROR %d: %s", err.code, err.msg);
@@ -169,9 +130,48 @@ static rect64 mouse_norm_rect(gfx_window* win) {
     return rect;
 }
 
-int main(void) {
+static void print_usage(const char* name) {
+    printf(
+        "usage: %s [options]\n"
+        "  --cache             keep the iteration counts of rendered tiles in a file in the\n"
+        "                      per-user cache directory, so later sessions reuse them\n"
+        "  --cache-size <n>    size of a new tile cache file in MiB (default %u)\n"
+        "  --reuse-frames      export zooms faster by filling every frame from the one before it,\n"
+        "                      which is slightly lossy and renders the frames in order\n",
+        name, RENDER_CACHE_FILE_SIZE_MIB
+    );
+}
+
+int main(int argc, char** argv) {
+    b32 use_cache_file = false;
+    u32 cache_size_mib = RENDER_CACHE_FILE_SIZE_MIB;
+    b32 reuse_frames = false;
+
+    for (int i = 1; i < argc; i++) {
+        b32 valid = true;
+
+        if (strcmp(argv[i], "--cache") == 0) {
+            use_cache_file = true;
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            char* end = NULL;
+            unsigned long value = strtoul(argv[++i], &end, 10);
+
+            valid = *end == '\0' && value > 0 && value <= 0xffffffff;
+            cache_size_mib = (u32)value;
+        } else if (strcmp(argv[i], "--reuse-frames") == 0) {
+            reuse_frames = true;
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
     mga_desc desc = {
-        .desired_max_size = MGA_MiB(16),
+        .desired_max_size = MGA_MiB(128),
         .desired_block_size = MGA_KiB(256),
         .error_callback = mga_err
     };
@@ -179,9 +179,16 @@ int main(void) {
 
     fpng_init();
 
+    // Before any thread is started, so the workers get their names
+    TRACE_INIT(TRACE_EVENTS_PER_THREAD);
+    TRACE_THREAD_NAME("main");
+
     gfx_window* win = gfx_win_create(perm_arena, WIDTH, HEIGHT, STR8("Fractal Renderer"));
 
-    tp = thread_pool_create(perm_arena, NUM_THREADS, 128);
+    tp = thread_pool_create(perm_arena, os_num_cpus(), 128);
+
+    // Render, encode and write stages each get a frame
+    exporter* export = exporter_create(perm_arena, tp, IMG_WIDTH, IMG_HEIGHT, 3);
 
     pixel8* screen = MGA_PUSH_ZERO_ARRAY(perm_arena, pixel8, IMG_WIDTH * IMG_HEIGHT);
     for (u32 i = 0; i < IMG_WIDTH * IMG_HEIGHT; i++) {
@@ -271,16 +278,58 @@ int main(void) {
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  
     glClearColor(0.45f, 0.65f, 0.77f, 1.0f);
 
-    complexd complex_dim = { 4.0, 4.0 * 9.0 / 16.0 };
-    complexd complex_center = { 0 };
-    u32 iterations = 64;
+    render_desc view = {
+        .width = IMG_WIDTH,
+        .height = IMG_HEIGHT,
+        .dim = { 4.0, 4.0 * 9.0 / 16.0 },
+        .center = { 0 },
+        .iterations = 64,
+        .kernel = RENDER_KERNEL_AUTO,
+        .interior_checks = true
+    };
 
-    render_mandelbrot(screen, IMG_WIDTH, IMG_HEIGHT, complex_dim, complex_center, iterations);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, IMG_WIDTH, IMG_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, screen);
+    complex_fixedpt view_center = complex_fixedpt_create(perm_arena, fixedpt_limbs_for_bits(CENTER_FRAC_BITS));
+
+    render_palette palette = { 0 };
+    render_palette_build(&palette, &(render_palette_desc){ 0 });
+
+    string8 kernel_name = render_kernel_name(render_kernel_resolve(view.kernel));
+    printf("render kernel: %.*s\n", (int)kernel_name.size, (char*)kernel_name.str);
+
+    view_history_entry history[VIEW_HISTORY_SIZE] = { 0 };
+    for (u32 i = 0; i < VIEW_HISTORY_SIZE; i++) {
+        history[i].center = complex_fixedpt_create(perm_arena, fixedpt_limbs_for_bits(CENTER_FRAC_BITS));
+    }
+    // Ring buffer, the oldest views are dropped when it is full
+    u32 history_next = 0;
+    u32 history_count = 0;
+
+    render_cache* cache = render_cache_create(perm_arena, RENDER_CACHE_SIZE);
+    if (use_cache_file) {
+        char cache_path[1024] = { 0 };
+
+        if (!os_user_cache_path(cache_path, sizeof(cache_path), RENDER_CACHE_APP_NAME, RENDER_CACHE_FILE_NAME)) {
+            printf("no per-user cache directory, tiles are only cached in memory\n");
+        } else if (!render_cache_open_file(cache, perm_arena, cache_path, (u64)cache_size_mib * MGA_MiB(1))) {
+            printf("cannot open %s, tiles are only cached in memory\n", cache_path);
+        } else {
+            printf("tile cache file: %s\n", cache_path);
+        }
+    }
+    render_progressive* preview = render_progressive_create(perm_arena, tp, IMG_WIDTH, IMG_HEIGHT, cache);
+    render_progressive_start(preview, &view, &view_center);
 
     while (!win->should_close) {
+        TRACE_ZONE_BEGIN(frame_zone, "frame");
+
         gfx_win_process_events(win);
 
+        if (render_progressive_update(preview, screen, &palette)) {
+            TRACE_ZONE_BEGIN(upload_zone, "upload");
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, IMG_WIDTH, IMG_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, screen);
+            TRACE_ZONE_END(upload_zone);
+        }
+
         if (win->mouse_buttons[0] && !win->prev_mouse_buttons[0]) {
             init_rect_pos = win->mouse_pos;
         }
@@ -294,84 +343,91 @@ int main(void) {
                 rect.y + rect.h * 0.5
             };
 
-            complex_center.r += (center.x - 0.5) * complex_dim.r;
-            complex_center.i += (center.y - 0.5) * complex_dim.i;
+            view_history_entry* entry = &history[history_next];
+            fixedpt_copy(&entry->center.r, &view_center.r);
+            fixedpt_copy(&entry->center.i, &view_center.i);
+            entry->dim = view.dim;
+            entry->iterations = view.iterations;
+
+            history_next = (history_next + 1) % VIEW_HISTORY_SIZE;
+            history_count = MIN(history_count + 1, VIEW_HISTORY_SIZE);
+
+            mga_temp scratch = mga_scratch_get(NULL, 0);
+            fixedpt offset = fixedpt_create(scratch.arena, view_center.r.num_limbs);
 
-            complex_dim = complexd_scale(complex_dim, rect.w);
+            fixedpt_from_f64(&offset, (center.x - 0.5) * view.dim.r);
+            fixedpt_add(&view_center.r, &view_center.r, &offset);
+            fixedpt_from_f64(&offset, (center.y - 0.5) * view.dim.i);
+            fixedpt_add(&view_center.i, &view_center.i, &offset);
 
-            iterations += 64;
+            mga_scratch_release(scratch);
+
+            view.center.r = fixedpt_to_f64(&view_center.r);
+            view.center.i = fixedpt_to_f64(&view_center.i);
+
+            view.dim = complexd_scale(view.dim, rect.w);
+
+            view.iterations += 64;
             
-            printf("dim: %f %f, center: %f %f, iters: %u\n", complex_dim.r, complex_dim.i, complex_center.r, complex_center.i, iterations);
+            printf("dim: %f %f, center: %f %f, iters: %u\n", view.dim.r, view.dim.i, view.center.r, view.center.i, view.iterations);
 
-            render_mandelbrot(screen, IMG_WIDTH, IMG_HEIGHT, complex_dim, complex_center, iterations);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, IMG_WIDTH, IMG_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, screen);
+            render_progressive_start(preview, &view, &view_center);
+        }
+
+        if (win->mouse_buttons[1] && !win->prev_mouse_buttons[1] && history_count > 0) {
+            history_next = (history_next + VIEW_HISTORY_SIZE - 1) % VIEW_HISTORY_SIZE;
+            history_count--;
+
+            view_history_entry* entry = &history[history_next];
+            fixedpt_copy(&view_center.r, &entry->center.r);
+            fixedpt_copy(&view_center.i, &entry->center.i);
+            view.dim = entry->dim;
+            view.iterations = entry->iterations;
+
+            view.center.r = fixedpt_to_f64(&view_center.r);
+            view.center.i = fixedpt_to_f64(&view_center.i);
+
+            render_progressive_start(preview, &view, &view_center);
         }
 
         if (win->mouse_buttons[2] && !win->prev_mouse_buttons[2]) {
             printf("saving images\n");
 
-            mga_temp temp = mga_temp_begin(perm_arena);
-            
-            u32 i = 0;
-            b32 done = false;
-            while (!done) {
-                if (complex_dim.r >= 4.0f)
-                    done = true;
-                
-                render_mandelbrot(screen, IMG_WIDTH, IMG_HEIGHT, complex_dim, complex_center, 1024);
-
-                complex_dim = complexd_scale(complex_dim, 1.5);
-                
-                fpng_img img = {
-                    .channels = 4,
-                    .width = IMG_WIDTH,
-                    .height = IMG_HEIGHT,
-                    .data = (u8*)screen
-                };
-                string8 out = { 0 };
-                fpng_encode_image_to_memory(perm_arena, &img, &out, 0);
-
-                char file_path[256] = { 0 };
-                sprintf(file_path, "out/img_%.4u.png", i);
-                i++;
-                
-                #ifdef PLATFORM_WIN32
-                FILE* f = NULL;
-                fopen_s(&f, file_path, "wb");
-                #else
-                FILE* f = fopen(file_path, "wb");
-                #endif
-                fwrite(out.str, 1, out.size, f);
-                fclose(f);
-                
-                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, IMG_WIDTH, IMG_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, screen);
-                draw(win);
-
-                mga_temp_end(temp);
-                
-                printf("image %d, dim: %f %f\n", i - 1, complex_dim.r, complex_dim.i);
-            }
-            i--;
-
-            char file1[256] = { 0 };
-            char file2[256] = { 0 };
-            for (u32 j = 0; j < i / 2 + 1; j++) {
-                sprintf(file1, "out/img_%.4u.png", j);
-                sprintf(file2, "out/img_%.4u.png", i - j);
-                
-                rename(file1, "out/temp.png");
-                rename(file2, file1);
-                rename("out/temp.png", file2);
-            }
+            render_progressive_cancel(preview);
+
+            render_desc export_view = view;
+            export_view.iterations = 1024;
+
+            export_desc export_seq = {
+                .view = export_view,
+                .center = &view_center,
+                .zoom_factor = 1.5,
+                .max_dim = 4.0,
+                .path_format = "out/img_%.4u.png",
+                .palette = &palette,
+                .reuse_frames = reuse_frames,
+                .frame_rendered = export_frame_rendered,
+                .ctx = win
+            };
+            printf("%u frames\n", export_sequence_length(&export_seq));
+
+            TRACE_ZONE_BEGIN(export_zone, "export");
+            exporter_zoom(export, &export_seq);
+            TRACE_ZONE_END(export_zone);
 
             printf("done saving images\n");
+            flush_trace();
 
-            render_mandelbrot(screen, IMG_WIDTH, IMG_HEIGHT, complex_dim, complex_center, 512);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, IMG_WIDTH, IMG_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, screen);
-            draw(win);
+            view.dim = complexd_scale(export_frame_dim(&export_seq, 0), export_seq.zoom_factor);
+
+            render_desc preview_view = view;
+            preview_view.iterations = 512;
+            render_progressive_start(preview, &preview_view, &view_center);
         }
 
         draw(win);
+
+        TRACE_ZONE_END(frame_zone);
         
         #if defined(PLATFORM_WIN32)
             Sleep(16);
@@ -380,6 +436,8 @@ int main(void) {
         #endif
     }
 
+    flush_trace();
+
     glDeleteTextures(1, &gl_fract.texture);
     glDeleteProgram(gl_fract.shader);
     glDeleteBuffers(1, &vertex_buffer);
@@ -387,6 +445,16 @@ int main(void) {
 
     gfx_win_destroy(win);
 
+    render_cache_stats cache_stats = render_cache_get_stats(cache);
+    printf(
+        "tile cache: %llu hits in memory, %llu in the file, %llu misses\n",
+        (unsigned long long)cache_stats.hits, (unsigned long long)cache_stats.file_hits,
+        (unsigned long long)cache_stats.misses
+    );
+
+    render_progressive_destroy(preview);
+    render_cache_destroy(cache);
+    exporter_destroy(export);
     thread_pool_destroy(tp);
 
     mga_destroy(perm_arena);
@@ -395,6 +463,8 @@ int main(void) {
 }
 
 void draw(gfx_window* win) {
+    TRACE_ZONE_BEGIN(zone, "draw");
+
     gfx_win_clear(win);
 
     glUseProgram(gl_fract.shader);
@@ -434,4 +504,6 @@ void draw(gfx_window* win) {
     glDisableVertexAttribArray(1);
 
     gfx_win_swap_buffers(win);
+
+    TRACE_ZONE_END(zone);
 }
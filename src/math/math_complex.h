@@ -13,4 +13,16 @@
 #undef CX_BASE_TYPE
 #undef CX_NAME_SUFFIX
 
+#include "math_f64x2.h"
+
+#define CX_BASE_TYPE f64x2
+#define CX_NAME_SUFFIX dd
+#define CX_ADD f64x2_add
+#define CX_SUB f64x2_sub
+#define CX_MUL f64x2_mul
+#define CX_DIV f64x2_div
+#include "math_complex_template.h"
+#undef CX_BASE_TYPE
+#undef CX_NAME_SUFFIX
+
 #endif // MATH_COMPLEX_H
\ No newline at end of file
@@ -8,6 +8,21 @@
 #define CX_NAME_SUFFIX _##CX_BASE_TYPE
 #endif
 
+// Base types without arithmetic operators can
+// define these before including the template
+#ifndef CX_ADD
+#define CX_ADD(a, b) ((a) + (b))
+#endif
+#ifndef CX_SUB
+#define CX_SUB(a, b) ((a) - (b))
+#endif
+#ifndef CX_MUL
+#define CX_MUL(a, b) ((a) * (b))
+#endif
+#ifndef CX_DIV
+#define CX_DIV(a, b) ((a) / (b))
+#endif
+
 #define CX_NAME CONCAT(complex, CX_NAME_SUFFIX)
 
 typedef struct { CX_BASE_TYPE r, i; } CX_NAME;
@@ -21,26 +36,31 @@ CX_NAME CONCAT(CX_NAME, _scale)(CX_NAME c, CX_BASE_TYPE s);
 #ifdef CX_IMPL
 
 CX_NAME CONCAT(CX_NAME, _add)(CX_NAME a, CX_NAME b) {
-    return (CX_NAME){ a.r + b.r, a.i + b.i };
+    return (CX_NAME){ CX_ADD(a.r, b.r), CX_ADD(a.i, b.i) };
 }
 CX_NAME CONCAT(CX_NAME, _sub)(CX_NAME a, CX_NAME b) {
-    return (CX_NAME){ a.r - b.r, a.i - b.i };
+    return (CX_NAME){ CX_SUB(a.r, b.r), CX_SUB(a.i, b.i) };
 }
 CX_NAME CONCAT(CX_NAME, _mul)(CX_NAME a, CX_NAME b) {
     return (CX_NAME){
-        a.r * b.r - a.i * b.i,
-        a.r * b.i + a.i * b.r
+        CX_SUB(CX_MUL(a.r, b.r), CX_MUL(a.i, b.i)),
+        CX_ADD(CX_MUL(a.r, b.i), CX_MUL(a.i, b.r))
     };
 }
 CX_NAME CONCAT(CX_NAME, _div)(CX_NAME a, CX_NAME b) {
-    CX_BASE_TYPE d = b.r * b.r + b.i * b.i;
+    CX_BASE_TYPE d = CX_ADD(CX_MUL(b.r, b.r), CX_MUL(b.i, b.i));
     return (CX_NAME){
-        (a.r * b.r + a.i * b.i) / d,
-        (a.i * b.r - a.r * b.i) / d
+        CX_DIV(CX_ADD(CX_MUL(a.r, b.r), CX_MUL(a.i, b.i)), d),
+        CX_DIV(CX_SUB(CX_MUL(a.i, b.r), CX_MUL(a.r, b.i)), d)
     };
 }
 CX_NAME CONCAT(CX_NAME, _scale)(CX_NAME c, CX_BASE_TYPE s) {
-    return (CX_NAME){ c.r * s, c.i * s };
+    return (CX_NAME){ CX_MUL(c.r, s), CX_MUL(c.i, s) };
 }
 
-#endif
\ No newline at end of file
+#endif
+
+#undef CX_ADD
+#undef CX_SUB
+#undef CX_MUL
+#undef CX_DIV
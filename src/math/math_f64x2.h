@@ -0,0 +1,101 @@
+#ifndef MATH_F64X2_H
+#define MATH_F64X2_H
+
+#include "base/base_defs.h"
+
+// Double-double number, the unevaluated sum hi + lo with |lo| <= ulp(hi) / 2
+// This gives about 106 bits of mantissa with the exponent range of an f64.
+//
+// The two halves are plain f64 fields so that vector code can keep
+// all of the his in one register and all of the los in another
+// (see render_dd.c), instead of interleaving them.
+// https://www.davidhbailey.com/dhbpapers/qd.pdf
+typedef struct {
+    f64 hi, lo;
+} f64x2;
+
+f64x2 f64x2_from_f64(f64 x);
+f64 f64x2_to_f64(f64x2 a);
+
+f64x2 f64x2_add(f64x2 a, f64x2 b);
+f64x2 f64x2_sub(f64x2 a, f64x2 b);
+f64x2 f64x2_mul(f64x2 a, f64x2 b);
+f64x2 f64x2_div(f64x2 a, f64x2 b);
+
+#ifdef F64X2_IMPL
+
+// The error free transformations below need every operation
+// to be rounded on its own, so multiplies cannot be fused into adds
+#if defined(__clang__)
+#    pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#    pragma GCC optimize("fp-contract=off")
+#endif
+
+static f64x2 _f64x2_quick_two_sum(f64 a, f64 b) {
+    f64 s = a + b;
+    return (f64x2){ s, b - (s - a) };
+}
+static f64x2 _f64x2_two_sum(f64 a, f64 b) {
+    f64 s = a + b;
+    f64 bb = s - a;
+    return (f64x2){ s, (a - (s - bb)) + (b - bb) };
+}
+// Dekker's product, exact without an fma instruction
+static f64x2 _f64x2_two_prod(f64 a, f64 b) {
+    const f64 split = 134217729.0; // 2^27 + 1
+
+    f64 p = a * b;
+
+    f64 ta = split * a;
+    f64 a_hi = ta - (ta - a);
+    f64 a_lo = a - a_hi;
+
+    f64 tb = split * b;
+    f64 b_hi = tb - (tb - b);
+    f64 b_lo = b - b_hi;
+
+    f64 err = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+    return (f64x2){ p, err };
+}
+
+f64x2 f64x2_from_f64(f64 x) {
+    return (f64x2){ x, 0.0 };
+}
+f64 f64x2_to_f64(f64x2 a) {
+    return a.hi + a.lo;
+}
+
+f64x2 f64x2_add(f64x2 a, f64x2 b) {
+    f64x2 s = _f64x2_two_sum(a.hi, b.hi);
+    f64x2 t = _f64x2_two_sum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = _f64x2_quick_two_sum(s.hi, s.lo);
+    s.lo += t.lo;
+    return _f64x2_quick_two_sum(s.hi, s.lo);
+}
+f64x2 f64x2_sub(f64x2 a, f64x2 b) {
+    return f64x2_add(a, (f64x2){ -b.hi, -b.lo });
+}
+f64x2 f64x2_mul(f64x2 a, f64x2 b) {
+    f64x2 p = _f64x2_two_prod(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return _f64x2_quick_two_sum(p.hi, p.lo);
+}
+f64x2 f64x2_div(f64x2 a, f64x2 b) {
+    // Long division with two f64 quotient digits and a correction
+    f64 q1 = a.hi / b.hi;
+    f64x2 r = f64x2_sub(a, f64x2_mul(b, f64x2_from_f64(q1)));
+
+    f64 q2 = r.hi / b.hi;
+    r = f64x2_sub(r, f64x2_mul(b, f64x2_from_f64(q2)));
+
+    f64 q3 = r.hi / b.hi;
+
+    f64x2 q = _f64x2_quick_two_sum(q1, q2);
+    return f64x2_add(q, f64x2_from_f64(q3));
+}
+
+#endif // F64X2_IMPL
+
+#endif // MATH_F64X2_H
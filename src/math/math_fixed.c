@@ -0,0 +1,306 @@
+#include "math_fixed.h"
+
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+u32 fixedpt_limbs_for_bits(u32 frac_bits) {
+    return 1 + (frac_bits + 31) / 32;
+}
+
+fixedpt fixedpt_create(mg_arena* arena, u32 num_limbs) {
+    return (fixedpt){
+        .num_limbs = num_limbs,
+        .limbs = MGA_PUSH_ZERO_ARRAY(arena, u32, num_limbs)
+    };
+}
+complex_fixedpt complex_fixedpt_create(mg_arena* arena, u32 num_limbs) {
+    return (complex_fixedpt){
+        .r = fixedpt_create(arena, num_limbs),
+        .i = fixedpt_create(arena, num_limbs)
+    };
+}
+
+void fixedpt_copy(fixedpt* out, const fixedpt* a) {
+    if (out == a) {
+        return;
+    }
+
+    u32 shared = MIN(out->num_limbs, a->num_limbs);
+    u32 out_start = out->num_limbs - shared;
+    u32 a_start = a->num_limbs - shared;
+
+    memset(out->limbs, 0, sizeof(u32) * out_start);
+    memmove(out->limbs + out_start, a->limbs + a_start, sizeof(u32) * shared);
+}
+
+// Two's complement negation of n limbs
+static void limbs_neg(u32* out, const u32* a, u32 n) {
+    u64 carry = 1;
+
+    for (u32 i = 0; i < n; i++) {
+        u64 sum = (u64)(~a[i]) + carry;
+        out[i] = (u32)sum;
+        carry = sum >> 32;
+    }
+}
+
+void fixedpt_from_f64(fixedpt* out, f64 x) {
+    u32 n = out->num_limbs;
+    f64 v = fabs(x);
+
+    // Every step only subtracts the integer part and multiplies
+    // by a power of two, so the conversion is exact
+    for (u32 i = 0; i < n; i++) {
+        f64 limb = floor(v);
+        out->limbs[n - 1 - i] = (u32)limb;
+        v = (v - limb) * 4294967296.0;
+    }
+
+    if (x < 0.0) {
+        limbs_neg(out->limbs, out->limbs, n);
+    }
+}
+
+f64 fixedpt_to_f64(const fixedpt* a) {
+    u32 n = a->num_limbs;
+    b32 negative = fixedpt_is_negative(a);
+
+    // Summing from the least significant limb keeps the rounding error small,
+    // and negating on the fly avoids needing a temporary
+    f64 out = 0.0;
+    u64 carry = 1;
+    for (u32 i = 0; i < n; i++) {
+        u32 limb = a->limbs[i];
+
+        if (negative) {
+            u64 sum = (u64)(~limb) + carry;
+            limb = (u32)sum;
+            carry = sum >> 32;
+        }
+
+        out += ldexp((f64)limb, 32 * ((i32)i - (i32)(n - 1)));
+    }
+
+    return negative ? -out : out;
+}
+
+f64x2 fixedpt_to_f64x2(const fixedpt* a) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    // hi is a rounded a, so a - hi is exact and lo can be rounded on its own
+    f64 hi = fixedpt_to_f64(a);
+
+    fixedpt rem = fixedpt_create(scratch.arena, a->num_limbs);
+    fixedpt_from_f64(&rem, hi);
+    fixedpt_sub(&rem, a, &rem);
+
+    f64 lo = fixedpt_to_f64(&rem);
+
+    mga_scratch_release(scratch);
+
+    return (f64x2){ hi, lo };
+}
+
+b32 fixedpt_from_str8(fixedpt* out, string8 str) {
+    u32 n = out->num_limbs;
+    u64 pos = 0;
+
+    b32 negative = false;
+    if (pos < str.size && (str.str[pos] == '-' || str.str[pos] == '+')) {
+        negative = str.str[pos] == '-';
+        pos++;
+    }
+
+    u64 int_start = pos;
+    u64 int_part = 0;
+    while (pos < str.size && str.str[pos] >= '0' && str.str[pos] <= '9') {
+        int_part = int_part * 10 + (str.str[pos] - '0');
+        pos++;
+
+        if (int_part > 0x7fffffff) {
+            return false;
+        }
+    }
+    u64 int_end = pos;
+
+    u64 frac_start = pos;
+    if (pos < str.size && str.str[pos] == '.') {
+        pos++;
+        frac_start = pos;
+
+        while (pos < str.size && str.str[pos] >= '0' && str.str[pos] <= '9') {
+            pos++;
+        }
+    }
+    u64 frac_end = pos;
+
+    if (pos != str.size || (int_start == int_end && frac_start == frac_end)) {
+        return false;
+    }
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+    u32* mag = MGA_PUSH_ZERO_ARRAY(scratch.arena, u32, n);
+
+    // Horner's rule from the last digit: x = (d + x) / 10.
+    // x stays below 1, so each digit only ever lands in the empty integer limb
+    for (u64 i = frac_end; i > frac_start; i--) {
+        mag[n - 1] = str.str[i - 1] - '0';
+
+        u64 rem = 0;
+        for (u32 j = n; j > 0; j--) {
+            u64 cur = (rem << 32) | mag[j - 1];
+            mag[j - 1] = (u32)(cur / 10);
+            rem = cur % 10;
+        }
+    }
+
+    mag[n - 1] = (u32)int_part;
+
+    if (negative) {
+        limbs_neg(out->limbs, mag, n);
+    } else {
+        memcpy(out->limbs, mag, sizeof(u32) * n);
+    }
+
+    mga_scratch_release(scratch);
+
+    return true;
+}
+
+b32 fixedpt_is_negative(const fixedpt* a) {
+    return (a->limbs[a->num_limbs - 1] & 0x80000000) != 0;
+}
+
+void fixedpt_neg(fixedpt* out, const fixedpt* a) {
+    assert(out->num_limbs == a->num_limbs);
+
+    limbs_neg(out->limbs, a->limbs, a->num_limbs);
+}
+
+void fixedpt_add(fixedpt* out, const fixedpt* a, const fixedpt* b) {
+    assert(out->num_limbs == a->num_limbs && a->num_limbs == b->num_limbs);
+
+    u64 carry = 0;
+    for (u32 i = 0; i < a->num_limbs; i++) {
+        u64 sum = (u64)a->limbs[i] + (u64)b->limbs[i] + carry;
+        out->limbs[i] = (u32)sum;
+        carry = sum >> 32;
+    }
+}
+
+void fixedpt_sub(fixedpt* out, const fixedpt* a, const fixedpt* b) {
+    assert(out->num_limbs == a->num_limbs && a->num_limbs == b->num_limbs);
+
+    // a - b = a + ~b + 1
+    u64 carry = 1;
+    for (u32 i = 0; i < a->num_limbs; i++) {
+        u64 sum = (u64)a->limbs[i] + (u64)(~b->limbs[i]) + carry;
+        out->limbs[i] = (u32)sum;
+        carry = sum >> 32;
+    }
+}
+
+void fixedpt_mul(fixedpt* out, const fixedpt* a, const fixedpt* b) {
+    assert(out->num_limbs == a->num_limbs && a->num_limbs == b->num_limbs);
+
+    u32 n = a->num_limbs;
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    u32* mag_a = MGA_PUSH_ARRAY(scratch.arena, u32, n);
+    u32* mag_b = MGA_PUSH_ARRAY(scratch.arena, u32, n);
+    u32* prod = MGA_PUSH_ZERO_ARRAY(scratch.arena, u32, n * 2);
+
+    b32 neg_a = fixedpt_is_negative(a);
+    b32 neg_b = fixedpt_is_negative(b);
+
+    if (neg_a) {
+        limbs_neg(mag_a, a->limbs, n);
+    } else {
+        memcpy(mag_a, a->limbs, sizeof(u32) * n);
+    }
+    if (neg_b) {
+        limbs_neg(mag_b, b->limbs, n);
+    } else {
+        memcpy(mag_b, b->limbs, sizeof(u32) * n);
+    }
+
+    for (u32 i = 0; i < n; i++) {
+        u64 carry = 0;
+
+        for (u32 j = 0; j < n; j++) {
+            u64 cur = (u64)mag_a[i] * (u64)mag_b[j] + (u64)prod[i + j] + carry;
+            prod[i + j] = (u32)cur;
+            carry = cur >> 32;
+        }
+
+        prod[i + n] = (u32)carry;
+    }
+
+    // Both inputs have n - 1 fractional limbs, so the product has 2n - 2
+    if (neg_a != neg_b) {
+        limbs_neg(out->limbs, prod + n - 1, n);
+    } else {
+        memcpy(out->limbs, prod + n - 1, sizeof(u32) * n);
+    }
+
+    mga_scratch_release(scratch);
+}
+
+void fixedpt_sqr(fixedpt* out, const fixedpt* a) {
+    assert(out->num_limbs == a->num_limbs);
+
+    u32 n = a->num_limbs;
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    u32* mag = MGA_PUSH_ARRAY(scratch.arena, u32, n);
+    if (fixedpt_is_negative(a)) {
+        limbs_neg(mag, a->limbs, n);
+    } else {
+        memcpy(mag, a->limbs, sizeof(u32) * n);
+    }
+
+    // Product scanning, one column of the 2n limb square at a time.
+    // Only limbs [n - 1, 2n - 2] are kept, and the two columns below
+    // that are enough to get the carries into them right.
+    // The column sum is kept in 128 bits, as acc_hi:acc_lo
+    u32 start_col = n > 3 ? n - 3 : 0;
+    u64 acc_lo = 0;
+    u64 acc_hi = 0;
+
+    for (u32 k = start_col; k <= 2 * n - 2; k++) {
+        u32 i = k > n - 1 ? k - (n - 1) : 0;
+        u32 j = k - i;
+
+        u64 col_lo = 0;
+        u64 col_hi = 0;
+
+        for (; i < j; i++, j--) {
+            u64 p = (u64)mag[i] * (u64)mag[j];
+            col_lo += p;
+            col_hi += col_lo < p;
+        }
+
+        // Every cross product appears twice in the square
+        col_hi = (col_hi << 1) | (col_lo >> 63);
+        col_lo <<= 1;
+
+        if (i == j) {
+            u64 p = (u64)mag[i] * (u64)mag[i];
+            col_lo += p;
+            col_hi += col_lo < p;
+        }
+
+        acc_lo += col_lo;
+        acc_hi += col_hi + (acc_lo < col_lo);
+
+        if (k >= n - 1) {
+            out->limbs[k - (n - 1)] = (u32)acc_lo;
+        }
+
+        acc_lo = (acc_lo >> 32) | (acc_hi << 32);
+        acc_hi >>= 32;
+    }
+
+    mga_scratch_release(scratch);
+}
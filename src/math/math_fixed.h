@@ -0,0 +1,56 @@
+#ifndef MATH_FIXED_H
+#define MATH_FIXED_H
+
+#include "base/base.h"
+#include "math_f64x2.h"
+
+// Arbitrary precision fixed point number
+// Stored in two's complement as 32 bit limbs, least significant first.
+// The last limb is the signed integer part, every other limb is fractional,
+// so a number with n limbs has 32 * (n - 1) bits after the point.
+//
+// Limbs are allocated once from an arena, the operations never allocate
+// except for temporary space on the scratch arenas.
+// All operands of an operation must have the same number of limbs,
+// and the output may alias any of the inputs.
+typedef struct {
+    u32 num_limbs;
+    u32* limbs;
+} fixedpt;
+
+typedef struct {
+    fixedpt r, i;
+} complex_fixedpt;
+
+u32 fixedpt_limbs_for_bits(u32 frac_bits);
+
+fixedpt fixedpt_create(mg_arena* arena, u32 num_limbs);
+complex_fixedpt complex_fixedpt_create(mg_arena* arena, u32 num_limbs);
+
+// Copies between numbers of any precision,
+// truncating or zero extending the fractional limbs
+void fixedpt_copy(fixedpt* out, const fixedpt* a);
+
+void fixedpt_from_f64(fixedpt* out, f64 x);
+f64 fixedpt_to_f64(const fixedpt* a);
+f64x2 fixedpt_to_f64x2(const fixedpt* a);
+
+// Parses a plain decimal like "-0.743643887037158704752191506114774",
+// rounding toward zero past the precision of out.
+// Returns false and leaves out untouched if str is not a number
+// or the integer part does not fit in the integer limb
+b32 fixedpt_from_str8(fixedpt* out, string8 str);
+
+b32 fixedpt_is_negative(const fixedpt* a);
+
+void fixedpt_neg(fixedpt* out, const fixedpt* a);
+void fixedpt_add(fixedpt* out, const fixedpt* a, const fixedpt* b);
+void fixedpt_sub(fixedpt* out, const fixedpt* a, const fixedpt* b);
+void fixedpt_mul(fixedpt* out, const fixedpt* a, const fixedpt* b);
+
+// Squares a using each cross product once, and skips the product columns
+// that only feed the discarded low limbs. The result can be one unit
+// of the last limb below the exact truncated square.
+void fixedpt_sqr(fixedpt* out, const fixedpt* a);
+
+#endif // MATH_FIXED_H
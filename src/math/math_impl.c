@@ -1,5 +1,6 @@
 #define VEC_IMPL
 #define CX_IMPL
+#define F64X2_IMPL
 
 #include "math_vec.h"
 #include "math_complex.h"
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef OS_H
+#define OS_H
+
+#include "base/base.h"
+
+// Number of logical processors this process is allowed to run on
+u32 os_num_cpus(void);
+
+// Monotonic clock in microseconds, only differences between calls are meaningful
+u64 os_now_usec(void);
+
+// Counting semaphore, for handing work between threads outside of a thread pool
+typedef struct _os_semaphore os_semaphore;
+
+os_semaphore* os_semaphore_create(mg_arena* arena, u32 initial_count);
+void os_semaphore_destroy(os_semaphore* sem);
+
+// Blocks until the count is above zero, then decrements it
+void os_semaphore_wait(os_semaphore* sem);
+void os_semaphore_signal(os_semaphore* sem);
+
+// Read only mapping of a whole file.
+// Pages are only read in when they are first touched,
+// and the os is told to read ahead of sequential access
+typedef struct {
+    const u8* data;
+    u64 size;
+} os_file_map;
+
+// Returns false if the file cannot be opened or is empty
+b32 os_file_map_open(os_file_map* map, const char* path);
+void os_file_map_close(os_file_map* map);
+
+// Read write mapping of a whole file that is shared with every other process
+// mapping it, so writes are seen by all of them and end up in the file.
+// A file that does not exist is created with size bytes, the init_size bytes of init
+// followed by zeros. It is built under a temporary name and moved into place whole,
+// so processes that create it at the same time all map the same complete file.
+// An existing file is mapped at its own size, and size and init are ignored.
+// New files are sparse, only the pages that get written take up disk space
+typedef struct {
+    u8* data;
+    u64 size;
+} os_shared_map;
+
+b32 os_shared_map_open(os_shared_map* map, const char* path, u64 size, const void* init, u64 init_size);
+void os_shared_map_close(os_shared_map* map);
+
+// Writes the path of file_name in the app_name directory of the per-user cache directory,
+// which is $XDG_CACHE_HOME or ~/.cache on linux and %LOCALAPPDATA% on win32.
+// The app_name directory is created if it does not exist.
+// Returns false if there is no cache directory or the path does not fit
+b32 os_user_cache_path(char* path, u64 path_size, const char* app_name, const char* file_name);
+
+#endif // OS_H
@@ -0,0 +1,200 @@
+// Needed for sched_getaffinity and CPU_COUNT
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE
+#endif
+
+#include "base/base_defs.h"
+
+#ifdef PLATFORM_LINUX
+
+#include "os.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+u32 os_num_cpus(void) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+        i32 count = CPU_COUNT(&cpu_set);
+        if (count > 0) {
+            return (u32)count;
+        }
+    }
+
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+}
+
+u64 os_now_usec(void) {
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (u64)ts.tv_sec * 1000000 + (u64)ts.tv_nsec / 1000;
+}
+
+typedef struct _os_semaphore {
+    sem_t sem;
+} os_semaphore;
+
+os_semaphore* os_semaphore_create(mg_arena* arena, u32 initial_count) {
+    os_semaphore* sem = MGA_PUSH_ZERO_STRUCT(arena, os_semaphore);
+    sem_init(&sem->sem, 0, initial_count);
+
+    return sem;
+}
+void os_semaphore_destroy(os_semaphore* sem) {
+    sem_destroy(&sem->sem);
+}
+
+void os_semaphore_wait(os_semaphore* sem) {
+    // Signals can interrupt the wait without taking from the count
+    while (sem_wait(&sem->sem) != 0) { }
+}
+void os_semaphore_signal(os_semaphore* sem) {
+    sem_post(&sem->sem);
+}
+
+b32 os_file_map_open(os_file_map* map, const char* path) {
+    *map = (os_file_map){ 0 };
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st = { 0 };
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    // The mapping keeps the file open
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    map->data = (const u8*)data;
+    map->size = (u64)st.st_size;
+
+    return true;
+}
+void os_file_map_close(os_file_map* map) {
+    if (map->data != NULL) {
+        munmap((void*)map->data, (size_t)map->size);
+    }
+
+    *map = (os_file_map){ 0 };
+}
+
+// Builds the file under a name of its own and links it to path, which fails if
+// another process got there first. Either way path then names a complete file
+static b32 shared_map_create(const char* path, u64 size, const void* init, u64 init_size) {
+    char tmp_path[1024] = { 0 };
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    if (len < 0 || (u64)len >= sizeof(tmp_path) || init_size > size) {
+        return false;
+    }
+
+    // Left over from a process with the same id that died while creating it
+    unlink(tmp_path);
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        return false;
+    }
+
+    // Growing a file with ftruncate leaves a hole, so it is sparse
+    b32 built = ftruncate(fd, (off_t)size) == 0 &&
+        (init_size == 0 || pwrite(fd, init, (size_t)init_size, 0) == (ssize_t)init_size);
+    close(fd);
+
+    b32 linked = built && (link(tmp_path, path) == 0 || errno == EEXIST);
+    unlink(tmp_path);
+
+    return linked;
+}
+
+b32 os_shared_map_open(os_shared_map* map, const char* path, u64 size, const void* init, u64 init_size) {
+    *map = (os_shared_map){ 0 };
+
+    int fd = open(path, O_RDWR);
+    if (fd == -1 && errno == ENOENT && size > 0 && shared_map_create(path, size, init, init_size)) {
+        fd = open(path, O_RDWR);
+    }
+    if (fd == -1) {
+        return false;
+    }
+
+    // The size of the file, which can be another one than size if it already existed
+    struct stat st = { 0 };
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    map->data = (u8*)data;
+    map->size = (u64)st.st_size;
+
+    return true;
+}
+void os_shared_map_close(os_shared_map* map) {
+    if (map->data != NULL) {
+        munmap(map->data, (size_t)map->size);
+    }
+
+    *map = (os_shared_map){ 0 };
+}
+
+b32 os_user_cache_path(char* path, u64 path_size, const char* app_name, const char* file_name) {
+    const char* xdg_cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    // Relative XDG paths are invalid and have to be ignored
+    int len = -1;
+    if (xdg_cache != NULL && xdg_cache[0] == '/') {
+        len = snprintf(path, path_size, "%s", xdg_cache);
+    } else if (home != NULL && home[0] != '\0') {
+        len = snprintf(path, path_size, "%s/.cache", home);
+    }
+    if (len < 0 || (u64)len >= path_size) {
+        return false;
+    }
+
+    // Usually there already, if not the app directory below fails
+    mkdir(path, 0700);
+
+    int app_len = snprintf(path + len, path_size - (u64)len, "/%s", app_name);
+    if (app_len < 0 || (u64)(len + app_len) >= path_size) {
+        return false;
+    }
+    len += app_len;
+
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+
+    int file_len = snprintf(path + len, path_size - (u64)len, "/%s", file_name);
+    return file_len >= 0 && (u64)(len + file_len) < path_size;
+}
+
+#endif // PLATFORM_LINUX
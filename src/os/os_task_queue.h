@@ -0,0 +1,136 @@
+#ifndef OS_TASK_QUEUE_H
+#define OS_TASK_QUEUE_H
+
+#include "base/base.h"
+#include "os_thread_pool.h"
+
+// Bounded lock-free multi-producer multi-consumer queue
+// Shared by the platform thread pool implementations
+// https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+typedef struct {
+    volatile u64 seq;
+    thread_task task;
+} _task_cell;
+
+typedef struct {
+    u64 mask;
+    _task_cell* cells;
+
+    // Producers and consumers work on separate cache lines
+    u8 _pad0[48];
+    volatile u64 enqueue_pos;
+    u8 _pad1[56];
+    volatile u64 dequeue_pos;
+    u8 _pad2[56];
+} _task_queue;
+
+static void _task_queue_init(mg_arena* arena, _task_queue* queue, u32 min_capacity) {
+    u64 capacity = 2;
+    while (capacity < min_capacity) {
+        capacity <<= 1;
+    }
+
+    queue->mask = capacity - 1;
+    queue->cells = MGA_PUSH_ZERO_ARRAY(arena, _task_cell, capacity);
+
+    for (u64 i = 0; i < capacity; i++) {
+        queue->cells[i].seq = i;
+    }
+
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+}
+
+// Returns false if the queue is full
+static b32 _task_queue_push(_task_queue* queue, thread_task task) {
+    u64 pos = atomic_load_u64(&queue->enqueue_pos);
+    _task_cell* cell = NULL;
+
+    while (true) {
+        cell = &queue->cells[pos & queue->mask];
+        u64 seq = atomic_load_u64(&cell->seq);
+        i64 diff = (i64)seq - (i64)pos;
+
+        if (diff == 0) {
+            if (atomic_cas_u64(&queue->enqueue_pos, &pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_u64(&queue->enqueue_pos);
+        }
+    }
+
+    cell->task = task;
+    atomic_store_u64(&cell->seq, pos + 1);
+
+    return true;
+}
+
+// Returns false if the queue is empty
+static b32 _task_queue_pop(_task_queue* queue, thread_task* task) {
+    u64 pos = atomic_load_u64(&queue->dequeue_pos);
+    _task_cell* cell = NULL;
+
+    while (true) {
+        cell = &queue->cells[pos & queue->mask];
+        u64 seq = atomic_load_u64(&cell->seq);
+        i64 diff = (i64)seq - (i64)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_cas_u64(&queue->dequeue_pos, &pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_u64(&queue->dequeue_pos);
+        }
+    }
+
+    *task = cell->task;
+    atomic_store_u64(&cell->seq, pos + queue->mask + 1);
+
+    return true;
+}
+
+// Range of a thread_pool_parallel_for, lives on the stack of the thread that called it
+typedef struct {
+    thread_range_func* func;
+    void* ctx;
+
+    u64 begin;
+    u64 end;
+    u64 grain;
+    u64 num_chunks;
+
+    // Claimed and finished chunks are counted on separate cache lines
+    u8 _pad0[16];
+    volatile u64 next_chunk;
+    u8 _pad1[56];
+    volatile u64 chunks_done;
+    u8 _pad2[56];
+} _parallel_job;
+
+// Runs chunks until every one has been claimed,
+// returns true if the caller finished the last chunk of the job
+static b32 _parallel_job_run(_parallel_job* job) {
+    b32 last = false;
+
+    u64 chunk = atomic_add_u64(&job->next_chunk, 1);
+    while (chunk < job->num_chunks) {
+        u64 begin = job->begin + chunk * job->grain;
+        u64 end = begin + MIN(job->grain, job->end - begin);
+
+        job->func(job->ctx, begin, end);
+
+        last = atomic_add_u64(&job->chunks_done, 1) == job->num_chunks - 1;
+        chunk = atomic_add_u64(&job->next_chunk, 1);
+    }
+
+    return last;
+}
+
+#endif // OS_TASK_QUEUE_H
@@ -3,8 +3,6 @@
 
 #include "base/base.h"
 
-// TODO: exit better from threads
-
 typedef struct _thread_pool thread_pool;
 
 typedef void (thread_func)(void*);
@@ -13,10 +11,59 @@ typedef struct {
     void* arg;
 } thread_task;
 
+// Called with a chunk [begin, end) of the range given to thread_pool_parallel_for
+typedef void (thread_range_func)(void* ctx, u64 begin, u64 end);
+
+typedef enum {
+    // Workers run on whichever cpus the os picks
+    THREAD_AFFINITY_NONE = 0,
+
+    // Worker i is pinned to the i-th cpu in order of socket, then core,
+    // so workers share cores and sockets before they spread to the next one
+    THREAD_AFFINITY_COMPACT,
+
+    // Consecutive workers go to different sockets, and to different cores of
+    // a socket before any core gets a second worker, which spreads them over
+    // every memory controller and cache
+    THREAD_AFFINITY_SCATTER,
+
+    THREAD_AFFINITY_COUNT
+} thread_affinity;
+
 thread_pool* thread_pool_create(mg_arena* arena, u32 num_threads, u32 max_tasks);
+// Waits for the tasks that are running, tasks still in the queue are dropped
 void thread_pool_destroy(thread_pool* tp);
 
+u32 thread_pool_num_threads(thread_pool* tp);
+
+// Pins every worker to a cpu the process is allowed to run on, or unpins them with
+// THREAD_AFFINITY_NONE. Workers wrap around when there are more of them than cpus.
+// Pinned workers keep the memory they touch first on their own NUMA node,
+// see render_first_touch. Only supported on linux, returns false elsewhere
+// or if a worker could not be pinned
+b32 thread_pool_set_affinity(thread_pool* tp, thread_affinity affinity);
+
+// Index of the calling thread among the workers of tp, from 0 to num_threads - 1,
+// or num_threads when it is not one of them. Tasks can use it to find
+// per worker data, or memory they placed on the worker's NUMA node
+u32 thread_pool_worker_index(thread_pool* tp);
+
+// Writes the time every worker has spent running tasks since the pool was created,
+// busy_usec has to hold num_threads values. Tasks the caller of thread_pool_add_task
+// runs itself because the queue was full are not counted
+void thread_pool_busy_usec(thread_pool* tp, u64* busy_usec);
+
 void thread_pool_add_task(thread_pool* tp, thread_task task);
 void thread_pool_wait(thread_pool* tp);
 
+// Calls func on every chunk of grain indices in [begin, end), the last one can be shorter,
+// and returns once all of them are done. The workers and the calling thread claim chunks
+// from a shared counter, so the whole range costs one wakeup and nothing is allocated.
+// Only one thread at a time can run a parallel_for on a pool, and never from a task of that pool.
+// Tasks from thread_pool_add_task keep running alongside it
+void thread_pool_parallel_for(
+    thread_pool* tp, u64 begin, u64 end, u64 grain,
+    thread_range_func* func, void* ctx
+);
+
 #endif // OS_THREAD_POOL_H
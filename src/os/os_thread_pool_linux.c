@@ -1,57 +1,161 @@
+// Needed for pthread_setaffinity_np and the CPU_ macros
+#ifndef _GNU_SOURCE
+#    define _GNU_SOURCE
+#endif
+
 #include "base/base_defs.h"
 
 #ifdef PLATFORM_LINUX
 
 #include "os_thread_pool.h"
+#include "os_task_queue.h"
+#include "os.h"
+#include "trace/trace.h"
 
-#include <stdio.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+// Number of empty polls before a worker goes to sleep
+#define SPIN_COUNT 256
+
+typedef struct {
+    thread_pool* tp;
+
+    // Only written by the worker, once per task
+    volatile u64 busy_usec;
+
+    // Workers update their own cache line
+    u8 _pad[48];
+} _thread_worker;
+
+// NULL on threads that are not workers of any pool
+static __thread _thread_worker* current_worker = NULL;
 
 typedef struct _thread_pool {
     u32 num_threads;
     pthread_t* threads;
+    _thread_worker* workers;
+
+    _task_queue queue;
 
-    u32 max_tasks;
-    u32 num_tasks;
-    thread_task* task_queue;
+    // Tasks that have been added but not finished yet
+    volatile u32 num_pending;
+    volatile u32 num_sleeping;
 
+    // Set by thread_pool_destroy, workers return instead of taking another task
+    volatile u32 stop;
+
+    // Address of the _parallel_job that is running, 0 between jobs
+    volatile u64 job;
+    // Bumped for every job, workers join when it differs from the last one they saw
+    volatile u64 job_gen;
+    // Workers that may still be reading the job
+    volatile u32 job_workers;
+
+    // Only used for sleeping and waking, never for accessing the queue
     pthread_mutex_t mutex;
     pthread_cond_t queue_cond_var;
-
-    u32 num_active;
     pthread_cond_t active_cond_var;
 } thread_pool;
 
+// worker is NULL when the task is run by the thread adding it
+static void linux_run_task(thread_pool* tp, _thread_worker* worker, thread_task task) {
+    u64 start = os_now_usec();
+    task.func(task.arg);
+
+    // Before the task counts as finished, so it is in by the time thread_pool_wait returns
+    if (worker != NULL) {
+        atomic_store_u64(&worker->busy_usec, worker->busy_usec + (os_now_usec() - start));
+    }
+
+    if (atomic_add_u32(&tp->num_pending, (u32)-1) == 1) {
+        pthread_mutex_lock(&tp->mutex);
+        pthread_cond_broadcast(&tp->active_cond_var);
+        pthread_mutex_unlock(&tp->mutex);
+    }
+}
+
+// Helps with the current job, if there still is one, and marks its generation as seen
+static void linux_join_job(thread_pool* tp, _thread_worker* worker, u64* seen_gen) {
+    atomic_add_u32(&tp->job_workers, 1);
+
+    // The caller stores the job before its generation, so this either gets that job,
+    // a later one or none. Reading a later job just means joining it one generation early
+    u64 gen = atomic_load_u64(&tp->job_gen);
+    _parallel_job* job = (_parallel_job*)(uintptr_t)atomic_load_u64(&tp->job);
+
+    if (job != NULL) {
+        u64 start = os_now_usec();
+        b32 last = _parallel_job_run(job);
+
+        atomic_store_u64(&worker->busy_usec, worker->busy_usec + (os_now_usec() - start));
+
+        if (last) {
+            pthread_mutex_lock(&tp->mutex);
+            pthread_cond_broadcast(&tp->active_cond_var);
+            pthread_mutex_unlock(&tp->mutex);
+        }
+    }
+
+    *seen_gen = gen;
+
+    // The job lives on the caller's stack, it cannot return before this
+    atomic_add_u32(&tp->job_workers, (u32)-1);
+}
+
 static void* linux_thread_start(void* arg) {
-    thread_pool* tp = (thread_pool*)arg;
+    _thread_worker* worker = (_thread_worker*)arg;
+    thread_pool* tp = worker->tp;
     thread_task task = { 0 };
+    u64 seen_gen = 0;
+
+    current_worker = worker;
+
+    TRACE_THREAD_NAME("pool worker");
 
     while (true) {
-        pthread_mutex_lock(&tp->mutex);
+        b32 found = false;
+        b32 job = false;
 
-        while (tp->num_tasks == 0) {
-            pthread_cond_wait(&tp->queue_cond_var, &tp->mutex);
-        }
+        for (u32 i = 0; i < SPIN_COUNT && !found && !job && !atomic_load_u32(&tp->stop); i++) {
+            job = atomic_load_u64(&tp->job_gen) != seen_gen;
+            found = !job && _task_queue_pop(&tp->queue, &task);
 
-        tp->num_active++;
-        task = tp->task_queue[0];
-        for (u32 i = 0; i < tp->num_tasks - 1; i++) {
-            tp->task_queue[i] = tp->task_queue[i + 1];
+            if (!found && !job) {
+                atomic_pause();
+            }
         }
-        tp->num_tasks--;
 
-        pthread_mutex_unlock(&tp->mutex);
+        if (!found && !job) {
+            pthread_mutex_lock(&tp->mutex);
 
-        task.func(task.arg);
+            // The producer checks num_sleeping after pushing,
+            // so either this pop sees the task or the producer sees the sleeper.
+            // The same goes for thread_pool_parallel_for and job_gen
+            atomic_add_u32(&tp->num_sleeping, 1);
+            while (
+                !atomic_load_u32(&tp->stop) &&
+                !(job = atomic_load_u64(&tp->job_gen) != seen_gen) &&
+                !(found = _task_queue_pop(&tp->queue, &task))
+            ) {
+                pthread_cond_wait(&tp->queue_cond_var, &tp->mutex);
+            }
+            atomic_add_u32(&tp->num_sleeping, (u32)-1);
 
-        pthread_mutex_lock(&tp->mutex);
+            pthread_mutex_unlock(&tp->mutex);
+        }
 
-        tp->num_active--;
-        if (tp->num_active == 0) {
-            pthread_cond_signal(&tp->active_cond_var);
+        if (job) {
+            linux_join_job(tp, worker, &seen_gen);
+            continue;
         }
 
-        pthread_mutex_unlock(&tp->mutex);
+        if (!found) {
+            break;
+        }
+
+        linux_run_task(tp, worker, task);
     }
 
     return NULL;
@@ -60,8 +164,7 @@ static void* linux_thread_start(void* arg) {
 thread_pool* thread_pool_create(mg_arena* arena, u32 num_threads, u32 max_tasks) {
     thread_pool* tp = MGA_PUSH_ZERO_STRUCT(arena, thread_pool);
 
-    tp->max_tasks = max_tasks;
-    tp->task_queue = MGA_PUSH_ZERO_ARRAY(arena, thread_task, max_tasks);
+    _task_queue_init(arena, &tp->queue, max_tasks);
 
     pthread_mutex_init(&tp->mutex, NULL);
     pthread_cond_init(&tp->queue_cond_var, NULL);
@@ -69,15 +172,26 @@ thread_pool* thread_pool_create(mg_arena* arena, u32 num_threads, u32 max_tasks)
 
     tp->num_threads = num_threads;
     tp->threads = MGA_PUSH_ZERO_ARRAY(arena, pthread_t, num_threads);
+    tp->workers = MGA_PUSH_ZERO_ARRAY(arena, _thread_worker, num_threads);
     for (u32 i = 0; i < num_threads; i++) {
-        pthread_create(&tp->threads[i], NULL, linux_thread_start, tp);
+        tp->workers[i].tp = tp;
+        pthread_create(&tp->threads[i], NULL, linux_thread_start, &tp->workers[i]);
     }
 
     return tp;
 }
 void thread_pool_destroy(thread_pool* tp) {
+    // Broadcasting under the mutex wakes every sleeper, including
+    // one that saw the flag clear but has not started waiting yet
+    pthread_mutex_lock(&tp->mutex);
+    atomic_store_u32(&tp->stop, 1);
+    pthread_cond_broadcast(&tp->queue_cond_var);
+    pthread_mutex_unlock(&tp->mutex);
+
+    // The pool usually lives on an arena that is freed right after this,
+    // so every worker has to be gone before returning
     for (u32 i = 0; i < tp->num_threads; i++) {
-        pthread_cancel(tp->threads[i]);
+        pthread_join(tp->threads[i], NULL);
     }
 
     pthread_mutex_destroy(&tp->mutex);
@@ -85,33 +199,228 @@ void thread_pool_destroy(thread_pool* tp) {
     pthread_cond_destroy(&tp->active_cond_var);
 }
 
-void thread_pool_add_task(thread_pool* tp, thread_task task) {
-    pthread_mutex_lock(&tp->mutex);
+u32 thread_pool_num_threads(thread_pool* tp) {
+    return tp->num_threads;
+}
 
-    if ((u64)tp->num_tasks + 1 >= (u64)tp->max_tasks) {
-        pthread_mutex_unlock(&tp->mutex);
-        fprintf(stderr, "Thread pool exceeded max tasks\n");
-        return;
+typedef struct {
+    u32 cpu;
+    u32 package;
+    u32 core;
+
+    // Sort keys of the policies
+    u32 smt_rank;
+    u32 core_rank;
+} _cpu_info;
+
+// Reads a number from the topology of a cpu in sysfs, returns fallback if it is missing
+static u32 linux_cpu_topology(u32 cpu, const char* name, u32 fallback) {
+    char path[128] = { 0 };
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/%s", cpu, name);
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return fallback;
     }
 
-    tp->task_queue[tp->num_tasks++] = task;
+    u32 value = fallback;
+    if (fscanf(f, "%u", &value) != 1) {
+        value = fallback;
+    }
+    fclose(f);
 
-    pthread_mutex_unlock(&tp->mutex);
+    return value;
+}
+
+// Order the policy hands out cpus in
+static b32 linux_cpu_before(const _cpu_info* a, const _cpu_info* b, thread_affinity affinity) {
+    u32 keys_a[3] = { a->package, a->core, a->cpu };
+    u32 keys_b[3] = { b->package, b->core, b->cpu };
 
-    pthread_cond_signal(&tp->queue_cond_var);
+    if (affinity == THREAD_AFFINITY_SCATTER) {
+        keys_a[0] = a->smt_rank;
+        keys_a[1] = a->core_rank;
+        keys_a[2] = a->package;
+
+        keys_b[0] = b->smt_rank;
+        keys_b[1] = b->core_rank;
+        keys_b[2] = b->package;
+    }
+
+    for (u32 i = 0; i < 3; i++) {
+        if (keys_a[i] != keys_b[i]) {
+            return keys_a[i] < keys_b[i];
+        }
+    }
+
+    return a->cpu < b->cpu;
 }
-void thread_pool_wait(thread_pool* tp) {
-    pthread_mutex_lock(&tp->mutex);
 
-    while (true) {
-        if (tp->num_active != 0 || tp->num_tasks != 0) {
-            pthread_cond_wait(&tp->active_cond_var, &tp->mutex);
+b32 thread_pool_set_affinity(thread_pool* tp, thread_affinity affinity) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return false;
+    }
+
+    b32 ok = true;
+
+    if (affinity == THREAD_AFFINITY_NONE) {
+        for (u32 i = 0; i < tp->num_threads; i++) {
+            ok = pthread_setaffinity_np(tp->threads[i], sizeof(allowed), &allowed) == 0 && ok;
+        }
+
+        return ok;
+    }
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    u32 num_cpus = 0;
+    _cpu_info* cpus = MGA_PUSH_ZERO_ARRAY(scratch.arena, _cpu_info, CPU_SETSIZE);
+
+    for (u32 cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[num_cpus++] = (_cpu_info){
+                .cpu = cpu,
+                .package = linux_cpu_topology(cpu, "physical_package_id", 0),
+                .core = linux_cpu_topology(cpu, "core_id", cpu)
+            };
+        }
+    }
+
+    // Hyperthreads of a core rank after its first cpu
+    for (u32 i = 0; i < num_cpus; i++) {
+        for (u32 j = 0; j < i; j++) {
+            cpus[i].smt_rank += cpus[j].package == cpus[i].package && cpus[j].core == cpus[i].core;
+        }
+    }
+    // Cores are counted from zero within their package, core_id can have gaps
+    for (u32 i = 0; i < num_cpus; i++) {
+        for (u32 j = 0; j < num_cpus; j++) {
+            cpus[i].core_rank += cpus[j].smt_rank == 0 &&
+                cpus[j].package == cpus[i].package && cpus[j].core < cpus[i].core;
+        }
+    }
+
+    // Insertion sort, there are only ever a few hundred cpus
+    for (u32 i = 1; i < num_cpus; i++) {
+        _cpu_info info = cpus[i];
+
+        u32 j = i;
+        while (j > 0 && linux_cpu_before(&info, &cpus[j - 1], affinity)) {
+            cpus[j] = cpus[j - 1];
+            j--;
+        }
+        cpus[j] = info;
+    }
+
+    for (u32 i = 0; i < tp->num_threads && num_cpus > 0; i++) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % num_cpus].cpu, &set);
+
+        ok = pthread_setaffinity_np(tp->threads[i], sizeof(set), &set) == 0 && ok;
+    }
+
+    mga_scratch_release(scratch);
+
+    return ok && num_cpus > 0;
+}
+
+u32 thread_pool_worker_index(thread_pool* tp) {
+    if (current_worker == NULL || current_worker->tp != tp) {
+        return tp->num_threads;
+    }
+
+    return (u32)(current_worker - tp->workers);
+}
+
+void thread_pool_busy_usec(thread_pool* tp, u64* busy_usec) {
+    for (u32 i = 0; i < tp->num_threads; i++) {
+        busy_usec[i] = atomic_load_u64(&tp->workers[i].busy_usec);
+    }
+}
+
+void thread_pool_add_task(thread_pool* tp, thread_task task) {
+    atomic_add_u32(&tp->num_pending, 1);
+
+    // When the queue is full, the caller helps drain it instead of dropping the task
+    while (!_task_queue_push(&tp->queue, task)) {
+        thread_task other = { 0 };
+
+        if (_task_queue_pop(&tp->queue, &other)) {
+            linux_run_task(tp, NULL, other);
         } else {
-            break;
+            sched_yield();
         }
     }
 
+    if (atomic_load_u32(&tp->num_sleeping) != 0) {
+        pthread_mutex_lock(&tp->mutex);
+        pthread_cond_signal(&tp->queue_cond_var);
+        pthread_mutex_unlock(&tp->mutex);
+    }
+}
+void thread_pool_wait(thread_pool* tp) {
+    pthread_mutex_lock(&tp->mutex);
+
+    while (atomic_load_u32(&tp->num_pending) != 0) {
+        pthread_cond_wait(&tp->active_cond_var, &tp->mutex);
+    }
+
     pthread_mutex_unlock(&tp->mutex);
 }
 
+void thread_pool_parallel_for(
+    thread_pool* tp, u64 begin, u64 end, u64 grain,
+    thread_range_func* func, void* ctx
+) {
+    if (begin >= end) {
+        return;
+    }
+
+    grain = MAX(grain, 1);
+
+    _parallel_job job = {
+        .func = func,
+        .ctx = ctx,
+        .begin = begin,
+        .end = end,
+        .grain = grain,
+        .num_chunks = (end - begin - 1) / grain + 1
+    };
+
+    // Not worth waking anyone
+    if (job.num_chunks == 1 || tp->num_threads == 0) {
+        _parallel_job_run(&job);
+        return;
+    }
+
+    atomic_store_u64(&tp->job, (u64)(uintptr_t)&job);
+    atomic_store_u64(&tp->job_gen, tp->job_gen + 1);
+
+    // One broadcast for the whole range, instead of a signal per task
+    if (atomic_load_u32(&tp->num_sleeping) != 0) {
+        pthread_mutex_lock(&tp->mutex);
+        pthread_cond_broadcast(&tp->queue_cond_var);
+        pthread_mutex_unlock(&tp->mutex);
+    }
+
+    _parallel_job_run(&job);
+
+    // Workers may still be running chunks they claimed
+    pthread_mutex_lock(&tp->mutex);
+    while (atomic_load_u64(&job.chunks_done) != job.num_chunks) {
+        pthread_cond_wait(&tp->active_cond_var, &tp->mutex);
+    }
+    pthread_mutex_unlock(&tp->mutex);
+
+    // Workers that woke up late see no job, but they still have to let go of it
+    atomic_store_u64(&tp->job, 0);
+    while (atomic_load_u32(&tp->job_workers) != 0) {
+        sched_yield();
+    }
+}
+
 #endif // PLATFORM_LINUX
@@ -3,59 +3,156 @@
 #ifdef PLATFORM_WIN32
 
 #include "os_thread_pool.h"
+#include "os_task_queue.h"
+#include "os.h"
+#include "trace/trace.h"
 
 #define UNICODE
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
-#include <stdio.h>
-
 // TODO: look into PTP_POOL
 
+// Number of empty polls before a worker goes to sleep
+#define SPIN_COUNT 256
+
+typedef struct {
+    thread_pool* tp;
+
+    // Only written by the worker, once per task
+    volatile u64 busy_usec;
+
+    // Workers update their own cache line
+    u8 _pad[48];
+} _thread_worker;
+
+// NULL on threads that are not workers of any pool
+static __declspec(thread) _thread_worker* current_worker = NULL;
+
 typedef struct _thread_pool {
     u32 num_threads;
     HANDLE* threads;
+    _thread_worker* workers;
 
-    u32 max_tasks;
-    u32 num_tasks;
-    thread_task* task_queue;
+    _task_queue queue;
 
+    // Tasks that have been added but not finished yet
+    volatile u32 num_pending;
+    volatile u32 num_sleeping;
+
+    // Set by thread_pool_destroy, workers return instead of taking another task
+    volatile u32 stop;
+
+    // Address of the _parallel_job that is running, 0 between jobs
+    volatile u64 job;
+    // Bumped for every job, workers join when it differs from the last one they saw
+    volatile u64 job_gen;
+    // Workers that may still be reading the job
+    volatile u32 job_workers;
+
+    // Only used for sleeping and waking, never for accessing the queue
     CRITICAL_SECTION mutex; // I know that it is not technically a mutex on win32
     CONDITION_VARIABLE queue_cond_var;
-
-    u32 num_active;
     CONDITION_VARIABLE active_cond_var;
 } thread_pool;
 
+// worker is NULL when the task is run by the thread adding it
+static void w32_run_task(thread_pool* tp, _thread_worker* worker, thread_task task) {
+    u64 start = os_now_usec();
+    task.func(task.arg);
+
+    // Before the task counts as finished, so it is in by the time thread_pool_wait returns
+    if (worker != NULL) {
+        atomic_store_u64(&worker->busy_usec, worker->busy_usec + (os_now_usec() - start));
+    }
+
+    if (atomic_add_u32(&tp->num_pending, (u32)-1) == 1) {
+        EnterCriticalSection(&tp->mutex);
+        WakeAllConditionVariable(&tp->active_cond_var);
+        LeaveCriticalSection(&tp->mutex);
+    }
+}
+
+// Helps with the current job, if there still is one, and marks its generation as seen
+static void w32_join_job(thread_pool* tp, _thread_worker* worker, u64* seen_gen) {
+    atomic_add_u32(&tp->job_workers, 1);
+
+    // The caller stores the job before its generation, so this either gets that job,
+    // a later one or none. Reading a later job just means joining it one generation early
+    u64 gen = atomic_load_u64(&tp->job_gen);
+    _parallel_job* job = (_parallel_job*)(uintptr_t)atomic_load_u64(&tp->job);
+
+    if (job != NULL) {
+        u64 start = os_now_usec();
+        b32 last = _parallel_job_run(job);
+
+        atomic_store_u64(&worker->busy_usec, worker->busy_usec + (os_now_usec() - start));
+
+        if (last) {
+            EnterCriticalSection(&tp->mutex);
+            WakeAllConditionVariable(&tp->active_cond_var);
+            LeaveCriticalSection(&tp->mutex);
+        }
+    }
+
+    *seen_gen = gen;
+
+    // The job lives on the caller's stack, it cannot return before this
+    atomic_add_u32(&tp->job_workers, (u32)-1);
+}
+
 static DWORD w32_thread_start(void* arg) {
-    thread_pool* tp = (thread_pool*)arg;
+    _thread_worker* worker = (_thread_worker*)arg;
+    thread_pool* tp = worker->tp;
     thread_task task = { 0 };
+    u64 seen_gen = 0;
+
+    current_worker = worker;
+
+    TRACE_THREAD_NAME("pool worker");
 
     while (true) {
-        EnterCriticalSection(&tp->mutex);
-        while (tp->num_tasks == 0) {
-            SleepConditionVariableCS(&tp->queue_cond_var, &tp->mutex, INFINITE);
-        }
+        b32 found = false;
+        b32 job = false;
 
-        tp->num_active++;
-        task = tp->task_queue[0];
-        for (u32 i = 0; i < tp->num_tasks - 1; i++) {
-            tp->task_queue[i] = tp->task_queue[i + 1];
+        for (u32 i = 0; i < SPIN_COUNT && !found && !job && !atomic_load_u32(&tp->stop); i++) {
+            job = atomic_load_u64(&tp->job_gen) != seen_gen;
+            found = !job && _task_queue_pop(&tp->queue, &task);
+
+            if (!found && !job) {
+                atomic_pause();
+            }
         }
-        tp->num_tasks--;
 
-        LeaveCriticalSection(&tp->mutex);
+        if (!found && !job) {
+            EnterCriticalSection(&tp->mutex);
 
-        task.func(task.arg);
+            // The producer checks num_sleeping after pushing,
+            // so either this pop sees the task or the producer sees the sleeper.
+            // The same goes for thread_pool_parallel_for and job_gen
+            atomic_add_u32(&tp->num_sleeping, 1);
+            while (
+                !atomic_load_u32(&tp->stop) &&
+                !(job = atomic_load_u64(&tp->job_gen) != seen_gen) &&
+                !(found = _task_queue_pop(&tp->queue, &task))
+            ) {
+                SleepConditionVariableCS(&tp->queue_cond_var, &tp->mutex, INFINITE);
+            }
+            atomic_add_u32(&tp->num_sleeping, (u32)-1);
 
-        EnterCriticalSection(&tp->mutex);
+            LeaveCriticalSection(&tp->mutex);
+        }
 
-        tp->num_active--;
-        if (tp->num_active == 0) {
-            WakeConditionVariable(&tp->active_cond_var);
+        if (job) {
+            w32_join_job(tp, worker, &seen_gen);
+            continue;
         }
 
-        LeaveCriticalSection(&tp->mutex);
+        if (!found) {
+            break;
+        }
+
+        w32_run_task(tp, worker, task);
     }
 
     return 0;
@@ -64,8 +161,7 @@ static DWORD w32_thread_start(void* arg) {
 thread_pool* thread_pool_create(mg_arena* arena, u32 num_threads, u32 max_tasks) {
     thread_pool* tp = MGA_PUSH_ZERO_STRUCT(arena, thread_pool);
 
-    tp->max_tasks = max_tasks;
-    tp->task_queue = MGA_PUSH_ZERO_ARRAY(arena, thread_task, max_tasks);
+    _task_queue_init(arena, &tp->queue, max_tasks);
 
     InitializeCriticalSection(&tp->mutex);
     InitializeConditionVariable(&tp->queue_cond_var);
@@ -73,47 +169,135 @@ thread_pool* thread_pool_create(mg_arena* arena, u32 num_threads, u32 max_tasks)
 
     tp->num_threads = num_threads;
     tp->threads = MGA_PUSH_ZERO_ARRAY(arena, HANDLE, num_threads);
+    tp->workers = MGA_PUSH_ZERO_ARRAY(arena, _thread_worker, num_threads);
     for (u32 i = 0; i < num_threads; i++) {
+        tp->workers[i].tp = tp;
         tp->threads[i] = CreateThread(
-            NULL, 0, w32_thread_start, tp, 0, NULL
+            NULL, 0, w32_thread_start, &tp->workers[i], 0, NULL
         );
     }
 
     return tp;
 }
 void thread_pool_destroy(thread_pool* tp) {
+    // Waking under the lock reaches a sleeper that saw the flag clear but has not started waiting yet
+    EnterCriticalSection(&tp->mutex);
+    atomic_store_u32(&tp->stop, 1);
+    WakeAllConditionVariable(&tp->queue_cond_var);
+    LeaveCriticalSection(&tp->mutex);
+
+    // The pool usually lives on an arena that is freed right after this,
+    // so every worker has to be gone before returning
     for (u32 i = 0; i < tp->num_threads; i++) {
+        WaitForSingleObject(tp->threads[i], INFINITE);
         CloseHandle(tp->threads[i]);
     }
 
     DeleteCriticalSection(&tp->mutex);
 }
 
+u32 thread_pool_num_threads(thread_pool* tp) {
+    return tp->num_threads;
+}
+
+b32 thread_pool_set_affinity(thread_pool* tp, thread_affinity affinity) {
+    // Processor groups would have to be handled for machines with over 64 cpus
+    UNUSED(tp);
+
+    return affinity == THREAD_AFFINITY_NONE;
+}
+
+u32 thread_pool_worker_index(thread_pool* tp) {
+    if (current_worker == NULL || current_worker->tp != tp) {
+        return tp->num_threads;
+    }
+
+    return (u32)(current_worker - tp->workers);
+}
+
+void thread_pool_busy_usec(thread_pool* tp, u64* busy_usec) {
+    for (u32 i = 0; i < tp->num_threads; i++) {
+        busy_usec[i] = atomic_load_u64(&tp->workers[i].busy_usec);
+    }
+}
+
 void thread_pool_add_task(thread_pool* tp, thread_task task) {
-    EnterCriticalSection(&tp->mutex);
+    atomic_add_u32(&tp->num_pending, 1);
+
+    // When the queue is full, the caller helps drain it instead of dropping the task
+    while (!_task_queue_push(&tp->queue, task)) {
+        thread_task other = { 0 };
+
+        if (_task_queue_pop(&tp->queue, &other)) {
+            w32_run_task(tp, NULL, other);
+        } else {
+            SwitchToThread();
+        }
+    }
 
-    if ((u64)tp->num_tasks + 1 >= (u64)tp->max_tasks) {
+    if (atomic_load_u32(&tp->num_sleeping) != 0) {
+        EnterCriticalSection(&tp->mutex);
+        WakeConditionVariable(&tp->queue_cond_var);
         LeaveCriticalSection(&tp->mutex);
-        fprintf(stderr, "Thread pool exceeded max tasks\n");
+    }
+}
+void thread_pool_wait(thread_pool* tp) {
+    EnterCriticalSection(&tp->mutex);
+    while (atomic_load_u32(&tp->num_pending) != 0) {
+        SleepConditionVariableCS(&tp->active_cond_var, &tp->mutex, INFINITE);
+    }
+    LeaveCriticalSection(&tp->mutex);
+}
+
+void thread_pool_parallel_for(
+    thread_pool* tp, u64 begin, u64 end, u64 grain,
+    thread_range_func* func, void* ctx
+) {
+    if (begin >= end) {
         return;
     }
 
-    tp->task_queue[tp->num_tasks++] = task;
+    grain = MAX(grain, 1);
 
-    LeaveCriticalSection(&tp->mutex);
-    WakeConditionVariable(&tp->queue_cond_var);
-}
-void thread_pool_wait(thread_pool* tp) {
+    _parallel_job job = {
+        .func = func,
+        .ctx = ctx,
+        .begin = begin,
+        .end = end,
+        .grain = grain,
+        .num_chunks = (end - begin - 1) / grain + 1
+    };
+
+    // Not worth waking anyone
+    if (job.num_chunks == 1 || tp->num_threads == 0) {
+        _parallel_job_run(&job);
+        return;
+    }
+
+    atomic_store_u64(&tp->job, (u64)(uintptr_t)&job);
+    atomic_store_u64(&tp->job_gen, tp->job_gen + 1);
+
+    // One broadcast for the whole range, instead of a signal per task
+    if (atomic_load_u32(&tp->num_sleeping) != 0) {
+        EnterCriticalSection(&tp->mutex);
+        WakeAllConditionVariable(&tp->queue_cond_var);
+        LeaveCriticalSection(&tp->mutex);
+    }
+
+    _parallel_job_run(&job);
+
+    // Workers may still be running chunks they claimed
     EnterCriticalSection(&tp->mutex);
-    while (true) {
-        if (tp->num_active != 0 || tp->num_tasks != 0) {
-            SleepConditionVariableCS(&tp->active_cond_var, &tp->mutex, INFINITE);
-        } else {
-            break;
-        }
+    while (atomic_load_u64(&job.chunks_done) != job.num_chunks) {
+        SleepConditionVariableCS(&tp->active_cond_var, &tp->mutex, INFINITE);
     }
     LeaveCriticalSection(&tp->mutex);
 
+    // Workers that woke up late see no job, but they still have to let go of it
+    atomic_store_u64(&tp->job, 0);
+    while (atomic_load_u32(&tp->job_workers) != 0) {
+        SwitchToThread();
+    }
 }
 
 #endif // PLATFORM_WIN32
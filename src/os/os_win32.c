@@ -0,0 +1,206 @@
+#include "base/base_defs.h"
+
+#ifdef PLATFORM_WIN32
+
+#include "os.h"
+
+#define UNICODE
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <winioctl.h>
+
+#include <stdio.h>
+
+u32 os_num_cpus(void) {
+    SYSTEM_INFO info = { 0 };
+    GetSystemInfo(&info);
+
+    return info.dwNumberOfProcessors > 0 ? (u32)info.dwNumberOfProcessors : 1;
+}
+
+u64 os_now_usec(void) {
+    LARGE_INTEGER freq = { 0 };
+    LARGE_INTEGER count = { 0 };
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+
+    // Split so the multiply does not overflow for long uptimes
+    u64 secs = (u64)count.QuadPart / (u64)freq.QuadPart;
+    u64 rem = (u64)count.QuadPart % (u64)freq.QuadPart;
+    return secs * 1000000 + rem * 1000000 / (u64)freq.QuadPart;
+}
+
+typedef struct _os_semaphore {
+    HANDLE handle;
+} os_semaphore;
+
+os_semaphore* os_semaphore_create(mg_arena* arena, u32 initial_count) {
+    os_semaphore* sem = MGA_PUSH_ZERO_STRUCT(arena, os_semaphore);
+    sem->handle = CreateSemaphoreW(NULL, (LONG)initial_count, 0x7fffffff, NULL);
+
+    return sem;
+}
+void os_semaphore_destroy(os_semaphore* sem) {
+    CloseHandle(sem->handle);
+}
+
+void os_semaphore_wait(os_semaphore* sem) {
+    WaitForSingleObject(sem->handle, INFINITE);
+}
+void os_semaphore_signal(os_semaphore* sem) {
+    ReleaseSemaphore(sem->handle, 1, NULL);
+}
+
+b32 os_file_map_open(os_file_map* map, const char* path) {
+    *map = (os_file_map){ 0 };
+
+    HANDLE file = CreateFileA(
+        path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size = { 0 };
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+
+    void* data = NULL;
+    if (mapping != NULL) {
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+
+    // The view keeps the mapping and the file open
+    if (mapping != NULL) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+
+    if (data == NULL) {
+        return false;
+    }
+
+    map->data = (const u8*)data;
+    map->size = (u64)size.QuadPart;
+
+    return true;
+}
+void os_file_map_close(os_file_map* map) {
+    if (map->data != NULL) {
+        UnmapViewOfFile(map->data);
+    }
+
+    *map = (os_file_map){ 0 };
+}
+
+// Builds the file under a name of its own and moves it to path, which fails if
+// another process got there first. Either way path then names a complete file
+static b32 shared_map_create(const char* path, u64 size, const void* init, u64 init_size) {
+    char tmp_path[1024] = { 0 };
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.%lu.tmp", path, (unsigned long)GetCurrentProcessId());
+    if (len < 0 || (u64)len >= sizeof(tmp_path) || init_size > size || init_size > 0xffffffff) {
+        return false;
+    }
+
+    HANDLE file = CreateFileA(
+        tmp_path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // Otherwise growing the file writes out every byte of it.
+    // File systems without sparse files just fail this
+    DWORD bytes_returned = 0;
+    DeviceIoControl(file, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes_returned, NULL);
+
+    LARGE_INTEGER end = { .QuadPart = (LONGLONG)size };
+    DWORD written = 0;
+    b32 built = SetFilePointerEx(file, end, NULL, FILE_BEGIN) && SetEndOfFile(file) &&
+        SetFilePointerEx(file, (LARGE_INTEGER){ 0 }, NULL, FILE_BEGIN) &&
+        (init_size == 0 || (WriteFile(file, init, (DWORD)init_size, &written, NULL) && written == init_size));
+    CloseHandle(file);
+
+    b32 moved = false;
+    if (built) {
+        moved = MoveFileExA(tmp_path, path, 0) ||
+            GetLastError() == ERROR_ALREADY_EXISTS || GetLastError() == ERROR_FILE_EXISTS;
+    }
+    DeleteFileA(tmp_path);
+
+    return moved;
+}
+
+b32 os_shared_map_open(os_shared_map* map, const char* path, u64 size, const void* init, u64 init_size) {
+    *map = (os_shared_map){ 0 };
+
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, share, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_NOT_FOUND &&
+        size > 0 && shared_map_create(path, size, init, init_size)) {
+        file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, share, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // The size of the file, which can be another one than size if it already existed
+    LARGE_INTEGER file_size = { 0 };
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        mapping = CreateFileMappingW(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    }
+
+    void* data = NULL;
+    if (mapping != NULL) {
+        data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    }
+
+    // The view keeps the mapping and the file open
+    if (mapping != NULL) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+
+    if (data == NULL) {
+        return false;
+    }
+
+    map->data = (u8*)data;
+    map->size = (u64)file_size.QuadPart;
+
+    return true;
+}
+void os_shared_map_close(os_shared_map* map) {
+    if (map->data != NULL) {
+        UnmapViewOfFile(map->data);
+    }
+
+    *map = (os_shared_map){ 0 };
+}
+
+b32 os_user_cache_path(char* path, u64 path_size, const char* app_name, const char* file_name) {
+    DWORD len = GetEnvironmentVariableA("LOCALAPPDATA", path, (DWORD)MIN(path_size, 0xffffffff));
+    if (len == 0 || (u64)len >= path_size) {
+        return false;
+    }
+
+    int app_len = snprintf(path + len, path_size - len, "\\%s", app_name);
+    if (app_len < 0 || (u64)len + (u64)app_len >= path_size) {
+        return false;
+    }
+    len += (DWORD)app_len;
+
+    if (!CreateDirectoryA(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return false;
+    }
+
+    int file_len = snprintf(path + len, path_size - len, "\\%s", file_name);
+    return file_len >= 0 && (u64)len + (u64)file_len < path_size;
+}
+
+#endif // PLATFORM_WIN32
@@ -0,0 +1,421 @@
+#include "render.h"
+#include "render_kernels.h"
+
+#include "fpng/fpng.h"
+
+// Periodicity tolerance, as a fraction of a pixel
+#define PERIODICITY_TOLERANCE 1e-3
+
+void mandelbrot_row_scalar(const mandelbrot_args* args, u32 y, u32 start_x, u32 end_x) {
+    for (u32 x = start_x; x < end_x; x++) {
+        complexd z = { 0 };
+        complexd c = {
+            mandelbrot_offset_r(args, x) + args->complex_center.r,
+            mandelbrot_offset_i(args, y) + args->complex_center.i
+        };
+
+        f32 n = (f32)args->iterations - 1.0;
+
+        if (args->interior_checks && mandelbrot_in_main_bulbs(c.r, c.i)) {
+            args->out[x + y * args->img_width] = n;
+            continue;
+        }
+
+        // Brent's cycle detection, the saved point moves at powers of two
+        complexd saved = { 0 };
+        u32 save_at = 1;
+
+        for (u32 i = 0; i < args->iterations; i++) {
+            z = complexd_add(complexd_mul(z, z), c);
+
+            f64 mag = z.r * z.r + z.i * z.i;
+            if (mag > MANDELBROT_BAILOUT) {
+                n = mandelbrot_smooth(i, mag);
+                break;
+            }
+
+            if (args->interior_checks) {
+                if (fabs(z.r - saved.r) < args->periodicity_eps && fabs(z.i - saved.i) < args->periodicity_eps) {
+                    break;
+                }
+
+                if (i == save_at) {
+                    saved = z;
+                    save_at *= 2;
+                }
+            }
+        }
+
+        args->out[x + y * args->img_width] = n;
+    }
+}
+
+void mandelbrot_tile_scalar(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    for (u32 y = start_y; y < end_y; y++) {
+        mandelbrot_row_scalar(args, y, start_x, end_x);
+    }
+}
+
+render_kernel render_kernel_resolve(render_kernel kernel) {
+    b32 has_avx512 = fpng_cpu_supports_avx512();
+    b32 has_avx2 = fpng_cpu_supports_avx2();
+
+    if (kernel == RENDER_KERNEL_AUTO) {
+        kernel = has_avx512 ? RENDER_KERNEL_AVX512 : RENDER_KERNEL_AVX2;
+    }
+
+    if (kernel == RENDER_KERNEL_AVX512 && !has_avx512) {
+        kernel = RENDER_KERNEL_AVX2;
+    }
+    if (kernel == RENDER_KERNEL_AVX2 && !has_avx2) {
+        kernel = RENDER_KERNEL_SCALAR;
+    }
+
+    return kernel;
+}
+
+string8 render_kernel_name(render_kernel kernel) {
+    switch (kernel) {
+        case RENDER_KERNEL_AUTO: return STR8("auto");
+        case RENDER_KERNEL_SCALAR: return STR8("scalar");
+        case RENDER_KERNEL_AVX2: return STR8("avx2");
+        case RENDER_KERNEL_AVX512: return STR8("avx512");
+        default: break;
+    }
+
+    return STR8("unknown");
+}
+
+#define TILE_SIZE 64
+
+// Each worker owns a contiguous range of tile indices, worker i of the pool
+// starts on the i-th range, which render_first_touch placed on its NUMA node.
+// The owner pops from the front and idle workers steal from the back.
+// Both ends live in one u64 so a single cas claims a tile from either side
+typedef struct {
+    // Low 32 bits are the front, high 32 bits are the back
+    volatile u64 range;
+
+    // Keeps the deques on separate cache lines
+    u8 _pad[56];
+} tile_deque;
+
+typedef struct _tile_sched {
+    thread_pool* tp;
+    mandelbrot_args args;
+    mandelbrot_tile_func* tile_func;
+
+    u32 tiles_x;
+    u32 tiles_y;
+
+    u32 num_workers;
+    tile_deque* deques;
+
+    volatile u32* cancel;
+    volatile u32 workers_left;
+} tile_sched;
+
+typedef struct {
+    tile_sched* sched;
+    u32 index;
+} tile_worker_args;
+
+#define TILE_RANGE(front, back) ((u64)(front) | ((u64)(back) << 32))
+#define TILE_FRONT(range) (u32)((range) & 0xffffffff)
+#define TILE_BACK(range) (u32)((range) >> 32)
+
+#define TILE_CANCELLED(sched) ((sched)->cancel != NULL && atomic_load_u32((sched)->cancel) != 0)
+
+static b32 tile_deque_pop(tile_deque* deque, u32* tile) {
+    u64 range = atomic_load_u64(&deque->range);
+
+    while (TILE_FRONT(range) < TILE_BACK(range)) {
+        u32 front = TILE_FRONT(range);
+
+        if (atomic_cas_u64(&deque->range, &range, TILE_RANGE(front + 1, TILE_BACK(range)))) {
+            *tile = front;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static b32 tile_deque_steal(tile_deque* deque, u32* tile) {
+    u64 range = atomic_load_u64(&deque->range);
+
+    while (TILE_FRONT(range) < TILE_BACK(range)) {
+        u32 back = TILE_BACK(range) - 1;
+
+        if (atomic_cas_u64(&deque->range, &range, TILE_RANGE(TILE_FRONT(range), back))) {
+            *tile = back;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void render_tile(tile_sched* sched, u32 tile) {
+    u32 start_x = (tile % sched->tiles_x) * TILE_SIZE;
+    u32 start_y = (tile / sched->tiles_x) * TILE_SIZE;
+    u32 end_x = MIN(start_x + TILE_SIZE, sched->args.img_width);
+    u32 end_y = MIN(start_y + TILE_SIZE, sched->args.img_height);
+
+    TRACE_ZONE_BEGIN(zone, "render tile");
+    sched->tile_func(&sched->args, start_x, start_y, end_x, end_y);
+    TRACE_ZONE_END(zone);
+}
+
+static void render_tile_worker(void* void_args) {
+    tile_worker_args* args = (tile_worker_args*)void_args;
+    tile_sched* sched = args->sched;
+
+    // Tasks are not tied to workers, so a worker that runs two of them
+    // finds its range empty the second time and only steals
+    u32 home = thread_pool_worker_index(sched->tp);
+    if (home >= sched->num_workers) {
+        home = args->index;
+    }
+
+    u32 tile = 0;
+    while (!TILE_CANCELLED(sched) && tile_deque_pop(&sched->deques[home], &tile)) {
+        render_tile(sched, tile);
+    }
+
+    // No tiles are added during a frame, so once a victim
+    // is empty it stays empty and a single pass is enough
+    for (u32 i = 1; i < sched->num_workers; i++) {
+        tile_deque* victim = &sched->deques[(home + i) % sched->num_workers];
+
+        while (!TILE_CANCELLED(sched) && tile_deque_steal(victim, &tile)) {
+            render_tile(sched, tile);
+        }
+    }
+
+    atomic_add_u32(&sched->workers_left, (u32)-1);
+}
+
+tile_sched* render_tiles_begin(
+    mg_arena* arena, thread_pool* tp, const mandelbrot_args* args,
+    mandelbrot_tile_func* tile_func, volatile u32* cancel
+) {
+    tile_sched* sched = MGA_PUSH_ZERO_STRUCT(arena, tile_sched);
+    *sched = (tile_sched){
+        .tp = tp,
+        .args = *args,
+        .tile_func = tile_func,
+        .tiles_x = (args->img_width + TILE_SIZE - 1) / TILE_SIZE,
+        .tiles_y = (args->img_height + TILE_SIZE - 1) / TILE_SIZE,
+        .num_workers = thread_pool_num_threads(tp),
+        .cancel = cancel
+    };
+    sched->workers_left = sched->num_workers;
+
+    u32 num_tiles = sched->tiles_x * sched->tiles_y;
+    sched->deques = MGA_PUSH_ZERO_ARRAY(arena, tile_deque, sched->num_workers);
+
+    for (u32 i = 0; i < sched->num_workers; i++) {
+        u32 front = (u32)((u64)num_tiles * i / sched->num_workers);
+        u32 back = (u32)((u64)num_tiles * (i + 1) / sched->num_workers);
+        sched->deques[i].range = TILE_RANGE(front, back);
+    }
+
+    for (u32 i = 0; i < sched->num_workers; i++) {
+        tile_worker_args* worker_args = MGA_PUSH_ZERO_STRUCT(arena, tile_worker_args);
+        *worker_args = (tile_worker_args){
+            .sched = sched,
+            .index = i
+        };
+
+        thread_pool_add_task(
+            tp,
+            (thread_task){
+                .func = render_tile_worker,
+                .arg = worker_args
+            }
+        );
+    }
+
+    return sched;
+}
+
+b32 render_tiles_finished(tile_sched* sched) {
+    return atomic_load_u32(&sched->workers_left) == 0;
+}
+
+typedef struct {
+    thread_pool* tp;
+    u8* buffer;
+    u32 num_bands;
+
+    // Band i is [offsets[i], offsets[i + 1]) bytes
+    u64* offsets;
+    volatile u32* claimed;
+} touch_sched;
+
+typedef struct {
+    touch_sched* sched;
+    u32 index;
+} touch_task_args;
+
+static void touch_band_task(void* void_args) {
+    touch_task_args* args = (touch_task_args*)void_args;
+    touch_sched* sched = args->sched;
+
+    u32 home = thread_pool_worker_index(sched->tp);
+    if (home >= sched->num_bands) {
+        home = args->index;
+    }
+
+    // The band of this worker if no other task took it, any other band otherwise,
+    // which only happens when a worker picks up two tasks
+    for (u32 i = 0; i < sched->num_bands; i++) {
+        u32 band = (home + i) % sched->num_bands;
+
+        u32 expected = 0;
+        if (atomic_cas_u32(&sched->claimed[band], &expected, 1)) {
+            memset(sched->buffer + sched->offsets[band], 0, sched->offsets[band + 1] - sched->offsets[band]);
+            break;
+        }
+    }
+}
+
+void render_first_touch(thread_pool* tp, void* buffer, u32 width, u32 height, u32 pixel_size) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    touch_sched sched = {
+        .tp = tp,
+        .buffer = (u8*)buffer,
+        .num_bands = thread_pool_num_threads(tp)
+    };
+    sched.offsets = MGA_PUSH_ARRAY(scratch.arena, u64, sched.num_bands + 1);
+    sched.claimed = MGA_PUSH_ZERO_ARRAY(scratch.arena, u32, sched.num_bands);
+
+    // Same split as render_tiles_begin. Tiles go row by row,
+    // so a range starting at tile front starts about front / tiles_x tile rows down
+    u32 tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    u32 tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    u64 num_tiles = (u64)tiles_x * tiles_y;
+    u64 row_size = (u64)width * pixel_size;
+
+    for (u32 i = 0; i < sched.num_bands; i++) {
+        u64 front = num_tiles * i / sched.num_bands;
+        u64 row = MIN(height, front * TILE_SIZE / tiles_x);
+
+        sched.offsets[i] = row * row_size;
+    }
+    sched.offsets[sched.num_bands] = (u64)height * row_size;
+
+    touch_task_args* args = MGA_PUSH_ARRAY(scratch.arena, touch_task_args, sched.num_bands);
+    for (u32 i = 0; i < sched.num_bands; i++) {
+        args[i] = (touch_task_args){ .sched = &sched, .index = i };
+
+        thread_pool_add_task(tp, (thread_task){ .func = touch_band_task, .arg = &args[i] });
+    }
+
+    thread_pool_wait(tp);
+
+    mga_scratch_release(scratch);
+}
+
+void mandelbrot_tile_masked(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    for (u32 y = start_y; y < end_y; y++) {
+        const u8* covered = args->covered + (u64)(y * args->grid_step + args->grid_y) * args->covered_width;
+
+        u32 x = start_x;
+        while (x < end_x) {
+            while (x < end_x && covered[x * args->grid_step + args->grid_x]) {
+                x++;
+            }
+
+            u32 run_start = x;
+            while (x < end_x && !covered[x * args->grid_step + args->grid_x]) {
+                x++;
+            }
+
+            if (x > run_start) {
+                args->masked_func(args, run_start, y, x, y + 1);
+            }
+        }
+    }
+}
+
+void render_tiles(thread_pool* tp, const mandelbrot_args* args, mandelbrot_tile_func* tile_func) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    render_tiles_begin(scratch.arena, tp, args, tile_func, NULL);
+    thread_pool_wait(tp);
+
+    mga_scratch_release(scratch);
+}
+
+void render_image(thread_pool* tp, const mandelbrot_args* args, mandelbrot_tile_func* tile_func, render_method method) {
+    if (method == RENDER_METHOD_SUBDIVIDE) {
+        render_subdivide(tp, args, tile_func);
+    } else {
+        render_tiles(tp, args, tile_func);
+    }
+}
+
+mandelbrot_tile_func* render_setup_f64(mandelbrot_args* args, f32* out, const render_desc* desc) {
+    mandelbrot_tile_func* tile_funcs[RENDER_KERNEL_COUNT] = {
+        [RENDER_KERNEL_SCALAR] = mandelbrot_tile_scalar,
+        [RENDER_KERNEL_AVX2] = mandelbrot_tile_avx2,
+        [RENDER_KERNEL_AVX512] = mandelbrot_tile_avx512,
+    };
+
+    *args = (mandelbrot_args){
+        .out = out,
+        .img_width = desc->width,
+        .img_height = desc->height,
+        .complex_dim = desc->dim,
+        .complex_center = desc->center,
+        .iterations = desc->iterations,
+        .grid_width = desc->width,
+        .grid_height = desc->height,
+        .grid_step = 1,
+        .interior_checks = desc->interior_checks,
+        .periodicity_eps = PERIODICITY_TOLERANCE * MIN(desc->dim.r / (f64)desc->width, desc->dim.i / (f64)desc->height)
+    };
+
+    return tile_funcs[render_kernel_resolve(desc->kernel)];
+}
+
+void render_mandelbrot(thread_pool* tp, f32* out, const render_desc* desc) {
+    mandelbrot_args args = { 0 };
+    mandelbrot_tile_func* tile_func = render_setup_f64(&args, out, desc);
+
+    render_image(tp, &args, tile_func, desc->method);
+}
+
+mandelbrot_tile_func* render_setup_auto(
+    mg_arena* arena, mandelbrot_args* args, f32* out,
+    const render_desc* desc, const complex_fixedpt* center
+) {
+    if (desc->dim.r < RENDER_PERTURB_MAX_DIM) {
+        return render_setup_perturb(arena, args, out, desc, center);
+    }
+
+    if (desc->dim.r < RENDER_DD_MAX_DIM) {
+        complexdd center_dd = { f64x2_from_f64(desc->center.r), f64x2_from_f64(desc->center.i) };
+        if (center != NULL) {
+            center_dd = (complexdd){ fixedpt_to_f64x2(&center->r), fixedpt_to_f64x2(&center->i) };
+        }
+
+        return render_setup_dd(args, out, desc, &center_dd);
+    }
+
+    return render_setup_f64(args, out, desc);
+}
+
+void render_mandelbrot_auto(thread_pool* tp, f32* out, const render_desc* desc, const complex_fixedpt* center) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    mandelbrot_args args = { 0 };
+    mandelbrot_tile_func* tile_func = render_setup_auto(scratch.arena, &args, out, desc, center);
+
+    render_image(tp, &args, tile_func, desc->method);
+
+    mga_scratch_release(scratch);
+}
@@ -0,0 +1,294 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "base/base.h"
+#include "os/os_thread_pool.h"
+#include "math/math_complex.h"
+#include "math/math_fixed.h"
+
+typedef struct {
+    u8 r, g, b, a;
+} pixel8;
+
+typedef enum {
+    // Picks the widest kernel supported by the cpu
+    RENDER_KERNEL_AUTO = 0,
+
+    // Reference implementation, one pixel at a time
+    RENDER_KERNEL_SCALAR,
+
+    // 4 f64 lanes
+    RENDER_KERNEL_AVX2,
+    // 8 f64 lanes
+    RENDER_KERNEL_AVX512,
+
+    RENDER_KERNEL_COUNT
+} render_kernel;
+
+typedef enum {
+    // Every pixel is iterated, in work stealing tiles
+    RENDER_METHOD_TILES = 0,
+
+    // Mariani-Silver subdivision, rectangles whose border never escaped
+    // are filled without iterating their inside. Several times faster on views
+    // with large parts of the set without interior_checks, about as fast as
+    // tiles with them. Exterior filaments thinner than a pixel can be filled
+    // over, so a few counts can differ from RENDER_METHOD_TILES
+    RENDER_METHOD_SUBDIVIDE,
+
+    RENDER_METHOD_COUNT
+} render_method;
+
+typedef struct {
+    u32 width;
+    u32 height;
+
+    complexd dim;
+    complexd center;
+    u32 iterations;
+
+    render_kernel kernel;
+    render_method method;
+
+    // Lets pixels inside the set stop early, by testing for the main
+    // cardioid and period 2 bulb and by detecting periodic orbits.
+    // Only used by render_mandelbrot
+    b32 interior_checks;
+} render_desc;
+
+// Palettes
+// Renders only produce iteration counts, which are colored in a separate pass.
+// The colors of one cycle of the palette are precomputed into a table,
+// so coloring is a multiply and a lookup per pixel, and cycling the palette
+// or changing its exposure only rebuilds the table
+
+#define RENDER_PALETTE_SIZE 1024
+
+typedef enum {
+    // The colors cycle at a fixed number of iterations
+    RENDER_COLOR_CYCLE = 0,
+
+    // Histogram equalization, the colors go by the fraction of escaped pixels
+    // with a lower count, so they spread evenly over the image at any depth
+    RENDER_COLOR_HISTOGRAM,
+
+    RENDER_COLOR_COUNT
+} render_color_mode;
+
+typedef struct {
+    render_color_mode mode;
+
+    // Iterations per cycle through the colors, only for RENDER_COLOR_CYCLE
+    f32 period;
+    // Cycles through the colors over the whole image, only for RENDER_COLOR_HISTOGRAM
+    f32 cycles;
+    // Shifts the colors by a fraction of a cycle, for palette cycling
+    f32 offset;
+    // Multiplies every color, 1 leaves them as they are
+    f32 exposure;
+    // Vector path of the colorize pass. There is only an AVX2 one,
+    // which RENDER_KERNEL_AVX512 uses as well
+    render_kernel kernel;
+} render_palette_desc;
+
+typedef struct {
+    pixel8 colors[RENDER_PALETTE_SIZE];
+
+    render_color_mode mode;
+
+    // Maps an iteration count, or a fraction of the histogram, to its entry of colors
+    f32 scale;
+    f32 bias;
+
+    // Color of pixels that never escaped
+    pixel8 interior;
+
+    // Resolved, never RENDER_KERNEL_AUTO
+    render_kernel kernel;
+} render_palette;
+
+// Fields of desc that are zero get the defaults
+void render_palette_build(render_palette* palette, const render_palette_desc* desc);
+
+// Colors count pixels from their iteration counts,
+// iterations is the limit they were rendered with.
+// The histogram of a histogram palette only covers the pixels passed in
+void render_colorize_span(pixel8* out, const f32* iters, u64 count, u32 iterations, const render_palette* palette);
+// Same, split into chunks on the thread pool.
+// Histograms are counted into a partial histogram per thread, which are summed
+// in ranges of bins without any locks before the pixels are colored
+void render_colorize(thread_pool* tp, pixel8* out, const f32* iters, u64 count, u32 iterations, const render_palette* palette);
+
+// Adaptive anti-aliasing
+// Pixels where the counts of their 3x3 neighbourhood spread out more than a threshold
+// are rendered again on a grid of samples x samples points within the pixel, and get
+// the average color of those points. The grid is shifted by a random fraction of its
+// spacing for every run of pixels, which trades the moire of a fixed grid for noise.
+// The edges of the set and its filaments are usually a small part of an image,
+// so this costs far less than rendering every pixel samples^2 times
+
+typedef struct {
+    // Points per side of the grid of a refined pixel, 0 or 1 disables anti-aliasing
+    u32 samples;
+    // Standard deviation of the counts of a neighbourhood, in iterations,
+    // above which its center pixel is refined. Zero gets the default
+    f32 threshold;
+} render_aa_desc;
+
+// Colors iters into out like render_colorize, then refines the pixels that aa picks.
+// desc and center have to be the ones iters was rendered with.
+// Returns the number of refined pixels
+u64 render_colorize_aa(
+    thread_pool* tp, pixel8* out, const f32* iters,
+    const render_desc* desc, const complex_fixedpt* center,
+    const render_palette* palette, const render_aa_desc* aa
+);
+
+// Pages of a new buffer go to the NUMA node of the thread that writes them first.
+// This zeroes an image of width * height pixels of pixel_size bytes on the thread pool,
+// with every worker writing the rows of the tiles it starts rendering from.
+// With pinned workers (see thread_pool_set_affinity), every part of an image that is
+// rendered into it is then close to the worker that renders it.
+// Only buffers that have never been written are placed, so call it right after allocating
+void render_first_touch(thread_pool* tp, void* buffer, u32 width, u32 height, u32 pixel_size);
+
+// fpng_init must be called before any kernel is resolved,
+// because the cpu feature detection lives there
+render_kernel render_kernel_resolve(render_kernel kernel);
+string8 render_kernel_name(render_kernel kernel);
+
+// out receives the iteration count of every pixel,
+// which is iterations - 1 for pixels that never escaped
+void render_mandelbrot(thread_pool* tp, f32* out, const render_desc* desc);
+
+// Dims where render_mandelbrot_auto switches to a slower, more precise path.
+// Below RENDER_DD_MAX_DIM the f64 kernels start breaking up into blocks,
+// and below RENDER_PERTURB_MAX_DIM double-double runs out of mantissa too
+#define RENDER_DD_MAX_DIM 1e-12
+#define RENDER_PERTURB_MAX_DIM 1e-27
+
+// Iterates every pixel in double-double precision (see math_f64x2.h).
+// This covers dims from about 1e-13 to 1e-28 without the cost of a reference orbit.
+// center overrides desc->center when it is not NULL
+void render_mandelbrot_dd(thread_pool* tp, f32* out, const render_desc* desc, const complexdd* center);
+
+// Renders with f64 deltas from one high precision reference orbit at the center.
+// This keeps working past the ~1e-13 limit of render_mandelbrot, down to dims of about 1e-300.
+// center overrides desc->center when it is not NULL, and can have any precision.
+// desc->kernel is ignored
+void render_mandelbrot_perturb(thread_pool* tp, f32* out, const render_desc* desc, const complex_fixedpt* center);
+
+// Picks render_mandelbrot, render_mandelbrot_dd or render_mandelbrot_perturb
+// based on desc->dim. center overrides desc->center for the deeper paths when it is not NULL
+void render_mandelbrot_auto(thread_pool* tp, f32* out, const render_desc* desc, const complex_fixedpt* center);
+
+// Renders like render_mandelbrot_auto, but takes what it can from prev, a render of the same
+// center and size with a smaller prev_dim. Points of desc that fall between samples of prev
+// are interpolated from them where they all escaped on the same iteration, and every other
+// pixel is rendered. Returns the number of pixels taken from prev.
+// Without a prev this is render_mandelbrot_auto, desc->method is ignored otherwise
+u64 render_mandelbrot_reuse(
+    thread_pool* tp, f32* out, const render_desc* desc,
+    const complex_fixedpt* center, const f32* prev, complexd prev_dim
+);
+
+// Tile cache
+// Keeps the iteration counts of earlier renders, so views that overlap them
+// only render what is new. Pixels are points of a lattice with the spacing of
+// the view, cut into square tiles. Halving the spacing is a level down a quadtree,
+// and every point of a level is also on the levels below it, so zooming out
+// is filled from the tiles of the deeper views as well.
+// Tiles are evicted least recently used first once the cache is full.
+// Only views for the f64 kernels can be cached, deeper ones always render.
+// A cache can also keep its tiles in a file, which lasts across sessions
+// and can be shared by any number of processes at once (see render_cache.c).
+// Tiles in the file are addressed by the formula, precision, iteration limit,
+// spacing and position of their points, so they are found again by any view
+// that lands on the same points. Nothing here is thread safe
+typedef struct _render_cache render_cache;
+
+// max_size is the memory budget of the tiles in bytes
+render_cache* render_cache_create(mg_arena* arena, u64 max_size);
+void render_cache_destroy(render_cache* cache);
+
+// Maps the file at path, and creates it with a size of about max_size bytes
+// if it does not exist. Tiles missing from memory are looked up in the file,
+// and every tile that is stored goes to the file too.
+// Returns false if the file cannot be mapped or was written by another version
+b32 render_cache_open_file(render_cache* cache, mg_arena* arena, const char* path, u64 max_size);
+
+// Counts of tile lookups since the cache was created
+typedef struct {
+    // Tiles found in memory
+    u64 hits;
+    // Tiles found in the file
+    u64 file_hits;
+    // Tiles of a view that were not found anywhere
+    u64 misses;
+    // Tiles written to the file
+    u64 file_writes;
+} render_cache_stats;
+
+render_cache_stats render_cache_get_stats(const render_cache* cache);
+
+typedef struct {
+    // Distance between pixels
+    f64 spacing_r;
+    f64 spacing_i;
+    // Lattice index of pixel (0, 0)
+    i64 x, y;
+    u32 width;
+    u32 height;
+
+    u32 iterations;
+    b32 interior_checks;
+} render_cache_view;
+
+// Moves desc->center by less than half a pixel, so its pixels land on the lattice.
+// Returns false for views that cannot be cached, desc is left as it is then
+b32 render_cache_view_init(render_cache_view* view, render_desc* desc);
+// Copies every pixel of the view the cache has into out and sets their covered flags.
+// Pixels that are covered already are left alone, returns the number of flags set
+u64 render_cache_read(render_cache* cache, const render_cache_view* view, f32* out, u8* covered);
+// Stores every pixel of iters, which is the full image of view
+void render_cache_write(render_cache* cache, const render_cache_view* view, const f32* iters);
+
+// Renders like render_mandelbrot_auto, but only the pixels that are not in the cache,
+// and stores the image in it afterwards. The view is moved onto the lattice, see above,
+// and desc->method is ignored. A NULL cache renders everything
+void render_mandelbrot_cached(
+    render_cache* cache, thread_pool* tp, f32* out,
+    const render_desc* desc, const complex_fixedpt* center
+);
+
+// Progressive rendering for interactive use.
+// An image is rendered in passes at 1/8, 1/4, 1/2 and full resolution,
+// and each pass only computes the pixels the earlier passes did not.
+// The passes run on the thread pool while the caller keeps going,
+// so nothing else may use the pool while a render is in flight.
+// desc->method is ignored, every pass is rendered in tiles.
+// With a cache, the pixels it has are shown at full resolution from the first pass
+// and skipped by every pass, and the finished image is stored in it
+typedef struct _render_progressive render_progressive;
+
+// cache can be NULL
+render_progressive* render_progressive_create(mg_arena* arena, thread_pool* tp, u32 width, u32 height, render_cache* cache);
+void render_progressive_destroy(render_progressive* rp);
+
+// Cancels the render in flight, and starts on a new one.
+// The path is picked the same way as render_mandelbrot_auto, and desc->width/height are ignored.
+// For deep views the reference orbit is computed before this returns
+void render_progressive_start(render_progressive* rp, const render_desc* desc, const complex_fixedpt* center);
+
+// Stops the render in flight, this only waits for the tiles that are already running
+void render_progressive_cancel(render_progressive* rp);
+
+// Returns true when another pass has finished since the last call,
+// and colors the image so far into out. Pixels that have not been rendered
+// yet are filled from the nearest sample above and to the left.
+// Only the rendered pixels are colored, and a histogram palette only counts them
+b32 render_progressive_update(render_progressive* rp, pixel8* out, const render_palette* palette);
+
+b32 render_progressive_done(render_progressive* rp);
+
+#endif // RENDER_H
@@ -0,0 +1,242 @@
+#include "render.h"
+#include "render_kernels.h"
+
+// Every chunk is a band of rows. It finds the pixels to refine in each row,
+// and renders every run of neighbouring ones as one small grid, so the
+// vector kernels get rows of sub-pixel points to work on.
+// A run of k pixels in row y is a (k * samples) x samples grid. Its points sit on a
+// grid AA_JITTER_STEPS times finer, which is what lets the shift be a fraction
+// of the spacing and still go through the integer grid of mandelbrot_args.
+// The grid of a pixel spans half a pixel on either side of its own sample,
+// so the fine grid has a border of one pixel around the image, where the grids
+// of the first row and column start. Its dim grows by the same border,
+// which keeps every sample of the image on its own point.
+
+#define AA_DEFAULT_THRESHOLD 4.0f
+#define AA_MAX_SAMPLES 8
+#define AA_JITTER_STEPS 8
+
+#define AA_BAND_ROWS 4
+// Gaps of up to this many pixels between two runs join them
+#define AA_MAX_GAP 2
+// Longer runs are split, which bounds the sample buffers of a task
+#define AA_MAX_RUN 64
+
+typedef struct {
+    const f32* iters;
+    pixel8* out;
+
+    u32 width;
+    u32 height;
+    u32 samples;
+    f32 threshold_sqr;
+
+    // Full image render on the bordered fine grid, runs only change its origin and size
+    const mandelbrot_args* args;
+    mandelbrot_tile_func* tile_func;
+    const render_colorizer* colorizer;
+
+    // Pixels refined by every band, each adds its count once
+    volatile u64 refined;
+} aa_sched;
+
+// Sums of the counts and their squares down the three rows around y, for every column
+static void aa_column_sums(const aa_sched* sched, u32 y, f64* sums, f64* sqr_sums) {
+    u32 y0 = y > 0 ? y - 1 : y;
+    u32 y1 = MIN(y + 2, sched->height);
+
+    for (u32 x = 0; x < sched->width; x++) {
+        sums[x] = 0.0;
+        sqr_sums[x] = 0.0;
+    }
+
+    for (u32 ny = y0; ny < y1; ny++) {
+        const f32* row = sched->iters + (u64)ny * sched->width;
+
+        for (u32 x = 0; x < sched->width; x++) {
+            f64 n = row[x];
+            sums[x] += n;
+            sqr_sums[x] += n * n;
+        }
+    }
+}
+
+// Variance of the 3x3 neighbourhood of column x, clamped to the image
+static f64 aa_variance(const aa_sched* sched, const f64* sums, const f64* sqr_sums, u32 x, u32 rows) {
+    u32 x0 = x > 0 ? x - 1 : x;
+    u32 x1 = MIN(x + 2, sched->width);
+
+    f64 sum = 0.0;
+    f64 sqr_sum = 0.0;
+    for (u32 nx = x0; nx < x1; nx++) {
+        sum += sums[nx];
+        sqr_sum += sqr_sums[nx];
+    }
+
+    f64 inv_count = 1.0 / (f64)((x1 - x0) * rows);
+    f64 mean = sum * inv_count;
+
+    return sqr_sum * inv_count - mean * mean;
+}
+
+// Deterministic, so the same view always refines to the same image
+static u32 aa_hash(u32 x, u32 y) {
+    u32 h = x * 0x9e3779b1u ^ y * 0x85ebca77u;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 13;
+
+    return h;
+}
+
+static void aa_render_run(const aa_sched* sched, mg_arena* arena, u32 y, u32 start_x, u32 end_x) {
+    u32 samples = sched->samples;
+    u32 run = end_x - start_x;
+    u32 fine = samples * AA_JITTER_STEPS;
+
+    u32 jitter = aa_hash(start_x, y);
+    u32 jitter_x = jitter % AA_JITTER_STEPS;
+    u32 jitter_y = (jitter >> 16) % AA_JITTER_STEPS;
+
+    // Pixel x of the image samples point (x + 1) * fine of the bordered grid
+    mandelbrot_args args = *sched->args;
+    args.img_width = run * samples;
+    args.img_height = samples;
+    args.grid_x = (start_x + 1) * fine - fine / 2 + jitter_x;
+    args.grid_y = (y + 1) * fine - fine / 2 + jitter_y;
+
+    u64 count = (u64)args.img_width * args.img_height;
+    args.out = MGA_PUSH_ARRAY(arena, f32, count);
+    pixel8* colors = MGA_PUSH_ARRAY(arena, pixel8, count);
+
+    sched->tile_func(&args, 0, 0, args.img_width, args.img_height);
+    render_colorizer_span(sched->colorizer, colors, args.out, count);
+
+    u32 num_samples = samples * samples;
+
+    for (u32 x = 0; x < run; x++) {
+        u32 r = 0, g = 0, b = 0;
+
+        for (u32 sy = 0; sy < samples; sy++) {
+            for (u32 sx = 0; sx < samples; sx++) {
+                pixel8 c = colors[x * samples + sx + sy * args.img_width];
+                r += c.r;
+                g += c.g;
+                b += c.b;
+            }
+        }
+
+        sched->out[start_x + x + (u64)y * sched->width] = (pixel8){
+            .r = (u8)((r + num_samples / 2) / num_samples),
+            .g = (u8)((g + num_samples / 2) / num_samples),
+            .b = (u8)((b + num_samples / 2) / num_samples),
+            .a = 255
+        };
+    }
+}
+
+static void aa_band(void* void_sched, u64 start_y, u64 end_y) {
+    aa_sched* sched = (aa_sched*)void_sched;
+    u64 refined = 0;
+
+    TRACE_ZONE_BEGIN(zone, "anti-alias");
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    f64* sums = MGA_PUSH_ARRAY(scratch.arena, f64, sched->width);
+    f64* sqr_sums = MGA_PUSH_ARRAY(scratch.arena, f64, sched->width);
+
+    for (u32 y = (u32)start_y; y < end_y; y++) {
+        aa_column_sums(sched, y, sums, sqr_sums);
+        u32 rows = MIN(y + 2, sched->height) - (y > 0 ? y - 1 : y);
+
+        // [run_start, run_end) ends on the last pixel to refine so far
+        u32 run_start = 0;
+        u32 run_end = 0;
+        b32 in_run = false;
+
+        for (u32 x = 0; x <= sched->width; x++) {
+            b32 refine = x < sched->width && aa_variance(sched, sums, sqr_sums, x, rows) > sched->threshold_sqr;
+
+            // Short gaps are refined along with the pixels around them, which costs
+            // less than the vector lanes short runs leave idle
+            b32 end_run = x == sched->width ||
+                (!refine && x - run_end >= AA_MAX_GAP) ||
+                (refine && x - run_start >= AA_MAX_RUN);
+
+            if (in_run && end_run) {
+                mga_temp run_temp = mga_temp_begin(scratch.arena);
+                aa_render_run(sched, scratch.arena, y, run_start, run_end);
+                mga_temp_end(run_temp);
+
+                refined += run_end - run_start;
+                in_run = false;
+            }
+
+            if (refine) {
+                if (!in_run) {
+                    run_start = x;
+                    in_run = true;
+                }
+                run_end = x + 1;
+            }
+        }
+    }
+
+    atomic_add_u64(&sched->refined, refined);
+
+    mga_scratch_release(scratch);
+
+    TRACE_ZONE_END(zone);
+}
+
+u64 render_colorize_aa(
+    thread_pool* tp, pixel8* out, const f32* iters,
+    const render_desc* desc, const complex_fixedpt* center,
+    const render_palette* palette, const render_aa_desc* aa
+) {
+    u64 num_pixels = (u64)desc->width * desc->height;
+
+    if (aa == NULL || aa->samples < 2) {
+        render_colorize(tp, out, iters, num_pixels, desc->iterations, palette);
+        return 0;
+    }
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    render_colorizer colorizer = { 0 };
+    render_colorizer_init(&colorizer, tp, scratch.arena, iters, num_pixels, desc->iterations, palette);
+    render_colorizer_apply(&colorizer, tp, out, iters, num_pixels);
+
+    // For deep views this computes the reference orbit again
+    mandelbrot_args args = { 0 };
+    mandelbrot_tile_func* tile_func = render_setup_auto(scratch.arena, &args, NULL, desc, center);
+
+    f32 threshold = aa->threshold > 0.0f ? aa->threshold : AA_DEFAULT_THRESHOLD;
+    u32 samples = MIN(aa->samples, AA_MAX_SAMPLES);
+    u32 fine = samples * AA_JITTER_STEPS;
+
+    args.grid_width = (desc->width + 2) * fine;
+    args.grid_height = (desc->height + 2) * fine;
+    args.grid_step = AA_JITTER_STEPS;
+    args.complex_dim.r *= (f64)(desc->width + 2) / (f64)desc->width;
+    args.complex_dim.i *= (f64)(desc->height + 2) / (f64)desc->height;
+
+    aa_sched sched = {
+        .iters = iters,
+        .out = out,
+        .width = desc->width,
+        .height = desc->height,
+        .samples = samples,
+        .threshold_sqr = threshold * threshold,
+        .args = &args,
+        .tile_func = tile_func,
+        .colorizer = &colorizer
+    };
+
+    thread_pool_parallel_for(tp, 0, desc->height, AA_BAND_ROWS, aa_band, &sched);
+
+    mga_scratch_release(scratch);
+
+    return sched.refined;
+}
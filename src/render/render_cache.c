@@ -0,0 +1,575 @@
+#include "render.h"
+#include "render_kernels.h"
+#include "os/os.h"
+
+// Every tile holds CACHE_TILE_SIZE x CACHE_TILE_SIZE points of a lattice,
+// with a flag for each point that has been rendered, so the edges of a frame
+// can be kept without rendering the rest of their tiles.
+// Tiles live in a hash table with chaining, and in a list from the least
+// to the most recently used. Their memory is pushed on the arena of the cache
+// until the budget is reached, after that the least recently used tile is reused.
+
+#define CACHE_TILE_SIZE 64
+#define CACHE_TILE_POINTS (CACHE_TILE_SIZE * CACHE_TILE_SIZE)
+
+// Finer levels a frame is looked up in, zooming out by up to 2^this finds its points
+#define CACHE_MAX_DEPTH 3
+
+// Lattice indices stay well within the integers an f64 holds exactly
+#define CACHE_MAX_INDEX 1e15
+
+// File store
+// The file is a cache_file_header, an index of cache_file_slot, and the tile of every
+// slot, in that order. It is CACHE_FILE_WAYS way set associative: the hash of a key
+// picks a set, and the tile can be in any slot of it. A tile that does not fit
+// takes the least recently used slot of its set, so the file never grows.
+// Any number of processes can map the file at once. Every slot has a sequence number
+// that is odd while a process writes it. Writers make it odd with a compare and swap,
+// so only one of them writes a slot at a time, and readers copy the tile out and
+// only keep it if the number was even and did not change in the meantime.
+// A process that dies in the middle of a write leaves the slot odd, which takes
+// it out of use for good.
+// Bump the version whenever the counts of a kernel change, so old files are not read
+
+#define CACHE_FILE_VERSION 1
+#define CACHE_FILE_WAYS 8
+
+#define CACHE_FILE_FORMULA_MANDELBROT 1
+// Only views for the f64 kernels are cached
+#define CACHE_FILE_PRECISION_F64 1
+
+typedef struct {
+    // "FRACTILE"
+    u8 magic[8];
+    u32 version;
+    u32 tile_size;
+
+    // Stamps every use of a slot, for the least recently used eviction
+    volatile u64 clock;
+
+    u8 reserved[40];
+} cache_file_header;
+
+typedef struct {
+    volatile u32 seq;
+    // Zero in slots that have never been written
+    u32 formula;
+    u32 precision;
+    u32 iterations;
+
+    volatile u64 last_used;
+
+    u64 spacing_r, spacing_i;
+    i64 tile_x, tile_y;
+
+    b32 interior_checks;
+    u32 reserved;
+} cache_file_slot;
+
+STATIC_ASSERT(sizeof(cache_file_header) == 64, cache_file_header_size);
+STATIC_ASSERT(sizeof(cache_file_slot) == 64, cache_file_slot_size);
+
+#define CACHE_FILE_TILE_BYTES (CACHE_TILE_POINTS * (sizeof(f32) + sizeof(u8)))
+
+typedef struct {
+    // Bits of the f64 spacing, which is the quadtree level
+    u64 spacing_r, spacing_i;
+    i64 tile_x, tile_y;
+
+    u32 iterations;
+    b32 interior_checks;
+} cache_key;
+
+typedef struct cache_tile cache_tile;
+struct cache_tile {
+    // Recently used list
+    cache_tile* next;
+    cache_tile* prev;
+
+    cache_tile* hash_next;
+
+    cache_key key;
+
+    f32* iters;
+    u8* valid;
+};
+
+typedef struct {
+    os_shared_map map;
+
+    u64 num_sets;
+    cache_file_header* header;
+    cache_file_slot* slots;
+    u8* tiles;
+
+    // Tiles are copied out of the file here first, because they can be torn
+    f32* staging_iters;
+    u8* staging_valid;
+} cache_file;
+
+typedef struct _render_cache {
+    mg_arena* arena;
+
+    // NULL without a file
+    cache_file* file;
+    render_cache_stats stats;
+
+    u32 max_tiles;
+    u32 num_tiles;
+
+    u32 num_buckets;
+    cache_tile** buckets;
+
+    // first is the least recently used
+    cache_tile* first;
+    cache_tile* last;
+} render_cache;
+
+static u64 cache_f64_bits(f64 x) {
+    u64 bits = 0;
+    memcpy(&bits, &x, sizeof(bits));
+
+    return bits;
+}
+
+static i64 cache_floor_div(i64 a, i64 b) {
+    i64 q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static u64 cache_hash(const cache_key* key) {
+    u64 h = 0xcbf29ce484222325ull;
+    u64 fields[5] = {
+        key->spacing_r, key->spacing_i,
+        (u64)key->tile_x, (u64)key->tile_y,
+        (u64)key->iterations | ((u64)key->interior_checks << 32)
+    };
+
+    for (u32 i = 0; i < 5; i++) {
+        h ^= fields[i];
+        h *= 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+
+    return h;
+}
+
+static b32 cache_key_equal(const cache_key* a, const cache_key* b) {
+    return a->spacing_r == b->spacing_r && a->spacing_i == b->spacing_i &&
+        a->tile_x == b->tile_x && a->tile_y == b->tile_y &&
+        a->iterations == b->iterations && a->interior_checks == b->interior_checks;
+}
+
+static cache_tile* cache_find(render_cache* cache, const cache_key* key) {
+    cache_tile* tile = cache->buckets[cache_hash(key) & (cache->num_buckets - 1)];
+
+    while (tile != NULL && !cache_key_equal(&tile->key, key)) {
+        tile = tile->hash_next;
+    }
+
+    if (tile != NULL) {
+        DLL_REMOVE(cache->first, cache->last, tile);
+        DLL_PUSH_BACK(cache->first, cache->last, tile);
+    }
+
+    return tile;
+}
+
+static void cache_unlink(render_cache* cache, cache_tile* tile) {
+    cache_tile** link = &cache->buckets[cache_hash(&tile->key) & (cache->num_buckets - 1)];
+
+    while (*link != tile) {
+        link = &(*link)->hash_next;
+    }
+    *link = tile->hash_next;
+
+    DLL_REMOVE(cache->first, cache->last, tile);
+}
+
+// Takes a new tile while there is room, and the least recently used one after that
+static cache_tile* cache_insert(render_cache* cache, const cache_key* key) {
+    cache_tile* tile = NULL;
+
+    if (cache->num_tiles < cache->max_tiles) {
+        tile = MGA_PUSH_ZERO_STRUCT(cache->arena, cache_tile);
+        tile->iters = MGA_PUSH_ARRAY(cache->arena, f32, CACHE_TILE_POINTS);
+        tile->valid = MGA_PUSH_ARRAY(cache->arena, u8, CACHE_TILE_POINTS);
+        cache->num_tiles++;
+    } else {
+        tile = cache->first;
+        cache_unlink(cache, tile);
+    }
+
+    memset(tile->valid, 0, CACHE_TILE_POINTS);
+    tile->key = *key;
+
+    cache_tile** bucket = &cache->buckets[cache_hash(key) & (cache->num_buckets - 1)];
+    tile->hash_next = *bucket;
+    *bucket = tile;
+
+    DLL_PUSH_BACK(cache->first, cache->last, tile);
+
+    return tile;
+}
+
+static b32 cache_file_slot_matches(const cache_file_slot* slot, const cache_key* key) {
+    return slot->formula == CACHE_FILE_FORMULA_MANDELBROT && slot->precision == CACHE_FILE_PRECISION_F64 &&
+        slot->iterations == key->iterations && slot->interior_checks == key->interior_checks &&
+        slot->spacing_r == key->spacing_r && slot->spacing_i == key->spacing_i &&
+        slot->tile_x == key->tile_x && slot->tile_y == key->tile_y;
+}
+
+static cache_file_slot* cache_file_set(cache_file* file, const cache_key* key, u8** tiles) {
+    u64 first = (cache_hash(key) % file->num_sets) * CACHE_FILE_WAYS;
+    *tiles = file->tiles + first * CACHE_FILE_TILE_BYTES;
+
+    return file->slots + first;
+}
+
+// Stamps start at 1, so a used slot always counts as more recent than an empty one
+static void cache_file_touch(cache_file* file, cache_file_slot* slot) {
+    atomic_store_u64(&slot->last_used, atomic_add_u64(&file->header->clock, 1) + 1);
+}
+
+// Copies the tile of key into the staging buffers, returns false if the file does not have it
+static b32 cache_file_read(cache_file* file, const cache_key* key) {
+    u8* tiles = NULL;
+    cache_file_slot* set = cache_file_set(file, key, &tiles);
+
+    for (u32 i = 0; i < CACHE_FILE_WAYS; i++) {
+        cache_file_slot* slot = &set[i];
+        u32 seq = atomic_load_u32(&slot->seq);
+
+        if ((seq & 1) != 0 || !cache_file_slot_matches(slot, key)) {
+            continue;
+        }
+
+        const u8* tile = tiles + i * CACHE_FILE_TILE_BYTES;
+        memcpy(file->staging_iters, tile, CACHE_TILE_POINTS * sizeof(f32));
+        memcpy(file->staging_valid, tile + CACHE_TILE_POINTS * sizeof(f32), CACHE_TILE_POINTS);
+
+        // Another process wrote the slot while it was copied
+        if (atomic_load_u32(&slot->seq) != seq) {
+            return false;
+        }
+
+        cache_file_touch(file, slot);
+        return true;
+    }
+
+    return false;
+}
+
+// Skips the tile if another process is writing the slot it would go in
+static b32 cache_file_write(cache_file* file, const cache_tile* tile) {
+    u8* tiles = NULL;
+    cache_file_slot* set = cache_file_set(file, &tile->key, &tiles);
+
+    // The slot with the tile already, or else an empty one, or else the least recently used one
+    u32 way = CACHE_FILE_WAYS;
+    u32 empty = CACHE_FILE_WAYS;
+    u32 oldest = 0;
+    for (u32 i = 0; i < CACHE_FILE_WAYS; i++) {
+        if (cache_file_slot_matches(&set[i], &tile->key)) {
+            way = i;
+            break;
+        }
+        if (set[i].formula == 0 && empty == CACHE_FILE_WAYS) {
+            empty = i;
+        }
+        if (set[i].last_used < set[oldest].last_used) {
+            oldest = i;
+        }
+    }
+    if (way == CACHE_FILE_WAYS) {
+        way = empty != CACHE_FILE_WAYS ? empty : oldest;
+    }
+
+    cache_file_slot* slot = &set[way];
+    u32 seq = atomic_load_u32(&slot->seq);
+    if ((seq & 1) != 0 || !atomic_cas_u32(&slot->seq, &seq, seq + 1)) {
+        return false;
+    }
+
+    slot->formula = CACHE_FILE_FORMULA_MANDELBROT;
+    slot->precision = CACHE_FILE_PRECISION_F64;
+    slot->iterations = tile->key.iterations;
+    slot->interior_checks = tile->key.interior_checks;
+    slot->spacing_r = tile->key.spacing_r;
+    slot->spacing_i = tile->key.spacing_i;
+    slot->tile_x = tile->key.tile_x;
+    slot->tile_y = tile->key.tile_y;
+
+    u8* data = tiles + way * CACHE_FILE_TILE_BYTES;
+    memcpy(data, tile->iters, CACHE_TILE_POINTS * sizeof(f32));
+    memcpy(data + CACHE_TILE_POINTS * sizeof(f32), tile->valid, CACHE_TILE_POINTS);
+
+    cache_file_touch(file, slot);
+    atomic_store_u32(&slot->seq, seq + 2);
+
+    return true;
+}
+
+b32 render_cache_open_file(render_cache* cache, mg_arena* arena, const char* path, u64 max_size) {
+    u64 set_size = CACHE_FILE_WAYS * (sizeof(cache_file_slot) + CACHE_FILE_TILE_BYTES);
+    u64 size = sizeof(cache_file_header) + MAX(1, (max_size - MIN(max_size, sizeof(cache_file_header))) / set_size) * set_size;
+
+    // A new file already has its header when any other process can open it
+    cache_file_header header = {
+        .magic = { 'F', 'R', 'A', 'C', 'T', 'I', 'L', 'E' },
+        .version = CACHE_FILE_VERSION,
+        .tile_size = CACHE_TILE_SIZE
+    };
+
+    cache_file* file = MGA_PUSH_ZERO_STRUCT(arena, cache_file);
+    if (!os_shared_map_open(&file->map, path, size, &header, sizeof(header))) {
+        return false;
+    }
+
+    // An existing file keeps its size, whatever max_size is now,
+    // so every process that maps it hashes tiles into the same sets
+    file->num_sets = (file->map.size - MIN(file->map.size, sizeof(cache_file_header))) / set_size;
+    file->header = (cache_file_header*)file->map.data;
+
+    if (file->num_sets == 0 || memcmp(file->header->magic, header.magic, sizeof(header.magic)) != 0 ||
+        file->header->version != CACHE_FILE_VERSION || file->header->tile_size != CACHE_TILE_SIZE) {
+        os_shared_map_close(&file->map);
+        return false;
+    }
+
+    file->slots = (cache_file_slot*)(file->map.data + sizeof(cache_file_header));
+    file->tiles = file->map.data + sizeof(cache_file_header) + file->num_sets * CACHE_FILE_WAYS * sizeof(cache_file_slot);
+
+    file->staging_iters = MGA_PUSH_ARRAY(arena, f32, CACHE_TILE_POINTS);
+    file->staging_valid = MGA_PUSH_ARRAY(arena, u8, CACHE_TILE_POINTS);
+
+    cache->file = file;
+
+    return true;
+}
+
+render_cache_stats render_cache_get_stats(const render_cache* cache) {
+    return cache->stats;
+}
+
+render_cache* render_cache_create(mg_arena* arena, u64 max_size) {
+    render_cache* cache = MGA_PUSH_ZERO_STRUCT(arena, render_cache);
+
+    u64 tile_size = sizeof(cache_tile) + CACHE_TILE_POINTS * (sizeof(f32) + sizeof(u8));
+    cache->max_tiles = (u32)MAX(1, MIN(max_size / tile_size, 1u << 24));
+
+    cache->num_buckets = 1;
+    while (cache->num_buckets < cache->max_tiles) {
+        cache->num_buckets *= 2;
+    }
+    cache->buckets = MGA_PUSH_ZERO_ARRAY(arena, cache_tile*, cache->num_buckets);
+
+    // Padded for the alignment of every push
+    cache->arena = mga_create(&(mga_desc){
+        .desired_max_size = MGA_MiB(1) + (u64)cache->max_tiles * (tile_size + 64),
+        .desired_block_size = MGA_MiB(1)
+    });
+
+    return cache;
+}
+
+void render_cache_destroy(render_cache* cache) {
+    if (cache->file != NULL) {
+        os_shared_map_close(&cache->file->map);
+    }
+
+    mga_destroy(cache->arena);
+}
+
+b32 render_cache_view_init(render_cache_view* view, render_desc* desc) {
+    if (!(desc->dim.r >= RENDER_DD_MAX_DIM) || desc->width == 0 || desc->height == 0) {
+        return false;
+    }
+
+    f64 spacing_r = desc->dim.r / (f64)desc->width;
+    f64 spacing_i = desc->dim.i / (f64)desc->height;
+
+    // Lattice index of pixel (0, 0), see mandelbrot_offset_r
+    f64 x = floor(desc->center.r / spacing_r - 0.5 * (f64)desc->width + 0.5);
+    f64 y = floor(desc->center.i / spacing_i - 0.5 * (f64)desc->height + 0.5);
+
+    if (!(fabs(x) < CACHE_MAX_INDEX) || !(fabs(y) < CACHE_MAX_INDEX)) {
+        return false;
+    }
+
+    *view = (render_cache_view){
+        .spacing_r = spacing_r,
+        .spacing_i = spacing_i,
+        .x = (i64)x,
+        .y = (i64)y,
+        .width = desc->width,
+        .height = desc->height,
+        .iterations = desc->iterations,
+        .interior_checks = desc->interior_checks
+    };
+
+    desc->center.r = (x + 0.5 * (f64)desc->width) * spacing_r;
+    desc->center.i = (y + 0.5 * (f64)desc->height) * spacing_i;
+
+    return true;
+}
+
+static cache_key cache_view_key(const render_cache_view* view, u32 depth, i64 tile_x, i64 tile_y) {
+    return (cache_key){
+        .spacing_r = cache_f64_bits(ldexp(view->spacing_r, -(i32)depth)),
+        .spacing_i = cache_f64_bits(ldexp(view->spacing_i, -(i32)depth)),
+        .tile_x = tile_x,
+        .tile_y = tile_y,
+        .iterations = view->iterations,
+        .interior_checks = view->interior_checks
+    };
+}
+
+// Pixels [*start, *end) of a frame starting at index first land in the tile at
+// tile_start, with pixel p on index (first + p) * 2^depth
+static void cache_tile_pixels(i64 first, u32 size, u32 depth, i64 tile_start, u32* start, u32* end) {
+    i64 scale = (i64)1 << depth;
+
+    i64 p0 = cache_floor_div(tile_start + scale - 1, scale) - first;
+    i64 p1 = cache_floor_div(tile_start + CACHE_TILE_SIZE + scale - 1, scale) - first;
+
+    *start = (u32)MIN(MAX(p0, 0), (i64)size);
+    *end = (u32)MIN(MAX(p1, 0), (i64)size);
+}
+
+u64 render_cache_read(render_cache* cache, const render_cache_view* view, f32* out, u8* covered) {
+    u64 num_covered = 0;
+    u64 num_pixels = (u64)view->width * view->height;
+    u32 width = view->width;
+
+    // Finer levels hold every point of the coarser ones, at even indices
+    for (u32 depth = 0; depth <= CACHE_MAX_DEPTH && num_covered < num_pixels; depth++) {
+        i64 scale = (i64)1 << depth;
+
+        i64 first_x = view->x * scale;
+        i64 first_y = view->y * scale;
+        i64 last_x = (view->x + width - 1) * scale;
+        i64 last_y = (view->y + view->height - 1) * scale;
+
+        i64 tile_x0 = cache_floor_div(first_x, CACHE_TILE_SIZE);
+        i64 tile_x1 = cache_floor_div(last_x, CACHE_TILE_SIZE);
+        i64 tile_y0 = cache_floor_div(first_y, CACHE_TILE_SIZE);
+        i64 tile_y1 = cache_floor_div(last_y, CACHE_TILE_SIZE);
+
+        for (i64 tile_y = tile_y0; tile_y <= tile_y1; tile_y++) {
+            for (i64 tile_x = tile_x0; tile_x <= tile_x1; tile_x++) {
+                cache_key key = cache_view_key(view, depth, tile_x, tile_y);
+                cache_tile* tile = cache_find(cache, &key);
+
+                if (tile != NULL) {
+                    cache->stats.hits++;
+                } else if (cache->file != NULL && cache_file_read(cache->file, &key)) {
+                    tile = cache_insert(cache, &key);
+                    memcpy(tile->iters, cache->file->staging_iters, CACHE_TILE_POINTS * sizeof(f32));
+                    memcpy(tile->valid, cache->file->staging_valid, CACHE_TILE_POINTS);
+
+                    cache->stats.file_hits++;
+                } else {
+                    // Only the tiles of the view itself count, the deeper levels are a bonus
+                    cache->stats.misses += depth == 0;
+                    continue;
+                }
+
+                u32 x0, x1, y0, y1;
+                cache_tile_pixels(view->x, width, depth, tile_x * CACHE_TILE_SIZE, &x0, &x1);
+                cache_tile_pixels(view->y, view->height, depth, tile_y * CACHE_TILE_SIZE, &y0, &y1);
+
+                for (u32 y = y0; y < y1; y++) {
+                    u32 ty = (u32)((view->y + y) * scale - tile_y * CACHE_TILE_SIZE);
+
+                    for (u32 x = x0; x < x1; x++) {
+                        u32 tx = (u32)((view->x + x) * scale - tile_x * CACHE_TILE_SIZE);
+                        u64 i = x + (u64)y * width;
+
+                        if (!covered[i] && tile->valid[tx + ty * CACHE_TILE_SIZE]) {
+                            out[i] = tile->iters[tx + ty * CACHE_TILE_SIZE];
+                            covered[i] = true;
+                            num_covered++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return num_covered;
+}
+
+void render_cache_write(render_cache* cache, const render_cache_view* view, const f32* iters) {
+    u32 width = view->width;
+
+    i64 tile_x0 = cache_floor_div(view->x, CACHE_TILE_SIZE);
+    i64 tile_x1 = cache_floor_div(view->x + width - 1, CACHE_TILE_SIZE);
+    i64 tile_y0 = cache_floor_div(view->y, CACHE_TILE_SIZE);
+    i64 tile_y1 = cache_floor_div(view->y + view->height - 1, CACHE_TILE_SIZE);
+
+    for (i64 tile_y = tile_y0; tile_y <= tile_y1; tile_y++) {
+        for (i64 tile_x = tile_x0; tile_x <= tile_x1; tile_x++) {
+            cache_key key = cache_view_key(view, 0, tile_x, tile_y);
+            cache_tile* tile = cache_find(cache, &key);
+
+            // The points of the file that are outside the view are kept
+            if (tile == NULL) {
+                b32 in_file = cache->file != NULL && cache_file_read(cache->file, &key);
+                tile = cache_insert(cache, &key);
+
+                if (in_file) {
+                    memcpy(tile->iters, cache->file->staging_iters, CACHE_TILE_POINTS * sizeof(f32));
+                    memcpy(tile->valid, cache->file->staging_valid, CACHE_TILE_POINTS);
+                }
+            }
+
+            u32 x0, x1, y0, y1;
+            cache_tile_pixels(view->x, width, 0, tile_x * CACHE_TILE_SIZE, &x0, &x1);
+            cache_tile_pixels(view->y, view->height, 0, tile_y * CACHE_TILE_SIZE, &y0, &y1);
+
+            for (u32 y = y0; y < y1; y++) {
+                u32 ty = (u32)(view->y + y - tile_y * CACHE_TILE_SIZE);
+                u32 tx = (u32)(view->x + x0 - tile_x * CACHE_TILE_SIZE);
+
+                memcpy(&tile->iters[tx + ty * CACHE_TILE_SIZE], &iters[x0 + (u64)y * width], sizeof(f32) * (x1 - x0));
+                memset(&tile->valid[tx + ty * CACHE_TILE_SIZE], 1, x1 - x0);
+            }
+
+            if (cache->file != NULL && cache_file_write(cache->file, tile)) {
+                cache->stats.file_writes++;
+            }
+        }
+    }
+}
+
+void render_mandelbrot_cached(
+    render_cache* cache, thread_pool* tp, f32* out,
+    const render_desc* desc, const complex_fixedpt* center
+) {
+    render_desc view = *desc;
+    render_cache_view cache_view = { 0 };
+
+    if (cache == NULL || !render_cache_view_init(&cache_view, &view)) {
+        render_mandelbrot_auto(tp, out, desc, center);
+        return;
+    }
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    u64 num_pixels = (u64)view.width * view.height;
+    u8* covered = MGA_PUSH_ZERO_ARRAY(scratch.arena, u8, num_pixels);
+
+    if (render_cache_read(cache, &cache_view, out, covered) < num_pixels) {
+        mandelbrot_args args = { 0 };
+        mandelbrot_tile_func* tile_func = render_setup_f64(&args, out, &view);
+        args.masked_func = tile_func;
+        args.covered = covered;
+        args.covered_width = view.width;
+
+        render_tiles(tp, &args, mandelbrot_tile_masked);
+        render_cache_write(cache, &cache_view, out);
+    }
+
+    mga_scratch_release(scratch);
+}
@@ -0,0 +1,337 @@
+#include "render.h"
+#include "render_kernels.h"
+
+#include <string.h>
+
+// The vector path has to pick the same entries as the scalar one
+#if defined(__clang__)
+#    pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#    pragma GCC optimize("fp-contract=off")
+#endif
+
+#ifdef RENDER_X64
+#    ifdef _MSC_VER
+#        include <intrin.h>
+#    endif
+#    include <immintrin.h>
+#endif
+
+#define PALETTE_MASK (RENDER_PALETTE_SIZE - 1)
+
+// Pixels per task of render_colorize
+#define COLORIZE_CHUNK_SIZE (1 << 16)
+
+// Histograms have a bin per iteration up to this many iterations,
+// past that every bin covers a few of them
+#define HISTOGRAM_MAX_BINS (1 << 16)
+
+// Three sines a third of a cycle apart, one cycle every 20 pi iterations
+#define PALETTE_DEFAULT_PERIOD 62.831853f
+
+static u8 palette_channel(f64 t, f64 exposure) {
+    f64 c = (sin(t) * 0.5 + 0.5) * 255.0 * exposure;
+
+    return (u8)MIN(c, 255.0);
+}
+
+void render_palette_build(render_palette* palette, const render_palette_desc* desc) {
+    f32 period = desc->period > 0.0f ? desc->period : PALETTE_DEFAULT_PERIOD;
+    f32 cycles = desc->cycles > 0.0f ? desc->cycles : 1.0f;
+    f64 exposure = desc->exposure > 0.0f ? desc->exposure : 1.0;
+
+    for (u32 i = 0; i < RENDER_PALETTE_SIZE; i++) {
+        f64 t = 2.0 * 3.14159265358979323846 * (f64)i / RENDER_PALETTE_SIZE;
+
+        palette->colors[i] = (pixel8){
+            .r = palette_channel(t, exposure),
+            .g = palette_channel(t + 4.188, exposure),
+            .b = palette_channel(t + 2.904, exposure),
+            .a = 255
+        };
+    }
+
+    // Keeps the bias positive, so truncating rounds down
+    f32 offset = desc->offset - floorf(desc->offset);
+
+    palette->mode = desc->mode < RENDER_COLOR_COUNT ? desc->mode : RENDER_COLOR_CYCLE;
+    palette->scale = palette->mode == RENDER_COLOR_HISTOGRAM ?
+        cycles * (f32)RENDER_PALETTE_SIZE : (f32)RENDER_PALETTE_SIZE / period;
+    palette->bias = offset * (f32)RENDER_PALETTE_SIZE;
+    palette->interior = (pixel8){ 0, 0, 0, 255 };
+    palette->kernel = render_kernel_resolve(desc->kernel);
+}
+
+static u32 histogram_num_bins(u32 iterations) {
+    return MAX(1, MIN(iterations, HISTOGRAM_MAX_BINS));
+}
+
+static void histogram_count(u32* bins, const f32* iters, u64 count, u32 iterations) {
+    u32 num_bins = histogram_num_bins(iterations);
+    f32 interior_n = (f32)iterations - 1.0f;
+    f32 bin_scale = (f32)num_bins / (f32)iterations;
+
+    for (u64 i = 0; i < count; i++) {
+        f32 n = iters[i];
+
+        if (n < interior_n) {
+            bins[MIN((u32)(n * bin_scale), num_bins - 1)]++;
+        }
+    }
+}
+
+// Fills in the cdf of params from the summed histogram
+static void histogram_cdf(render_colorizer* params, f32* cdf, const u32* bins, u32 iterations) {
+    u32 num_bins = histogram_num_bins(iterations);
+
+    u64 total = 0;
+    for (u32 b = 0; b < num_bins; b++) {
+        total += bins[b];
+    }
+
+    f64 inv_total = total > 0 ? 1.0 / (f64)total : 0.0;
+
+    u64 below = 0;
+    for (u32 b = 0; b < num_bins; b++) {
+        cdf[b] = (f32)((f64)below * inv_total);
+        below += bins[b];
+    }
+    cdf[num_bins] = 1.0f;
+
+    params->cdf = cdf;
+    params->num_bins = num_bins;
+    params->bin_scale = (f32)num_bins / (f32)iterations;
+}
+
+static void colorize_span_scalar(pixel8* out, const f32* iters, u64 count, const render_colorizer* params) {
+    const render_palette* palette = params->palette;
+
+    for (u64 i = 0; i < count; i++) {
+        f32 n = iters[i];
+
+        if (n >= params->interior_n) {
+            out[i] = palette->interior;
+            continue;
+        }
+
+        if (params->cdf != NULL) {
+            // Interpolates within the bin, so smooth counts stay smooth
+            f32 x = n * params->bin_scale;
+            u32 b = MIN((u32)x, params->num_bins - 1);
+            f32 frac = x - (f32)b;
+
+            n = params->cdf[b] + (params->cdf[b + 1] - params->cdf[b]) * frac;
+        }
+
+        out[i] = palette->colors[(u32)(i32)(n * palette->scale + palette->bias) & PALETTE_MASK];
+    }
+}
+
+#ifdef RENDER_X64
+
+// 8 lookups per gather, interior pixels are blended in after
+RENDER_TARGET("avx2")
+static void colorize_span_avx2(pixel8* out, const f32* iters, u64 count, const render_colorizer* params) {
+    const render_palette* palette = params->palette;
+
+    const __m256 scale = _mm256_set1_ps(palette->scale);
+    const __m256 bias = _mm256_set1_ps(palette->bias);
+    const __m256 interior_n = _mm256_set1_ps(params->interior_n);
+    const __m256i mask = _mm256_set1_epi32(PALETTE_MASK);
+
+    const __m256 bin_scale = _mm256_set1_ps(params->bin_scale);
+    const __m256i last_bin = _mm256_set1_epi32((i32)params->num_bins - 1);
+    const __m256i one = _mm256_set1_epi32(1);
+
+    u32 interior_u32 = 0;
+    memcpy(&interior_u32, &palette->interior, sizeof(u32));
+    const __m256i interior = _mm256_set1_epi32((i32)interior_u32);
+
+    u64 i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 n = _mm256_loadu_ps(iters + i);
+        __m256 inside = _mm256_cmp_ps(n, interior_n, _CMP_GE_OQ);
+
+        __m256 t = n;
+        if (params->cdf != NULL) {
+            __m256 x = _mm256_mul_ps(n, bin_scale);
+            __m256i b = _mm256_min_epi32(_mm256_cvttps_epi32(x), last_bin);
+            __m256 frac = _mm256_sub_ps(x, _mm256_cvtepi32_ps(b));
+
+            // Interior lanes can be past the last bin, so they read bin 0 instead
+            b = _mm256_andnot_si256(_mm256_castps_si256(inside), b);
+
+            __m256 lo = _mm256_i32gather_ps(params->cdf, b, sizeof(f32));
+            __m256 hi = _mm256_i32gather_ps(params->cdf, _mm256_add_epi32(b, one), sizeof(f32));
+            t = _mm256_add_ps(lo, _mm256_mul_ps(_mm256_sub_ps(hi, lo), frac));
+        }
+
+        __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(t, scale), bias));
+        index = _mm256_and_si256(index, mask);
+
+        __m256i colors = _mm256_i32gather_epi32((const int*)palette->colors, index, sizeof(pixel8));
+        colors = _mm256_blendv_epi8(colors, interior, _mm256_castps_si256(inside));
+
+        _mm256_storeu_si256((__m256i*)(out + i), colors);
+    }
+
+    colorize_span_scalar(out + i, iters + i, count - i, params);
+}
+
+#endif // RENDER_X64
+
+void render_colorizer_span(const render_colorizer* params, pixel8* out, const f32* iters, u64 count) {
+#ifdef RENDER_X64
+    if (params->palette->kernel != RENDER_KERNEL_SCALAR) {
+        colorize_span_avx2(out, iters, count, params);
+        return;
+    }
+#endif
+
+    colorize_span_scalar(out, iters, count, params);
+}
+
+typedef struct {
+    pixel8* out;
+    const f32* iters;
+    const render_colorizer* params;
+} colorize_job;
+
+static void colorize_chunk(void* void_job, u64 begin, u64 end) {
+    colorize_job* job = (colorize_job*)void_job;
+
+    TRACE_ZONE_BEGIN(zone, "colorize chunk");
+    render_colorizer_span(job->params, job->out + begin, job->iters + begin, end - begin);
+    TRACE_ZONE_END(zone);
+}
+
+typedef struct {
+    const f32* iters;
+    u64 count;
+    u32 iterations;
+
+    u64 pixels_per_part;
+    u32 num_bins;
+
+    // One partial histogram per part, summed into totals
+    u32 num_parts;
+    u32** part_bins;
+    u32* totals;
+} histogram_job;
+
+static void histogram_count_parts(void* void_job, u64 begin, u64 end) {
+    histogram_job* job = (histogram_job*)void_job;
+
+    TRACE_ZONE_BEGIN(zone, "histogram");
+    for (u64 p = begin; p < end; p++) {
+        u64 start = MIN(job->count, p * job->pixels_per_part);
+
+        histogram_count(
+            job->part_bins[p], job->iters + start,
+            MIN(job->pixels_per_part, job->count - start), job->iterations
+        );
+    }
+    TRACE_ZONE_END(zone);
+}
+
+static void histogram_merge_bins(void* void_job, u64 begin, u64 end) {
+    histogram_job* job = (histogram_job*)void_job;
+
+    for (u64 b = begin; b < end; b++) {
+        u32 sum = 0;
+        for (u32 p = 0; p < job->num_parts; p++) {
+            sum += job->part_bins[p][b];
+        }
+
+        job->totals[b] = sum;
+    }
+}
+
+// Every thread counts its own range of pixels, then every thread sums its own range of bins.
+// Nothing is shared between the chunks of a step, so neither needs atomics.
+// Small images are counted on the calling thread
+static void histogram_build(thread_pool* tp, render_colorizer* params, mg_arena* arena, const f32* iters, u64 count, u32 iterations) {
+    u32 num_bins = histogram_num_bins(iterations);
+    u32 num_parts = tp != NULL ? thread_pool_num_threads(tp) : 1;
+
+    if (count < COLORIZE_CHUNK_SIZE || num_parts < 2) {
+        u32* bins = MGA_PUSH_ZERO_ARRAY(arena, u32, num_bins);
+        f32* cdf = MGA_PUSH_ARRAY(arena, f32, num_bins + 1);
+
+        histogram_count(bins, iters, count, iterations);
+        histogram_cdf(params, cdf, bins, iterations);
+        return;
+    }
+
+    histogram_job job = {
+        .iters = iters,
+        .count = count,
+        .iterations = iterations,
+        .pixels_per_part = (count + num_parts - 1) / num_parts,
+        .num_bins = num_bins,
+        .num_parts = num_parts,
+        .part_bins = MGA_PUSH_ARRAY(arena, u32*, num_parts),
+        .totals = MGA_PUSH_ARRAY(arena, u32, num_bins)
+    };
+    f32* cdf = MGA_PUSH_ARRAY(arena, f32, num_bins + 1);
+
+    for (u32 i = 0; i < num_parts; i++) {
+        job.part_bins[i] = MGA_PUSH_ZERO_ARRAY(arena, u32, num_bins);
+    }
+
+    thread_pool_parallel_for(tp, 0, num_parts, 1, histogram_count_parts, &job);
+    thread_pool_parallel_for(
+        tp, 0, num_bins, (num_bins + num_parts - 1) / num_parts, histogram_merge_bins, &job
+    );
+
+    histogram_cdf(params, cdf, job.totals, iterations);
+}
+
+void render_colorizer_init(
+    render_colorizer* params, thread_pool* tp, mg_arena* arena,
+    const f32* iters, u64 count, u32 iterations, const render_palette* palette
+) {
+    *params = (render_colorizer){
+        .palette = palette,
+        .interior_n = (f32)iterations - 1.0f
+    };
+
+    if (palette->mode == RENDER_COLOR_HISTOGRAM) {
+        histogram_build(tp, params, arena, iters, count, iterations);
+    }
+}
+
+void render_colorize_span(pixel8* out, const f32* iters, u64 count, u32 iterations, const render_palette* palette) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    render_colorizer params = { 0 };
+    render_colorizer_init(&params, NULL, scratch.arena, iters, count, iterations, palette);
+    render_colorizer_span(&params, out, iters, count);
+
+    mga_scratch_release(scratch);
+}
+
+void render_colorizer_apply(const render_colorizer* params, thread_pool* tp, pixel8* out, const f32* iters, u64 count) {
+    if (tp == NULL || thread_pool_num_threads(tp) < 2) {
+        render_colorizer_span(params, out, iters, count);
+        return;
+    }
+
+    colorize_job job = {
+        .out = out,
+        .iters = iters,
+        .params = params
+    };
+
+    thread_pool_parallel_for(tp, 0, count, COLORIZE_CHUNK_SIZE, colorize_chunk, &job);
+}
+
+void render_colorize(thread_pool* tp, pixel8* out, const f32* iters, u64 count, u32 iterations, const render_palette* palette) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    render_colorizer params = { 0 };
+    render_colorizer_init(&params, tp, scratch.arena, iters, count, iterations, palette);
+    render_colorizer_apply(&params, tp, out, iters, count);
+
+    mga_scratch_release(scratch);
+}
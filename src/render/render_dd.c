@@ -0,0 +1,429 @@
+#include "render.h"
+#include "render_kernels.h"
+
+#include "fpng/fpng.h"
+
+// Double-double kernels, for zooms where f64 runs out of mantissa
+// but a perturbation reference orbit is not needed yet.
+// The vector kernels keep the hi and lo halves of each lane in separate
+// registers, and use the same operation order as math_f64x2.h,
+// so they produce the same image as the scalar kernel.
+// Only the error term of the hi * hi product uses an fma,
+// where it is exact and matches Dekker's product in the scalar version.
+
+#if defined(__clang__)
+#    pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#    pragma GCC optimize("fp-contract=off")
+#endif
+
+static void mandelbrot_row_dd_scalar(const mandelbrot_args* args, u32 y, u32 start_x, u32 end_x) {
+    f64x2 c_i = f64x2_add(
+        args->complex_center_dd.i,
+        f64x2_from_f64(mandelbrot_offset_i(args, y))
+    );
+
+    for (u32 x = start_x; x < end_x; x++) {
+        complexdd z = { 0 };
+        complexdd c = {
+            f64x2_add(
+                args->complex_center_dd.r,
+                f64x2_from_f64(mandelbrot_offset_r(args, x))
+            ),
+            c_i
+        };
+
+        f32 n = (f32)args->iterations - 1.0;
+
+        for (u32 i = 0; i < args->iterations; i++) {
+            z = complexdd_add(complexdd_mul(z, z), c);
+
+            f64 mag = z.r.hi * z.r.hi + z.i.hi * z.i.hi;
+            if (mag > MANDELBROT_BAILOUT) {
+                n = mandelbrot_smooth(i, mag);
+                break;
+            }
+        }
+
+        args->out[x + y * args->img_width] = n;
+    }
+}
+
+void mandelbrot_tile_dd_scalar(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    for (u32 y = start_y; y < end_y; y++) {
+        mandelbrot_row_dd_scalar(args, y, start_x, end_x);
+    }
+}
+
+#ifdef RENDER_X64
+
+#ifdef _MSC_VER
+#    include <intrin.h>
+#endif
+#include <immintrin.h>
+
+typedef struct { __m256d hi, lo; } dd_m256d;
+typedef struct { __m512d hi, lo; } dd_m512d;
+
+RENDER_TARGET("avx2,fma")
+static inline dd_m256d dd256_quick_two_sum(__m256d a, __m256d b) {
+    __m256d s = _mm256_add_pd(a, b);
+    return (dd_m256d){ s, _mm256_sub_pd(b, _mm256_sub_pd(s, a)) };
+}
+RENDER_TARGET("avx2,fma")
+static inline dd_m256d dd256_two_sum(__m256d a, __m256d b) {
+    __m256d s = _mm256_add_pd(a, b);
+    __m256d bb = _mm256_sub_pd(s, a);
+    __m256d err = _mm256_add_pd(_mm256_sub_pd(a, _mm256_sub_pd(s, bb)), _mm256_sub_pd(b, bb));
+    return (dd_m256d){ s, err };
+}
+RENDER_TARGET("avx2,fma")
+static inline dd_m256d dd256_add(dd_m256d a, dd_m256d b) {
+    dd_m256d s = dd256_two_sum(a.hi, b.hi);
+    dd_m256d t = dd256_two_sum(a.lo, b.lo);
+    s.lo = _mm256_add_pd(s.lo, t.hi);
+    s = dd256_quick_two_sum(s.hi, s.lo);
+    s.lo = _mm256_add_pd(s.lo, t.lo);
+    return dd256_quick_two_sum(s.hi, s.lo);
+}
+RENDER_TARGET("avx2,fma")
+static inline dd_m256d dd256_mul(dd_m256d a, dd_m256d b) {
+    __m256d p = _mm256_mul_pd(a.hi, b.hi);
+    __m256d err = _mm256_fmsub_pd(a.hi, b.hi, p);
+    err = _mm256_add_pd(err, _mm256_add_pd(_mm256_mul_pd(a.hi, b.lo), _mm256_mul_pd(a.lo, b.hi)));
+    return dd256_quick_two_sum(p, err);
+}
+
+RENDER_TARGET("avx2,fma")
+static inline __m256d mandelbrot_lanes_dd_avx2(const mandelbrot_args* args, dd_m256d c_r, dd_m256d c_i, __m256d* mag_out) {
+    const __m256d bailout = _mm256_set1_pd(MANDELBROT_BAILOUT);
+
+    dd_m256d z_r = { _mm256_setzero_pd(), _mm256_setzero_pd() };
+    dd_m256d z_i = { _mm256_setzero_pd(), _mm256_setzero_pd() };
+    __m256d n = _mm256_set1_pd((f64)args->iterations - 1.0);
+    __m256d escape_mag = _mm256_setzero_pd();
+    __m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+
+    for (u32 i = 0; i < args->iterations; i++) {
+        dd_m256d zr2 = dd256_mul(z_r, z_r);
+        dd_m256d zi2 = dd256_mul(z_i, z_i);
+        dd_m256d zri = dd256_mul(z_r, z_i);
+
+        // Negating both halves and doubling both halves are exact
+        dd_m256d neg_zi2 = { _mm256_xor_pd(zi2.hi, _mm256_set1_pd(-0.0)), _mm256_xor_pd(zi2.lo, _mm256_set1_pd(-0.0)) };
+        z_r = dd256_add(dd256_add(zr2, neg_zi2), c_r);
+        z_i = dd256_add((dd_m256d){ _mm256_add_pd(zri.hi, zri.hi), _mm256_add_pd(zri.lo, zri.lo) }, c_i);
+
+        __m256d mag = _mm256_add_pd(_mm256_mul_pd(z_r.hi, z_r.hi), _mm256_mul_pd(z_i.hi, z_i.hi));
+        __m256d escaped = _mm256_and_pd(_mm256_cmp_pd(mag, bailout, _CMP_GT_OQ), active);
+
+        n = _mm256_blendv_pd(n, _mm256_set1_pd((f64)i), escaped);
+        escape_mag = _mm256_blendv_pd(escape_mag, mag, escaped);
+        active = _mm256_andnot_pd(escaped, active);
+
+        if (_mm256_movemask_pd(active) == 0) {
+            break;
+        }
+    }
+
+    *mag_out = escape_mag;
+    return n;
+}
+
+RENDER_TARGET("avx2,fma")
+static void mandelbrot_row_dd_avx2(const mandelbrot_args* args, u32 y, u32 start_x, u32 end_x) {
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d lane_offsets = _mm256_mul_pd(_mm256_set_pd(3.0, 2.0, 1.0, 0.0), _mm256_set1_pd((f64)args->grid_step));
+    const __m256d width = _mm256_set1_pd((f64)args->grid_width);
+    const __m256d dim_r = _mm256_set1_pd(args->complex_dim.r);
+    const dd_m256d center_r = {
+        _mm256_set1_pd(args->complex_center_dd.r.hi),
+        _mm256_set1_pd(args->complex_center_dd.r.lo)
+    };
+
+    f64x2 c_i_scalar = f64x2_add(
+        args->complex_center_dd.i,
+        f64x2_from_f64(mandelbrot_offset_i(args, y))
+    );
+    const dd_m256d c_i = { _mm256_set1_pd(c_i_scalar.hi), _mm256_set1_pd(c_i_scalar.lo) };
+
+    for (u32 x = start_x; x < end_x; x += 4) {
+        __m256d xs = _mm256_add_pd(_mm256_set1_pd((f64)(x * args->grid_step + args->grid_x)), lane_offsets);
+        dd_m256d offset_r = {
+            _mm256_mul_pd(_mm256_sub_pd(_mm256_div_pd(xs, width), half), dim_r),
+            _mm256_setzero_pd()
+        };
+        dd_m256d c_r = dd256_add(center_r, offset_r);
+
+        __m256d mag;
+        __m256d n = mandelbrot_lanes_dd_avx2(args, c_r, c_i, &mag);
+
+        f64 lane_n[4];
+        f64 lane_mag[4];
+        f32 lane_out[4];
+        _mm256_storeu_pd(lane_n, n);
+        _mm256_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx2(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(4, end_x - x); j++) {
+            args->out[x + j + y * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+RENDER_TARGET("avx2,fma")
+static void mandelbrot_column_dd_avx2(const mandelbrot_args* args, u32 x, u32 start_y, u32 end_y) {
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d lane_offsets = _mm256_mul_pd(_mm256_set_pd(3.0, 2.0, 1.0, 0.0), _mm256_set1_pd((f64)args->grid_step));
+    const __m256d height = _mm256_set1_pd((f64)args->grid_height);
+    const __m256d dim_i = _mm256_set1_pd(args->complex_dim.i);
+    const dd_m256d center_i = {
+        _mm256_set1_pd(args->complex_center_dd.i.hi),
+        _mm256_set1_pd(args->complex_center_dd.i.lo)
+    };
+
+    f64x2 c_r_scalar = f64x2_add(
+        args->complex_center_dd.r,
+        f64x2_from_f64(mandelbrot_offset_r(args, x))
+    );
+    const dd_m256d c_r = { _mm256_set1_pd(c_r_scalar.hi), _mm256_set1_pd(c_r_scalar.lo) };
+
+    for (u32 y = start_y; y < end_y; y += 4) {
+        __m256d ys = _mm256_add_pd(_mm256_set1_pd((f64)(y * args->grid_step + args->grid_y)), lane_offsets);
+        dd_m256d offset_i = {
+            _mm256_mul_pd(_mm256_sub_pd(_mm256_div_pd(ys, height), half), dim_i),
+            _mm256_setzero_pd()
+        };
+        dd_m256d c_i = dd256_add(center_i, offset_i);
+
+        __m256d mag;
+        __m256d n = mandelbrot_lanes_dd_avx2(args, c_r, c_i, &mag);
+
+        f64 lane_n[4];
+        f64 lane_mag[4];
+        f32 lane_out[4];
+        _mm256_storeu_pd(lane_n, n);
+        _mm256_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx2(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(4, end_y - y); j++) {
+            args->out[x + (y + j) * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+RENDER_TARGET("avx512f")
+static inline dd_m512d dd512_quick_two_sum(__m512d a, __m512d b) {
+    __m512d s = _mm512_add_pd(a, b);
+    return (dd_m512d){ s, _mm512_sub_pd(b, _mm512_sub_pd(s, a)) };
+}
+RENDER_TARGET("avx512f")
+static inline dd_m512d dd512_two_sum(__m512d a, __m512d b) {
+    __m512d s = _mm512_add_pd(a, b);
+    __m512d bb = _mm512_sub_pd(s, a);
+    __m512d err = _mm512_add_pd(_mm512_sub_pd(a, _mm512_sub_pd(s, bb)), _mm512_sub_pd(b, bb));
+    return (dd_m512d){ s, err };
+}
+RENDER_TARGET("avx512f")
+static inline dd_m512d dd512_add(dd_m512d a, dd_m512d b) {
+    dd_m512d s = dd512_two_sum(a.hi, b.hi);
+    dd_m512d t = dd512_two_sum(a.lo, b.lo);
+    s.lo = _mm512_add_pd(s.lo, t.hi);
+    s = dd512_quick_two_sum(s.hi, s.lo);
+    s.lo = _mm512_add_pd(s.lo, t.lo);
+    return dd512_quick_two_sum(s.hi, s.lo);
+}
+RENDER_TARGET("avx512f")
+static inline dd_m512d dd512_mul(dd_m512d a, dd_m512d b) {
+    __m512d p = _mm512_mul_pd(a.hi, b.hi);
+    __m512d err = _mm512_fmsub_pd(a.hi, b.hi, p);
+    err = _mm512_add_pd(err, _mm512_add_pd(_mm512_mul_pd(a.hi, b.lo), _mm512_mul_pd(a.lo, b.hi)));
+    return dd512_quick_two_sum(p, err);
+}
+
+RENDER_TARGET("avx512f")
+static inline __m512d mandelbrot_lanes_dd_avx512(const mandelbrot_args* args, dd_m512d c_r, dd_m512d c_i, __m512d* mag_out) {
+    const __m512d bailout = _mm512_set1_pd(MANDELBROT_BAILOUT);
+    const __m512i sign_bit = _mm512_set1_epi64((i64)0x8000000000000000ull);
+
+    dd_m512d z_r = { _mm512_setzero_pd(), _mm512_setzero_pd() };
+    dd_m512d z_i = { _mm512_setzero_pd(), _mm512_setzero_pd() };
+    __m512d n = _mm512_set1_pd((f64)args->iterations - 1.0);
+    __m512d escape_mag = _mm512_setzero_pd();
+    __mmask8 active = 0xff;
+
+    for (u32 i = 0; i < args->iterations; i++) {
+        dd_m512d zr2 = dd512_mul(z_r, z_r);
+        dd_m512d zi2 = dd512_mul(z_i, z_i);
+        dd_m512d zri = dd512_mul(z_r, z_i);
+
+        dd_m512d neg_zi2 = {
+            _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(zi2.hi), sign_bit)),
+            _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(zi2.lo), sign_bit))
+        };
+        z_r = dd512_add(dd512_add(zr2, neg_zi2), c_r);
+        z_i = dd512_add((dd_m512d){ _mm512_add_pd(zri.hi, zri.hi), _mm512_add_pd(zri.lo, zri.lo) }, c_i);
+
+        __m512d mag = _mm512_add_pd(_mm512_mul_pd(z_r.hi, z_r.hi), _mm512_mul_pd(z_i.hi, z_i.hi));
+        __mmask8 escaped = _mm512_mask_cmp_pd_mask(active, mag, bailout, _CMP_GT_OQ);
+
+        n = _mm512_mask_blend_pd(escaped, n, _mm512_set1_pd((f64)i));
+        escape_mag = _mm512_mask_blend_pd(escaped, escape_mag, mag);
+        active &= ~escaped;
+
+        if (active == 0) {
+            break;
+        }
+    }
+
+    *mag_out = escape_mag;
+    return n;
+}
+
+RENDER_TARGET("avx512f")
+static void mandelbrot_row_dd_avx512(const mandelbrot_args* args, u32 y, u32 start_x, u32 end_x) {
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d lane_offsets = _mm512_mul_pd(_mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0), _mm512_set1_pd((f64)args->grid_step));
+    const __m512d width = _mm512_set1_pd((f64)args->grid_width);
+    const __m512d dim_r = _mm512_set1_pd(args->complex_dim.r);
+    const dd_m512d center_r = {
+        _mm512_set1_pd(args->complex_center_dd.r.hi),
+        _mm512_set1_pd(args->complex_center_dd.r.lo)
+    };
+
+    f64x2 c_i_scalar = f64x2_add(
+        args->complex_center_dd.i,
+        f64x2_from_f64(mandelbrot_offset_i(args, y))
+    );
+    const dd_m512d c_i = { _mm512_set1_pd(c_i_scalar.hi), _mm512_set1_pd(c_i_scalar.lo) };
+
+    for (u32 x = start_x; x < end_x; x += 8) {
+        __m512d xs = _mm512_add_pd(_mm512_set1_pd((f64)(x * args->grid_step + args->grid_x)), lane_offsets);
+        dd_m512d offset_r = {
+            _mm512_mul_pd(_mm512_sub_pd(_mm512_div_pd(xs, width), half), dim_r),
+            _mm512_setzero_pd()
+        };
+        dd_m512d c_r = dd512_add(center_r, offset_r);
+
+        __m512d mag;
+        __m512d n = mandelbrot_lanes_dd_avx512(args, c_r, c_i, &mag);
+
+        f64 lane_n[8];
+        f64 lane_mag[8];
+        f32 lane_out[8];
+        _mm512_storeu_pd(lane_n, n);
+        _mm512_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx512(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(8, end_x - x); j++) {
+            args->out[x + j + y * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+RENDER_TARGET("avx512f")
+static void mandelbrot_column_dd_avx512(const mandelbrot_args* args, u32 x, u32 start_y, u32 end_y) {
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d lane_offsets = _mm512_mul_pd(_mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0), _mm512_set1_pd((f64)args->grid_step));
+    const __m512d height = _mm512_set1_pd((f64)args->grid_height);
+    const __m512d dim_i = _mm512_set1_pd(args->complex_dim.i);
+    const dd_m512d center_i = {
+        _mm512_set1_pd(args->complex_center_dd.i.hi),
+        _mm512_set1_pd(args->complex_center_dd.i.lo)
+    };
+
+    f64x2 c_r_scalar = f64x2_add(
+        args->complex_center_dd.r,
+        f64x2_from_f64(mandelbrot_offset_r(args, x))
+    );
+    const dd_m512d c_r = { _mm512_set1_pd(c_r_scalar.hi), _mm512_set1_pd(c_r_scalar.lo) };
+
+    for (u32 y = start_y; y < end_y; y += 8) {
+        __m512d ys = _mm512_add_pd(_mm512_set1_pd((f64)(y * args->grid_step + args->grid_y)), lane_offsets);
+        dd_m512d offset_i = {
+            _mm512_mul_pd(_mm512_sub_pd(_mm512_div_pd(ys, height), half), dim_i),
+            _mm512_setzero_pd()
+        };
+        dd_m512d c_i = dd512_add(center_i, offset_i);
+
+        __m512d mag;
+        __m512d n = mandelbrot_lanes_dd_avx512(args, c_r, c_i, &mag);
+
+        f64 lane_n[8];
+        f64 lane_mag[8];
+        f32 lane_out[8];
+        _mm512_storeu_pd(lane_n, n);
+        _mm512_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx512(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(8, end_y - y); j++) {
+            args->out[x + (y + j) * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+void mandelbrot_tile_dd_avx2(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    if (end_x - start_x < 4) {
+        for (u32 x = start_x; x < end_x; x++) {
+            mandelbrot_column_dd_avx2(args, x, start_y, end_y);
+        }
+        return;
+    }
+
+    for (u32 y = start_y; y < end_y; y++) {
+        mandelbrot_row_dd_avx2(args, y, start_x, end_x);
+    }
+}
+
+void mandelbrot_tile_dd_avx512(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    if (end_x - start_x < 8) {
+        for (u32 x = start_x; x < end_x; x++) {
+            mandelbrot_column_dd_avx512(args, x, start_y, end_y);
+        }
+        return;
+    }
+
+    for (u32 y = start_y; y < end_y; y++) {
+        mandelbrot_row_dd_avx512(args, y, start_x, end_x);
+    }
+}
+
+#else // RENDER_X64
+
+void mandelbrot_tile_dd_avx2(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    mandelbrot_tile_dd_scalar(args, start_x, start_y, end_x, end_y);
+}
+
+void mandelbrot_tile_dd_avx512(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    mandelbrot_tile_dd_scalar(args, start_x, start_y, end_x, end_y);
+}
+
+#endif // RENDER_X64
+
+mandelbrot_tile_func* render_setup_dd(mandelbrot_args* args, f32* out, const render_desc* desc, const complexdd* center) {
+    mandelbrot_tile_func* tile_funcs[RENDER_KERNEL_COUNT] = {
+        [RENDER_KERNEL_SCALAR] = mandelbrot_tile_dd_scalar,
+        [RENDER_KERNEL_AVX2] = mandelbrot_tile_dd_avx2,
+        [RENDER_KERNEL_AVX512] = mandelbrot_tile_dd_avx512,
+    };
+
+    *args = (mandelbrot_args){
+        .out = out,
+        .img_width = desc->width,
+        .img_height = desc->height,
+        .complex_dim = desc->dim,
+        .complex_center = desc->center,
+        .iterations = desc->iterations,
+        .grid_width = desc->width,
+        .grid_height = desc->height,
+        .grid_step = 1,
+        .complex_center_dd = center != NULL ? *center : (complexdd){
+            f64x2_from_f64(desc->center.r), f64x2_from_f64(desc->center.i)
+        }
+    };
+
+    return tile_funcs[render_kernel_resolve(desc->kernel)];
+}
+
+void render_mandelbrot_dd(thread_pool* tp, f32* out, const render_desc* desc, const complexdd* center) {
+    mandelbrot_args args = { 0 };
+    mandelbrot_tile_func* tile_func = render_setup_dd(&args, out, desc, center);
+
+    render_image(tp, &args, tile_func, desc->method);
+}
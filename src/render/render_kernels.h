@@ -0,0 +1,223 @@
+#ifndef RENDER_KERNELS_H
+#define RENDER_KERNELS_H
+
+#include <math.h>
+#include <string.h>
+
+#include "render.h"
+#include "trace/trace.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#    define RENDER_X64
+#endif
+
+// Vector kernels are compiled with function level target attributes
+#if defined(_MSC_VER) && !defined(__clang__)
+#    define RENDER_TARGET(t)
+#else
+#    define RENDER_TARGET(t) __attribute__((target(t)))
+#endif
+
+typedef struct mandelbrot_args mandelbrot_args;
+
+// Renders the pixels in [start_x, end_x) x [start_y, end_y)
+typedef void (mandelbrot_tile_func)(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+
+struct mandelbrot_args {
+    // Iteration count of every pixel, see render_mandelbrot
+    f32* out;
+    u32 img_width;
+    u32 img_height;
+    complexd complex_dim;
+    complexd complex_center;
+    u32 iterations;
+
+    // Pixel (x, y) of out samples the same point as pixel
+    // (x * grid_step + grid_x, y * grid_step + grid_y) of a
+    // grid_width x grid_height image. This lets a render fill in a subset
+    // of the pixels of a bigger image with exactly the same coordinates.
+    // A plain render has a step of 1 and the grid size is the image size
+    u32 grid_width;
+    u32 grid_height;
+    u32 grid_step;
+    u32 grid_x, grid_y;
+
+    // Only used by the f64 kernels.
+    // An orbit that comes back within periodicity_eps of a saved
+    // point on both axes is treated as periodic
+    b32 interior_checks;
+    f64 periodicity_eps;
+
+    // Only used by the perturbation kernel.
+    // ref_orbit[0] is 0, and the last entry is either the
+    // iteration limit or the first point that escaped
+    const complexd* ref_orbit;
+    u32 ref_len;
+
+    // Series approximation for the first series_skip iterations.
+    // dz = a u + b u^2 + c u^3, where u is dc / series_radius
+    u32 series_skip;
+    f64 series_radius;
+    complexd series_a, series_b, series_c;
+
+    // Only used by the double-double kernels, replaces complex_center
+    complexdd complex_center_dd;
+
+    // Only used by mandelbrot_tile_masked, for images that are partly filled in already.
+    // Pixel (x, y) is skipped when the flag of the grid pixel it samples,
+    // (x * grid_step + grid_x, y * grid_step + grid_y), is set.
+    // The other pixels are rendered with masked_func
+    const u8* covered;
+    u32 covered_width;
+    mandelbrot_tile_func* masked_func;
+};
+
+// Distance from the center to the point pixel x or row y samples
+static inline f64 mandelbrot_offset_r(const mandelbrot_args* args, u32 x) {
+    return (((f64)(x * args->grid_step + args->grid_x) / (f64)args->grid_width) - 0.5) * args->complex_dim.r;
+}
+static inline f64 mandelbrot_offset_i(const mandelbrot_args* args, u32 y) {
+    return (((f64)(y * args->grid_step + args->grid_y) / (f64)args->grid_height) - 0.5) * args->complex_dim.i;
+}
+
+// Squared radius an orbit has to pass to escape.
+// Past a radius of 2 every orbit escapes anyway, a much larger one makes
+// the smooth count below independent of where the orbit crossed it
+#define MANDELBROT_LOG2_BAILOUT 16.0
+#define MANDELBROT_BAILOUT 65536.0
+
+// Smooth iteration count of a point that escaped on iteration n with a squared
+// radius of mag. One more iteration roughly squares mag, so the count falls from
+// n to n - 1 as mag goes from the bailout to its square, which makes it continuous
+// across the bands of the integer count. Points that never escaped have a mag of
+// at most the bailout and keep n. Counts never go below 0
+// log2 of a positive normal x to within about 1e-7, which is well under what
+// an f32 count can hold. Unlike the libm one it vectorizes, see mandelbrot_smooth_avx2
+static inline f64 mandelbrot_log2(f64 x) {
+    u64 bits = 0;
+    memcpy(&bits, &x, sizeof(bits));
+
+    f64 e = (f64)((i64)(bits >> 52) - 1023);
+    bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+
+    f64 m = 0.0;
+    memcpy(&m, &bits, sizeof(m));
+
+    // Keeps m within [1/sqrt(2), sqrt(2)], where the series converges quickly
+    if (m > 1.4142135623730951) {
+        m *= 0.5;
+        e += 1.0;
+    }
+
+    // ln(m) = 2 atanh(t)
+    f64 t = (m - 1.0) / (m + 1.0);
+    f64 t2 = t * t;
+    f64 ln_m = 2.0 * t * (1.0 + t2 * (1.0 / 3.0 + t2 * (1.0 / 5.0 + t2 * (1.0 / 7.0))));
+
+    return e + ln_m * 1.4426950408889634;
+}
+
+static inline f32 mandelbrot_smooth(f64 n, f64 mag) {
+    if (!(mag > MANDELBROT_BAILOUT)) {
+        return (f32)n;
+    }
+
+    f64 smooth = n - mandelbrot_log2(mandelbrot_log2(mag) * (1.0 / MANDELBROT_LOG2_BAILOUT));
+    return (f32)(smooth > 0.0 ? smooth : 0.0);
+}
+
+#ifdef RENDER_X64
+// mandelbrot_smooth of 4 or 8 lanes at once, with exactly the same results
+void mandelbrot_smooth_avx2(f32* out, const f64* n, const f64* mag);
+void mandelbrot_smooth_avx512(f32* out, const f64* n, const f64* mag);
+#endif
+
+
+// True for points inside the main cardioid or the period 2 bulb
+static inline b32 mandelbrot_in_main_bulbs(f64 c_r, f64 c_i) {
+    f64 x = c_r - 0.25;
+    f64 y2 = c_i * c_i;
+    f64 q = x * x + y2;
+
+    if (q * (q + x) <= 0.25 * y2) {
+        return true;
+    }
+
+    return (c_r + 1.0) * (c_r + 1.0) + y2 <= 0.0625;
+}
+
+// Renders pixels [start_x, end_x) of row y one at a time
+void mandelbrot_row_scalar(const mandelbrot_args* args, u32 y, u32 start_x, u32 end_x);
+
+void mandelbrot_tile_scalar(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+void mandelbrot_tile_avx2(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+void mandelbrot_tile_avx512(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+
+void mandelbrot_tile_dd_scalar(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+void mandelbrot_tile_dd_avx2(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+void mandelbrot_tile_dd_avx512(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+
+void mandelbrot_tile_perturb(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+
+// Fill in args for a full image render of desc, and return the tile function to use.
+// The perturbation setup computes the reference orbit, which is allocated on arena
+mandelbrot_tile_func* render_setup_f64(mandelbrot_args* args, f32* out, const render_desc* desc);
+mandelbrot_tile_func* render_setup_dd(mandelbrot_args* args, f32* out, const render_desc* desc, const complexdd* center);
+mandelbrot_tile_func* render_setup_perturb(
+    mg_arena* arena, mandelbrot_args* args, f32* out,
+    const render_desc* desc, const complex_fixedpt* center
+);
+
+// Picks the path the same way as render_mandelbrot_auto
+mandelbrot_tile_func* render_setup_auto(
+    mg_arena* arena, mandelbrot_args* args, f32* out,
+    const render_desc* desc, const complex_fixedpt* center
+);
+
+// Colors counts the same way as render_colorize, for passes that color more
+// samples of an image than its pixels. Holds the histogram of a histogram palette
+typedef struct {
+    const render_palette* palette;
+    f32 interior_n;
+
+    // Only for histogram palettes.
+    // cdf[b] is the fraction of escaped pixels below bin b, and has num_bins + 1 entries
+    const f32* cdf;
+    u32 num_bins;
+    f32 bin_scale;
+} render_colorizer;
+
+// The histogram is counted from iters, on the thread pool if tp is not NULL,
+// and allocated on arena
+void render_colorizer_init(
+    render_colorizer* params, thread_pool* tp, mg_arena* arena,
+    const f32* iters, u64 count, u32 iterations, const render_palette* palette
+);
+void render_colorizer_span(const render_colorizer* params, pixel8* out, const f32* iters, u64 count);
+// Splits the span into chunks on the thread pool
+void render_colorizer_apply(const render_colorizer* params, thread_pool* tp, pixel8* out, const f32* iters, u64 count);
+
+typedef struct _tile_sched tile_sched;
+
+// Queues the tiles of an image on the thread pool without waiting for them.
+// Workers stop taking tiles once *cancel is nonzero, cancel can be NULL
+tile_sched* render_tiles_begin(
+    mg_arena* arena, thread_pool* tp, const mandelbrot_args* args,
+    mandelbrot_tile_func* tile_func, volatile u32* cancel
+);
+// True once every worker of sched has returned
+b32 render_tiles_finished(tile_sched* sched);
+
+// Renders the runs of pixels that are not covered with args->masked_func
+void mandelbrot_tile_masked(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y);
+
+// Splits the image into tiles and renders them on the thread pool
+void render_tiles(thread_pool* tp, const mandelbrot_args* args, mandelbrot_tile_func* tile_func);
+
+// Renders with Mariani-Silver subdivision, see render_subdivide.c
+void render_subdivide(thread_pool* tp, const mandelbrot_args* args, mandelbrot_tile_func* tile_func);
+
+// Picks render_tiles or render_subdivide based on method
+void render_image(thread_pool* tp, const mandelbrot_args* args, mandelbrot_tile_func* tile_func, render_method method);
+
+#endif // RENDER_KERNELS_H
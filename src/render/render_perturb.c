@@ -0,0 +1,223 @@
+#include "render.h"
+#include "render_kernels.h"
+
+#include <math.h>
+
+// Each pixel is iterated as an f64 delta dz from a reference orbit Z
+// computed at the image center with enough precision for the zoom:
+//     dz' = (2Z + dz) * dz + dc
+// When |Z + dz| < |dz| the reference is no longer a good approximation
+// (this is where the classic perturbation glitches come from),
+// so the pixel is rebased onto the start of the orbit with dz = Z + dz.
+// The same rebasing handles pixels that outlive an escaped reference.
+// https://fractalforums.org/fractal-mathematics-and-new-theories/28/another-solution-to-perturbation-glitches/4360
+//
+// Deep zooms spend most of their time in early iterations where every pixel
+// still follows the reference closely, so those are skipped together using
+// a truncated series in dc:
+//     dz_n = A_n dc + B_n dc^2 + C_n dc^3
+//     A' = 2ZA + 1, B' = 2ZB + A^2, C' = 2ZC + 2AB
+// The coefficients are stored premultiplied by powers of the frame radius r,
+// (a = A r, b = B r^2, c = C r^3) so they stay in f64 range at any depth.
+
+// Maximum error of the series, in pixels at the point it stops
+#define SERIES_TOLERANCE 0.01
+
+void mandelbrot_tile_perturb(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    const complexd* orbit = args->ref_orbit;
+    u32 ref_len = args->ref_len;
+
+    for (u32 y = start_y; y < end_y; y++) {
+        f64 dc_i = mandelbrot_offset_i(args, y);
+
+        for (u32 x = start_x; x < end_x; x++) {
+            f64 dc_r = mandelbrot_offset_r(args, x);
+
+            f64 dz_r = 0.0;
+            f64 dz_i = 0.0;
+            u32 k = 0;
+
+            if (args->series_skip != 0) {
+                complexd u = { dc_r / args->series_radius, dc_i / args->series_radius };
+                complexd dz = complexd_mul(args->series_c, u);
+                dz = complexd_mul(complexd_add(dz, args->series_b), u);
+                dz = complexd_mul(complexd_add(dz, args->series_a), u);
+
+                dz_r = dz.r;
+                dz_i = dz.i;
+                k = args->series_skip;
+            }
+
+            f32 n = (f32)args->iterations - 1.0;
+
+            for (u32 i = args->series_skip; i < args->iterations; i++) {
+                f64 a_r = 2.0 * orbit[k].r + dz_r;
+                f64 a_i = 2.0 * orbit[k].i + dz_i;
+
+                f64 new_dz_r = a_r * dz_r - a_i * dz_i + dc_r;
+                f64 new_dz_i = a_r * dz_i + a_i * dz_r + dc_i;
+                dz_r = new_dz_r;
+                dz_i = new_dz_i;
+                k++;
+
+                f64 z_r = orbit[k].r + dz_r;
+                f64 z_i = orbit[k].i + dz_i;
+                f64 mag = z_r * z_r + z_i * z_i;
+
+                if (mag > MANDELBROT_BAILOUT) {
+                    n = mandelbrot_smooth(i, mag);
+                    break;
+                }
+
+                if (mag < dz_r * dz_r + dz_i * dz_i || k == ref_len) {
+                    dz_r = z_r;
+                    dz_i = z_i;
+                    k = 0;
+                }
+            }
+
+            args->out[x + y * args->img_width] = n;
+        }
+    }
+}
+
+// Returns the index of the last entry written to orbit
+static u32 perturb_reference_orbit(complexd* orbit, const complex_fixedpt* c, u32 iterations) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    u32 num_limbs = c->r.num_limbs;
+    complex_fixedpt z = complex_fixedpt_create(scratch.arena, num_limbs);
+    fixedpt zr2 = fixedpt_create(scratch.arena, num_limbs);
+    fixedpt zi2 = fixedpt_create(scratch.arena, num_limbs);
+    fixedpt zri2 = fixedpt_create(scratch.arena, num_limbs);
+
+    orbit[0] = (complexd){ 0 };
+
+    u32 len = iterations;
+    for (u32 i = 0; i < iterations; i++) {
+        // 2 zr zi = (zr + zi)^2 - zr^2 - zi^2, so the whole step is three squares
+        fixedpt_add(&zri2, &z.r, &z.i);
+        fixedpt_sqr(&zri2, &zri2);
+        fixedpt_sqr(&zr2, &z.r);
+        fixedpt_sqr(&zi2, &z.i);
+
+        fixedpt_sub(&zri2, &zri2, &zr2);
+        fixedpt_sub(&zri2, &zri2, &zi2);
+
+        fixedpt_sub(&z.r, &zr2, &zi2);
+        fixedpt_add(&z.r, &z.r, &c->r);
+
+        fixedpt_add(&z.i, &zri2, &c->i);
+
+        orbit[i + 1] = (complexd){ fixedpt_to_f64(&z.r), fixedpt_to_f64(&z.i) };
+
+        if (orbit[i + 1].r * orbit[i + 1].r + orbit[i + 1].i * orbit[i + 1].i > MANDELBROT_BAILOUT) {
+            len = i + 1;
+            break;
+        }
+    }
+
+    mga_scratch_release(scratch);
+
+    return len;
+}
+
+// Finds how many iterations every pixel within radius of the center can skip,
+// and fills in the series coefficients in args
+static void perturb_series_approx(mandelbrot_args* args, f64 radius, f64 pixel_size) {
+    complexd a = { 0 }, b = { 0 }, c = { 0 };
+
+    args->series_skip = 0;
+    args->series_radius = radius;
+
+    // The skip has to stop before the reference escapes,
+    // so the per pixel loop always has a valid orbit entry to continue from
+    for (u32 n = 0; n + 1 < args->ref_len; n++) {
+        complexd z2 = complexd_scale(args->ref_orbit[n], 2.0);
+
+        complexd next_a = complexd_add(complexd_mul(z2, a), (complexd){ radius, 0.0 });
+        complexd next_b = complexd_add(complexd_mul(z2, b), complexd_mul(a, a));
+        complexd next_c = complexd_add(complexd_mul(z2, c), complexd_scale(complexd_mul(a, b), 2.0));
+
+        f64 len_a = hypot(next_a.r, next_a.i);
+        f64 len_b = hypot(next_b.r, next_b.i);
+        f64 len_c = hypot(next_c.r, next_c.i);
+
+        // The cubic term stands in for the truncation error. An error of e in dz
+        // moves the result by about e / |A| in c, which has to stay under a pixel
+        b32 accurate = len_c < SERIES_TOLERANCE * pixel_size * len_a / radius;
+
+        // No pixel may escape during the skipped iterations
+        complexd z = args->ref_orbit[n + 1];
+        b32 bounded = hypot(z.r, z.i) + len_a + len_b + len_c < 2.0;
+
+        if (!accurate || !bounded) {
+            break;
+        }
+
+        a = next_a;
+        b = next_b;
+        c = next_c;
+        args->series_skip = n + 1;
+    }
+
+    args->series_a = a;
+    args->series_b = b;
+    args->series_c = c;
+}
+
+mandelbrot_tile_func* render_setup_perturb(
+    mg_arena* arena, mandelbrot_args* args, f32* out,
+    const render_desc* desc, const complex_fixedpt* center
+) {
+    mga_temp scratch = mga_scratch_get(&arena, 1);
+
+    // Enough bits to resolve a pixel, plus a margin for the orbit to lose
+    f64 pixel_size = MIN(desc->dim.r / (f64)desc->width, desc->dim.i / (f64)desc->height);
+    u32 frac_bits = 64 + (u32)MAX(0.0, -log2(pixel_size));
+    u32 num_limbs = fixedpt_limbs_for_bits(frac_bits);
+
+    complex_fixedpt ref_center = complex_fixedpt_create(scratch.arena, num_limbs);
+    if (center != NULL) {
+        fixedpt_copy(&ref_center.r, &center->r);
+        fixedpt_copy(&ref_center.i, &center->i);
+    } else {
+        fixedpt_from_f64(&ref_center.r, desc->center.r);
+        fixedpt_from_f64(&ref_center.i, desc->center.i);
+    }
+
+    complexd* orbit = MGA_PUSH_ARRAY(arena, complexd, desc->iterations + 1);
+    u32 ref_len = perturb_reference_orbit(orbit, &ref_center, desc->iterations);
+
+    *args = (mandelbrot_args){
+        .out = out,
+        .img_width = desc->width,
+        .img_height = desc->height,
+        .complex_dim = desc->dim,
+        .complex_center = desc->center,
+        .iterations = desc->iterations,
+        .grid_width = desc->width,
+        .grid_height = desc->height,
+        .grid_step = 1,
+        .ref_orbit = orbit,
+        .ref_len = ref_len
+    };
+
+    f64 radius = 0.5 * hypot(desc->dim.r, desc->dim.i);
+    perturb_series_approx(args, radius, pixel_size);
+
+    mga_scratch_release(scratch);
+
+    return mandelbrot_tile_perturb;
+}
+
+void render_mandelbrot_perturb(thread_pool* tp, f32* out, const render_desc* desc, const complex_fixedpt* center) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    mandelbrot_args args = { 0 };
+    mandelbrot_tile_func* tile_func = render_setup_perturb(scratch.arena, &args, out, desc, center);
+
+    render_image(tp, &args, tile_func, desc->method);
+
+    mga_scratch_release(scratch);
+}
@@ -0,0 +1,261 @@
+#include "render.h"
+#include "render_kernels.h"
+
+// The first pass samples every 8th pixel in both directions.
+// Every later pass halves the step, and only renders the three grids of
+// new pixels (offset by the new step right, down, and both), so no pixel is
+// computed twice. The grids go through render_tiles_begin, so the passes
+// run on the thread pool while the caller polls render_progressive_update.
+
+#define PROGRESSIVE_FIRST_STEP 8
+
+typedef struct {
+    mandelbrot_args args;
+    tile_sched* sched;
+} progressive_grid;
+
+typedef struct _render_progressive {
+    thread_pool* tp;
+    u32 width;
+    u32 height;
+
+    // Everything for the current view, reset by every start
+    mg_arena* view_arena;
+
+    // Full resolution iteration counts, only the pixels of finished passes are valid
+    f32* samples;
+    // The valid samples packed together, the lattice of the last pass
+    // followed by the covered pixels off it, and their colors
+    f32* packed;
+    pixel8* colors;
+
+    mandelbrot_args view_args;
+    mandelbrot_tile_func* tile_func;
+
+    // Can be NULL. Pixels that came from the cache are covered,
+    // and only the uncovered ones are rendered
+    render_cache* cache;
+    render_cache_view cache_view;
+    b32 cached;
+    u8* covered;
+
+    b32 running;
+    // Step of the pass in flight
+    u32 step;
+
+    u32 num_grids;
+    progressive_grid grids[3];
+
+    volatile u32 cancel;
+} render_progressive;
+
+static void progressive_begin_grid(render_progressive* rp, u32 grid_step, u32 grid_x, u32 grid_y) {
+    u32 width = (rp->width - grid_x + grid_step - 1) / grid_step;
+    u32 height = (rp->height - grid_y + grid_step - 1) / grid_step;
+
+    if (width == 0 || height == 0) {
+        return;
+    }
+
+    progressive_grid* grid = &rp->grids[rp->num_grids++];
+    mandelbrot_args* args = &grid->args;
+
+    *args = rp->view_args;
+    args->out = MGA_PUSH_ARRAY(rp->view_arena, f32, (u64)width * height);
+    args->img_width = width;
+    args->img_height = height;
+    args->grid_step = grid_step;
+    args->grid_x = grid_x;
+    args->grid_y = grid_y;
+
+    args->covered = rp->covered;
+    args->covered_width = rp->width;
+    args->masked_func = rp->tile_func;
+
+    grid->sched = render_tiles_begin(
+        rp->view_arena, rp->tp, args, rp->cached ? mandelbrot_tile_masked : rp->tile_func, &rp->cancel
+    );
+}
+
+static void progressive_begin_pass(render_progressive* rp, u32 step) {
+    rp->step = step;
+    rp->num_grids = 0;
+
+    if (step == PROGRESSIVE_FIRST_STEP) {
+        progressive_begin_grid(rp, step, 0, 0);
+    } else {
+        progressive_begin_grid(rp, step * 2, step, 0);
+        progressive_begin_grid(rp, step * 2, 0, step);
+        progressive_begin_grid(rp, step * 2, step, step);
+    }
+}
+
+render_progressive* render_progressive_create(mg_arena* arena, thread_pool* tp, u32 width, u32 height, render_cache* cache) {
+    render_progressive* rp = MGA_PUSH_ZERO_STRUCT(arena, render_progressive);
+
+    rp->tp = tp;
+    rp->width = width;
+    rp->height = height;
+    rp->samples = MGA_PUSH_ZERO_ARRAY(arena, f32, (u64)width * height);
+    rp->packed = MGA_PUSH_ZERO_ARRAY(arena, f32, (u64)width * height);
+    rp->colors = MGA_PUSH_ZERO_ARRAY(arena, pixel8, (u64)width * height);
+
+    rp->cache = cache;
+    if (cache != NULL) {
+        rp->covered = MGA_PUSH_ZERO_ARRAY(arena, u8, (u64)width * height);
+    }
+
+    rp->view_arena = mga_create(&(mga_desc){
+        .desired_max_size = MGA_MiB(64),
+        .desired_block_size = MGA_KiB(256)
+    });
+
+    return rp;
+}
+
+void render_progressive_destroy(render_progressive* rp) {
+    render_progressive_cancel(rp);
+
+    mga_destroy(rp->view_arena);
+}
+
+void render_progressive_start(render_progressive* rp, const render_desc* desc, const complex_fixedpt* center) {
+    render_progressive_cancel(rp);
+    mga_reset(rp->view_arena);
+
+    render_desc view = *desc;
+    view.width = rp->width;
+    view.height = rp->height;
+
+    rp->cached = rp->cache != NULL && render_cache_view_init(&rp->cache_view, &view);
+    rp->tile_func = render_setup_auto(rp->view_arena, &rp->view_args, NULL, &view, center);
+
+    rp->running = true;
+
+    if (rp->cached) {
+        u64 num_pixels = (u64)rp->width * rp->height;
+        memset(rp->covered, 0, num_pixels);
+
+        // The next update shows the image without starting any pass
+        if (render_cache_read(rp->cache, &rp->cache_view, rp->samples, rp->covered) == num_pixels) {
+            rp->step = 1;
+            rp->num_grids = 0;
+            return;
+        }
+    }
+
+    progressive_begin_pass(rp, PROGRESSIVE_FIRST_STEP);
+}
+
+void render_progressive_cancel(render_progressive* rp) {
+    if (!rp->running) {
+        return;
+    }
+
+    // Workers check the flag between tiles, so this only waits for the tiles in flight
+    atomic_store_u32(&rp->cancel, 1);
+    thread_pool_wait(rp->tp);
+    atomic_store_u32(&rp->cancel, 0);
+
+    rp->running = false;
+}
+
+b32 render_progressive_update(render_progressive* rp, pixel8* out, const render_palette* palette) {
+    if (!rp->running) {
+        return false;
+    }
+
+    for (u32 i = 0; i < rp->num_grids; i++) {
+        if (!render_tiles_finished(rp->grids[i].sched)) {
+            return false;
+        }
+    }
+
+    TRACE_ZONE_BEGIN(zone, "progressive pass");
+
+    u32 width = rp->width;
+    u32 height = rp->height;
+    u32 step = rp->step;
+
+    for (u32 i = 0; i < rp->num_grids; i++) {
+        const mandelbrot_args* args = &rp->grids[i].args;
+
+        for (u32 y = 0; y < args->img_height; y++) {
+            u32 sample_y = y * args->grid_step + args->grid_y;
+
+            for (u32 x = 0; x < args->img_width; x++) {
+                u32 sample_x = x * args->grid_step + args->grid_x;
+
+                if (!rp->cached || !rp->covered[sample_x + sample_y * width]) {
+                    rp->samples[sample_x + sample_y * width] = args->out[x + y * args->img_width];
+                }
+            }
+        }
+    }
+
+    // Only the valid samples are colored, so neither the pixels the later passes fill in
+    // nor a histogram palette see the counts that are left over from the previous view
+    u32 lattice_width = (width + step - 1) / step;
+    u64 num_packed = 0;
+
+    for (u32 y = 0; y < height; y += step) {
+        for (u32 x = 0; x < width; x += step) {
+            rp->packed[num_packed++] = rp->samples[x + y * width];
+        }
+    }
+
+    u64 num_lattice = num_packed;
+    for (u32 y = 0; y < height && rp->cached; y++) {
+        for (u32 x = 0; x < width; x++) {
+            u32 i = x + y * width;
+
+            if (rp->covered[i] && (x % step != 0 || y % step != 0)) {
+                rp->packed[num_packed++] = rp->samples[i];
+            }
+        }
+    }
+
+    // Every pass is done, so the pool is free until the next one starts
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    render_colorizer params = { 0 };
+    render_colorizer_init(&params, rp->tp, scratch.arena, rp->packed, num_packed, rp->view_args.iterations, palette);
+    render_colorizer_apply(&params, rp->tp, rp->colors, rp->packed, num_packed);
+
+    mga_scratch_release(scratch);
+
+    // Pixels that have not been sampled yet copy the sample above and to the left of them.
+    // Covered pixels off the lattice come in the same order they were packed in
+    u64 next_covered = num_lattice;
+    for (u32 y = 0; y < height; y++) {
+        const pixel8* lattice_row = rp->colors + (u64)(y / step) * lattice_width;
+
+        for (u32 x = 0; x < width; x++) {
+            u32 i = x + y * width;
+
+            if (rp->cached && rp->covered[i] && (x % step != 0 || y % step != 0)) {
+                out[i] = rp->colors[next_covered++];
+            } else {
+                out[i] = lattice_row[x / step];
+            }
+        }
+    }
+
+    if (step > 1) {
+        progressive_begin_pass(rp, step / 2);
+    } else {
+        if (rp->cached) {
+            render_cache_write(rp->cache, &rp->cache_view, rp->samples);
+        }
+
+        rp->running = false;
+    }
+
+    TRACE_ZONE_END(zone);
+
+    return true;
+}
+
+b32 render_progressive_done(render_progressive* rp) {
+    return !rp->running;
+}
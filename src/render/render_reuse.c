@@ -0,0 +1,174 @@
+#include "render.h"
+#include "render_kernels.h"
+
+// Every chunk is a band of rows. Each pixel is mapped to where its point
+// lands in the previous frame. Points that land on a sample of it take its count as is,
+// the others are bilinearly interpolated from the two or four samples around them,
+// but only if those all escaped on the same iteration.
+// This also fills between interior samples, because they are less than a pixel apart,
+// so a filament that passes between them would be missed by a plain render as well.
+// Everything else, including the ring the previous frame does not cover,
+// is rendered in runs of neighbouring pixels straight into the image.
+
+#define REUSE_BAND_ROWS 4
+// Gaps of up to this many pixels between two runs join them
+#define REUSE_MAX_GAP 2
+// Points within this fraction of a pixel of a sample take its count
+#define REUSE_SNAP 1e-6
+
+typedef struct {
+    f32* out;
+    const f32* prev;
+
+    u32 width;
+    u32 height;
+
+    // Position in prev of the point of pixel x is x * scale_r + offset_r, same for rows
+    f64 scale_r, offset_r;
+    f64 scale_i, offset_i;
+
+    const mandelbrot_args* args;
+    mandelbrot_tile_func* tile_func;
+
+    // Pixels rendered by every band, each adds its count once
+    volatile u64 rendered;
+} reuse_sched;
+
+typedef struct {
+    u32 index;
+    f32 t;
+    // Whether the sample after index has any weight
+    b32 lerp;
+} reuse_coord;
+
+static b32 reuse_map(f64 pos, u32 size, reuse_coord* coord) {
+    f64 index = floor(pos + REUSE_SNAP);
+    f64 t = pos - index;
+
+    if (index < 0.0 || index > (f64)(size - 1)) {
+        return false;
+    }
+
+    coord->index = (u32)index;
+    coord->lerp = t > REUSE_SNAP;
+    coord->t = coord->lerp ? (f32)t : 0.0f;
+
+    return !coord->lerp || coord->index + 1 < size;
+}
+
+// Tries to fill pixel (x, y) from the previous frame
+static b32 reuse_pixel(const reuse_sched* sched, const reuse_coord* cx, const reuse_coord* cy, u32 x, u32 y) {
+    const f32* row0 = sched->prev + (u64)cy->index * sched->width;
+    const f32* row1 = cy->lerp ? row0 + sched->width : row0;
+    u32 x0 = cx->index;
+    u32 x1 = cx->lerp ? x0 + 1 : x0;
+
+    f32 n00 = row0[x0], n10 = row0[x1];
+    f32 n01 = row1[x0], n11 = row1[x1];
+
+    f32 first = floorf(n00);
+    if (floorf(n10) != first || floorf(n01) != first || floorf(n11) != first) {
+        return false;
+    }
+
+    f32 top = n00 + (n10 - n00) * cx->t;
+    f32 bottom = n01 + (n11 - n01) * cx->t;
+    sched->out[x + (u64)y * sched->width] = top + (bottom - top) * cy->t;
+
+    return true;
+}
+
+static void reuse_band(void* void_sched, u64 start_y, u64 end_y) {
+    reuse_sched* sched = (reuse_sched*)void_sched;
+    u64 rendered = 0;
+
+    TRACE_ZONE_BEGIN(zone, "reuse");
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    // Only depends on the column, so it is worked out once for the band
+    reuse_coord* cols = MGA_PUSH_ARRAY(scratch.arena, reuse_coord, sched->width);
+    b32* cols_valid = MGA_PUSH_ARRAY(scratch.arena, b32, sched->width);
+    for (u32 x = 0; x < sched->width; x++) {
+        cols_valid[x] = reuse_map((f64)x * sched->scale_r + sched->offset_r, sched->width, &cols[x]);
+    }
+
+    for (u32 y = (u32)start_y; y < end_y; y++) {
+        reuse_coord row = { 0 };
+        b32 row_valid = reuse_map((f64)y * sched->scale_i + sched->offset_i, sched->height, &row);
+
+        // [run_start, run_end) ends on the last pixel to render so far
+        u32 run_start = 0;
+        u32 run_end = 0;
+        b32 in_run = false;
+
+        for (u32 x = 0; x <= sched->width; x++) {
+            b32 render = false;
+            if (x < sched->width) {
+                render = !(row_valid && cols_valid[x] && reuse_pixel(sched, &cols[x], &row, x, y));
+            }
+
+            // Pixels in short gaps are rendered again along with the pixels around
+            // them, which costs less than the vector lanes short runs leave idle
+            b32 end_run = x == sched->width || (!render && x - run_end >= REUSE_MAX_GAP);
+
+            if (in_run && end_run) {
+                sched->tile_func(sched->args, run_start, y, run_end, y + 1);
+                rendered += run_end - run_start;
+                in_run = false;
+            }
+
+            if (render) {
+                if (!in_run) {
+                    run_start = x;
+                    in_run = true;
+                }
+                run_end = x + 1;
+            }
+        }
+    }
+
+    atomic_add_u64(&sched->rendered, rendered);
+
+    mga_scratch_release(scratch);
+
+    TRACE_ZONE_END(zone);
+}
+
+u64 render_mandelbrot_reuse(
+    thread_pool* tp, f32* out, const render_desc* desc,
+    const complex_fixedpt* center, const f32* prev, complexd prev_dim
+) {
+    if (prev == NULL || !(prev_dim.r < desc->dim.r) || !(prev_dim.i < desc->dim.i)) {
+        render_mandelbrot_auto(tp, out, desc, center);
+        return 0;
+    }
+
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    mandelbrot_args args = { 0 };
+    mandelbrot_tile_func* tile_func = render_setup_auto(scratch.arena, &args, out, desc, center);
+
+    // Pixel x samples (x / width - 0.5) * dim from the center, see mandelbrot_offset_r
+    f64 ratio_r = desc->dim.r / prev_dim.r;
+    f64 ratio_i = desc->dim.i / prev_dim.i;
+
+    reuse_sched sched = {
+        .out = out,
+        .prev = prev,
+        .width = desc->width,
+        .height = desc->height,
+        .scale_r = ratio_r,
+        .offset_r = (f64)desc->width * 0.5 * (1.0 - ratio_r),
+        .scale_i = ratio_i,
+        .offset_i = (f64)desc->height * 0.5 * (1.0 - ratio_i),
+        .args = &args,
+        .tile_func = tile_func
+    };
+
+    thread_pool_parallel_for(tp, 0, desc->height, REUSE_BAND_ROWS, reuse_band, &sched);
+
+    mga_scratch_release(scratch);
+
+    return (u64)desc->width * desc->height - sched.rendered;
+}
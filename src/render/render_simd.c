@@ -0,0 +1,438 @@
+#include "render_kernels.h"
+
+// The vector kernels are compiled with function level target attributes
+// so the rest of the application does not need -mavx2 or -mavx512f.
+// They are only called after render_kernel_resolve has checked the cpu.
+
+// Contracting the multiplies and adds into fma would make the
+// vector kernels disagree with the scalar reference on boundary pixels
+#if defined(__clang__)
+#    pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#    pragma GCC optimize("fp-contract=off")
+#endif
+
+#ifdef RENDER_X64
+
+#ifdef _MSC_VER
+#    include <intrin.h>
+#endif
+#include <immintrin.h>
+
+// mandelbrot_log2 step for step, so the vector kernels store the same counts as the scalar ones
+RENDER_TARGET("avx2")
+static inline __m256d mandelbrot_log2_avx2(__m256d x) {
+    // The exponent bits or'd into the mantissa of 2^52 convert to f64 exactly
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    __m256i bits = _mm256_castpd_si256(x);
+
+    __m256d e = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_castpd_si256(magic)));
+    e = _mm256_sub_pd(e, _mm256_set1_pd(4503599627370496.0 + 1023.0));
+
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffffll)),
+        _mm256_set1_epi64x(0x3ff0000000000000ll)
+    ));
+
+    __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(1.4142135623730951), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+    e = _mm256_add_pd(e, _mm256_and_pd(big, one));
+
+    __m256d t = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+    __m256d t2 = _mm256_mul_pd(t, t);
+
+    __m256d series = _mm256_add_pd(_mm256_set1_pd(1.0 / 5.0), _mm256_mul_pd(t2, _mm256_set1_pd(1.0 / 7.0)));
+    series = _mm256_add_pd(_mm256_set1_pd(1.0 / 3.0), _mm256_mul_pd(t2, series));
+    series = _mm256_add_pd(one, _mm256_mul_pd(t2, series));
+    __m256d ln_m = _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), t), series);
+
+    return _mm256_add_pd(e, _mm256_mul_pd(ln_m, _mm256_set1_pd(1.4426950408889634)));
+}
+
+RENDER_TARGET("avx2")
+void mandelbrot_smooth_avx2(f32* out, const f64* n, const f64* mag) {
+    __m256d n_v = _mm256_loadu_pd(n);
+    __m256d mag_v = _mm256_loadu_pd(mag);
+
+    __m256d escaped = _mm256_cmp_pd(mag_v, _mm256_set1_pd(MANDELBROT_BAILOUT), _CMP_GT_OQ);
+
+    __m256d log_mag = _mm256_mul_pd(mandelbrot_log2_avx2(mag_v), _mm256_set1_pd(1.0 / MANDELBROT_LOG2_BAILOUT));
+    __m256d smooth = _mm256_sub_pd(n_v, mandelbrot_log2_avx2(log_mag));
+    smooth = _mm256_max_pd(smooth, _mm256_setzero_pd());
+
+    _mm_storeu_ps(out, _mm256_cvtpd_ps(_mm256_blendv_pd(n_v, smooth, escaped)));
+}
+
+RENDER_TARGET("avx512f")
+static inline __m512d mandelbrot_log2_avx512(__m512d x) {
+    const __m512d magic = _mm512_set1_pd(4503599627370496.0);
+    const __m512d one = _mm512_set1_pd(1.0);
+
+    __m512i bits = _mm512_castpd_si512(x);
+
+    __m512d e = _mm512_castsi512_pd(_mm512_or_si512(_mm512_srli_epi64(bits, 52), _mm512_castpd_si512(magic)));
+    e = _mm512_sub_pd(e, _mm512_set1_pd(4503599627370496.0 + 1023.0));
+
+    __m512d m = _mm512_castsi512_pd(_mm512_or_si512(
+        _mm512_and_si512(bits, _mm512_set1_epi64(0x000fffffffffffffll)),
+        _mm512_set1_epi64(0x3ff0000000000000ll)
+    ));
+
+    __mmask8 big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(1.4142135623730951), _CMP_GT_OQ);
+    m = _mm512_mask_mul_pd(m, big, m, _mm512_set1_pd(0.5));
+    e = _mm512_mask_add_pd(e, big, e, one);
+
+    __m512d t = _mm512_div_pd(_mm512_sub_pd(m, one), _mm512_add_pd(m, one));
+    __m512d t2 = _mm512_mul_pd(t, t);
+
+    __m512d series = _mm512_add_pd(_mm512_set1_pd(1.0 / 5.0), _mm512_mul_pd(t2, _mm512_set1_pd(1.0 / 7.0)));
+    series = _mm512_add_pd(_mm512_set1_pd(1.0 / 3.0), _mm512_mul_pd(t2, series));
+    series = _mm512_add_pd(one, _mm512_mul_pd(t2, series));
+    __m512d ln_m = _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(2.0), t), series);
+
+    return _mm512_add_pd(e, _mm512_mul_pd(ln_m, _mm512_set1_pd(1.4426950408889634)));
+}
+
+RENDER_TARGET("avx512f")
+void mandelbrot_smooth_avx512(f32* out, const f64* n, const f64* mag) {
+    __m512d n_v = _mm512_loadu_pd(n);
+    __m512d mag_v = _mm512_loadu_pd(mag);
+
+    __mmask8 escaped = _mm512_cmp_pd_mask(mag_v, _mm512_set1_pd(MANDELBROT_BAILOUT), _CMP_GT_OQ);
+
+    __m512d log_mag = _mm512_mul_pd(mandelbrot_log2_avx512(mag_v), _mm512_set1_pd(1.0 / MANDELBROT_LOG2_BAILOUT));
+    __m512d smooth = _mm512_sub_pd(n_v, mandelbrot_log2_avx512(log_mag));
+    smooth = _mm512_max_pd(smooth, _mm512_setzero_pd());
+
+    _mm256_storeu_ps(out, _mm512_cvtpd_ps(_mm512_mask_blend_pd(escaped, n_v, smooth)));
+}
+
+// Same test as mandelbrot_in_main_bulbs, returns an all ones lane for points inside
+RENDER_TARGET("avx2")
+static inline __m256d mandelbrot_in_main_bulbs_avx2(__m256d c_r, __m256d c_i) {
+    __m256d x = _mm256_sub_pd(c_r, _mm256_set1_pd(0.25));
+    __m256d y2 = _mm256_mul_pd(c_i, c_i);
+    __m256d q = _mm256_add_pd(_mm256_mul_pd(x, x), y2);
+
+    __m256d cardioid = _mm256_cmp_pd(
+        _mm256_mul_pd(q, _mm256_add_pd(q, x)),
+        _mm256_mul_pd(_mm256_set1_pd(0.25), y2),
+        _CMP_LE_OQ
+    );
+
+    __m256d bx = _mm256_add_pd(c_r, _mm256_set1_pd(1.0));
+    __m256d bulb = _mm256_cmp_pd(
+        _mm256_add_pd(_mm256_mul_pd(bx, bx), y2),
+        _mm256_set1_pd(0.0625),
+        _CMP_LE_OQ
+    );
+
+    return _mm256_or_pd(cardioid, bulb);
+}
+
+// Iterates 4 points at once and returns the iteration each one escaped on,
+// with the squared radius they escaped at in mag_out (0 if they did not)
+RENDER_TARGET("avx2")
+static inline __m256d mandelbrot_lanes_avx2(const mandelbrot_args* args, __m256d c_r, __m256d c_i, __m256d* mag_out) {
+    const __m256d bailout = _mm256_set1_pd(MANDELBROT_BAILOUT);
+    const __m256d sign_bit = _mm256_set1_pd(-0.0);
+    const __m256d eps = _mm256_set1_pd(args->periodicity_eps);
+
+    __m256d z_r = _mm256_setzero_pd();
+    __m256d z_i = _mm256_setzero_pd();
+    __m256d n = _mm256_set1_pd((f64)args->iterations - 1.0);
+    __m256d escape_mag = _mm256_setzero_pd();
+    __m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+
+    __m256d saved_r = _mm256_setzero_pd();
+    __m256d saved_i = _mm256_setzero_pd();
+    u32 save_at = 1;
+
+    if (args->interior_checks) {
+        active = _mm256_andnot_pd(mandelbrot_in_main_bulbs_avx2(c_r, c_i), active);
+    }
+
+    for (u32 i = 0; i < args->iterations && _mm256_movemask_pd(active) != 0; i++) {
+        __m256d zr_zi = _mm256_mul_pd(z_r, z_i);
+        z_r = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(z_r, z_r), _mm256_mul_pd(z_i, z_i)), c_r);
+        z_i = _mm256_add_pd(_mm256_add_pd(zr_zi, zr_zi), c_i);
+
+        __m256d mag = _mm256_add_pd(_mm256_mul_pd(z_r, z_r), _mm256_mul_pd(z_i, z_i));
+        __m256d escaped = _mm256_and_pd(_mm256_cmp_pd(mag, bailout, _CMP_GT_OQ), active);
+
+        n = _mm256_blendv_pd(n, _mm256_set1_pd((f64)i), escaped);
+        escape_mag = _mm256_blendv_pd(escape_mag, mag, escaped);
+        active = _mm256_andnot_pd(escaped, active);
+
+        if (args->interior_checks) {
+            __m256d dist_r = _mm256_andnot_pd(sign_bit, _mm256_sub_pd(z_r, saved_r));
+            __m256d dist_i = _mm256_andnot_pd(sign_bit, _mm256_sub_pd(z_i, saved_i));
+            __m256d periodic = _mm256_and_pd(
+                _mm256_cmp_pd(dist_r, eps, _CMP_LT_OQ),
+                _mm256_cmp_pd(dist_i, eps, _CMP_LT_OQ)
+            );
+            active = _mm256_andnot_pd(periodic, active);
+
+            if (i == save_at) {
+                saved_r = z_r;
+                saved_i = z_i;
+                save_at *= 2;
+            }
+        }
+    }
+
+    *mag_out = escape_mag;
+    return n;
+}
+
+RENDER_TARGET("avx2")
+static void mandelbrot_row_avx2(const mandelbrot_args* args, u32 y, u32 start_x, u32 end_x) {
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d lane_offsets = _mm256_mul_pd(_mm256_set_pd(3.0, 2.0, 1.0, 0.0), _mm256_set1_pd((f64)args->grid_step));
+    const __m256d width = _mm256_set1_pd((f64)args->grid_width);
+    const __m256d dim_r = _mm256_set1_pd(args->complex_dim.r);
+    const __m256d center_r = _mm256_set1_pd(args->complex_center.r);
+
+    const __m256d c_i = _mm256_set1_pd(
+        mandelbrot_offset_i(args, y) + args->complex_center.i
+    );
+
+    // The last group may run past end_x, those lanes are computed but not stored
+    for (u32 x = start_x; x < end_x; x += 4) {
+        __m256d xs = _mm256_add_pd(_mm256_set1_pd((f64)(x * args->grid_step + args->grid_x)), lane_offsets);
+        __m256d c_r = _mm256_add_pd(
+            _mm256_mul_pd(_mm256_sub_pd(_mm256_div_pd(xs, width), half), dim_r),
+            center_r
+        );
+
+        __m256d mag;
+        __m256d n = mandelbrot_lanes_avx2(args, c_r, c_i, &mag);
+
+        f64 lane_n[4];
+        f64 lane_mag[4];
+        f32 lane_out[4];
+        _mm256_storeu_pd(lane_n, n);
+        _mm256_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx2(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(4, end_x - x); j++) {
+            args->out[x + j + y * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+// Same as the row version, but down column x.
+// This keeps tiles that are narrower than a vector fast
+RENDER_TARGET("avx2")
+static void mandelbrot_column_avx2(const mandelbrot_args* args, u32 x, u32 start_y, u32 end_y) {
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d lane_offsets = _mm256_mul_pd(_mm256_set_pd(3.0, 2.0, 1.0, 0.0), _mm256_set1_pd((f64)args->grid_step));
+    const __m256d height = _mm256_set1_pd((f64)args->grid_height);
+    const __m256d dim_i = _mm256_set1_pd(args->complex_dim.i);
+    const __m256d center_i = _mm256_set1_pd(args->complex_center.i);
+
+    const __m256d c_r = _mm256_set1_pd(
+        mandelbrot_offset_r(args, x) + args->complex_center.r
+    );
+
+    for (u32 y = start_y; y < end_y; y += 4) {
+        __m256d ys = _mm256_add_pd(_mm256_set1_pd((f64)(y * args->grid_step + args->grid_y)), lane_offsets);
+        __m256d c_i = _mm256_add_pd(
+            _mm256_mul_pd(_mm256_sub_pd(_mm256_div_pd(ys, height), half), dim_i),
+            center_i
+        );
+
+        __m256d mag;
+        __m256d n = mandelbrot_lanes_avx2(args, c_r, c_i, &mag);
+
+        f64 lane_n[4];
+        f64 lane_mag[4];
+        f32 lane_out[4];
+        _mm256_storeu_pd(lane_n, n);
+        _mm256_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx2(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(4, end_y - y); j++) {
+            args->out[x + (y + j) * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+RENDER_TARGET("avx512f")
+static inline __mmask8 mandelbrot_in_main_bulbs_avx512(__m512d c_r, __m512d c_i) {
+    __m512d x = _mm512_sub_pd(c_r, _mm512_set1_pd(0.25));
+    __m512d y2 = _mm512_mul_pd(c_i, c_i);
+    __m512d q = _mm512_add_pd(_mm512_mul_pd(x, x), y2);
+
+    __mmask8 cardioid = _mm512_cmp_pd_mask(
+        _mm512_mul_pd(q, _mm512_add_pd(q, x)),
+        _mm512_mul_pd(_mm512_set1_pd(0.25), y2),
+        _CMP_LE_OQ
+    );
+
+    __m512d bx = _mm512_add_pd(c_r, _mm512_set1_pd(1.0));
+    __mmask8 bulb = _mm512_cmp_pd_mask(
+        _mm512_add_pd(_mm512_mul_pd(bx, bx), y2),
+        _mm512_set1_pd(0.0625),
+        _CMP_LE_OQ
+    );
+
+    return cardioid | bulb;
+}
+
+RENDER_TARGET("avx512f")
+static inline __m512d mandelbrot_lanes_avx512(const mandelbrot_args* args, __m512d c_r, __m512d c_i, __m512d* mag_out) {
+    const __m512d bailout = _mm512_set1_pd(MANDELBROT_BAILOUT);
+    const __m512d eps = _mm512_set1_pd(args->periodicity_eps);
+
+    __m512d z_r = _mm512_setzero_pd();
+    __m512d z_i = _mm512_setzero_pd();
+    __m512d n = _mm512_set1_pd((f64)args->iterations - 1.0);
+    __m512d escape_mag = _mm512_setzero_pd();
+    __mmask8 active = 0xff;
+
+    __m512d saved_r = _mm512_setzero_pd();
+    __m512d saved_i = _mm512_setzero_pd();
+    u32 save_at = 1;
+
+    if (args->interior_checks) {
+        active &= ~mandelbrot_in_main_bulbs_avx512(c_r, c_i);
+    }
+
+    for (u32 i = 0; i < args->iterations && active != 0; i++) {
+        __m512d zr_zi = _mm512_mul_pd(z_r, z_i);
+        z_r = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(z_r, z_r), _mm512_mul_pd(z_i, z_i)), c_r);
+        z_i = _mm512_add_pd(_mm512_add_pd(zr_zi, zr_zi), c_i);
+
+        __m512d mag = _mm512_add_pd(_mm512_mul_pd(z_r, z_r), _mm512_mul_pd(z_i, z_i));
+        __mmask8 escaped = _mm512_mask_cmp_pd_mask(active, mag, bailout, _CMP_GT_OQ);
+
+        n = _mm512_mask_blend_pd(escaped, n, _mm512_set1_pd((f64)i));
+        escape_mag = _mm512_mask_blend_pd(escaped, escape_mag, mag);
+        active &= ~escaped;
+
+        if (args->interior_checks) {
+            __m512d dist_r = _mm512_abs_pd(_mm512_sub_pd(z_r, saved_r));
+            __m512d dist_i = _mm512_abs_pd(_mm512_sub_pd(z_i, saved_i));
+            __mmask8 periodic = _mm512_mask_cmp_pd_mask(active, dist_r, eps, _CMP_LT_OQ);
+            periodic = _mm512_mask_cmp_pd_mask(periodic, dist_i, eps, _CMP_LT_OQ);
+            active &= ~periodic;
+
+            if (i == save_at) {
+                saved_r = z_r;
+                saved_i = z_i;
+                save_at *= 2;
+            }
+        }
+    }
+
+    *mag_out = escape_mag;
+    return n;
+}
+
+RENDER_TARGET("avx512f")
+static void mandelbrot_row_avx512(const mandelbrot_args* args, u32 y, u32 start_x, u32 end_x) {
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d lane_offsets = _mm512_mul_pd(_mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0), _mm512_set1_pd((f64)args->grid_step));
+    const __m512d width = _mm512_set1_pd((f64)args->grid_width);
+    const __m512d dim_r = _mm512_set1_pd(args->complex_dim.r);
+    const __m512d center_r = _mm512_set1_pd(args->complex_center.r);
+
+    const __m512d c_i = _mm512_set1_pd(
+        mandelbrot_offset_i(args, y) + args->complex_center.i
+    );
+
+    // The last group may run past end_x, those lanes are computed but not stored
+    for (u32 x = start_x; x < end_x; x += 8) {
+        __m512d xs = _mm512_add_pd(_mm512_set1_pd((f64)(x * args->grid_step + args->grid_x)), lane_offsets);
+        __m512d c_r = _mm512_add_pd(
+            _mm512_mul_pd(_mm512_sub_pd(_mm512_div_pd(xs, width), half), dim_r),
+            center_r
+        );
+
+        __m512d mag;
+        __m512d n = mandelbrot_lanes_avx512(args, c_r, c_i, &mag);
+
+        f64 lane_n[8];
+        f64 lane_mag[8];
+        f32 lane_out[8];
+        _mm512_storeu_pd(lane_n, n);
+        _mm512_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx512(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(8, end_x - x); j++) {
+            args->out[x + j + y * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+RENDER_TARGET("avx512f")
+static void mandelbrot_column_avx512(const mandelbrot_args* args, u32 x, u32 start_y, u32 end_y) {
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d lane_offsets = _mm512_mul_pd(_mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0), _mm512_set1_pd((f64)args->grid_step));
+    const __m512d height = _mm512_set1_pd((f64)args->grid_height);
+    const __m512d dim_i = _mm512_set1_pd(args->complex_dim.i);
+    const __m512d center_i = _mm512_set1_pd(args->complex_center.i);
+
+    const __m512d c_r = _mm512_set1_pd(
+        mandelbrot_offset_r(args, x) + args->complex_center.r
+    );
+
+    for (u32 y = start_y; y < end_y; y += 8) {
+        __m512d ys = _mm512_add_pd(_mm512_set1_pd((f64)(y * args->grid_step + args->grid_y)), lane_offsets);
+        __m512d c_i = _mm512_add_pd(
+            _mm512_mul_pd(_mm512_sub_pd(_mm512_div_pd(ys, height), half), dim_i),
+            center_i
+        );
+
+        __m512d mag;
+        __m512d n = mandelbrot_lanes_avx512(args, c_r, c_i, &mag);
+
+        f64 lane_n[8];
+        f64 lane_mag[8];
+        f32 lane_out[8];
+        _mm512_storeu_pd(lane_n, n);
+        _mm512_storeu_pd(lane_mag, mag);
+        mandelbrot_smooth_avx512(lane_out, lane_n, lane_mag);
+        for (u32 j = 0; j < MIN(8, end_y - y); j++) {
+            args->out[x + (y + j) * args->img_width] = lane_out[j];
+        }
+    }
+}
+
+void mandelbrot_tile_avx2(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    if (end_x - start_x < 4) {
+        for (u32 x = start_x; x < end_x; x++) {
+            mandelbrot_column_avx2(args, x, start_y, end_y);
+        }
+        return;
+    }
+
+    for (u32 y = start_y; y < end_y; y++) {
+        mandelbrot_row_avx2(args, y, start_x, end_x);
+    }
+}
+
+void mandelbrot_tile_avx512(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    if (end_x - start_x < 8) {
+        for (u32 x = start_x; x < end_x; x++) {
+            mandelbrot_column_avx512(args, x, start_y, end_y);
+        }
+        return;
+    }
+
+    for (u32 y = start_y; y < end_y; y++) {
+        mandelbrot_row_avx512(args, y, start_x, end_x);
+    }
+}
+
+#else // RENDER_X64
+
+void mandelbrot_tile_avx2(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    mandelbrot_tile_scalar(args, start_x, start_y, end_x, end_y);
+}
+
+void mandelbrot_tile_avx512(const mandelbrot_args* args, u32 start_x, u32 start_y, u32 end_x, u32 end_y) {
+    mandelbrot_tile_scalar(args, start_x, start_y, end_x, end_y);
+}
+
+#endif // RENDER_X64
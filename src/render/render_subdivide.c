@@ -0,0 +1,189 @@
+#include "render.h"
+#include "render_kernels.h"
+
+// Mariani-Silver subdivision
+// Every rectangle is handed out with its border pixels already rendered.
+// If no pixel of the border escaped, the inside is filled as never escaping,
+// otherwise the rectangle is cut in half along its longer side,
+// the dividing line is rendered, and both halves are processed the same way.
+// One half is queued on the thread pool and the other is processed in place.
+// The set has no holes, so a closed curve inside it only encloses more of the set.
+// The border is only sampled at pixels though, and exterior filaments thinner
+// than a pixel can pass between two samples, which the fill then covers up.
+// Escaped borders are never filled, smooth counts depend on where each point escaped.
+
+// Rectangles with both sides at most this size are rendered directly.
+// Thin rows and columns are slower per pixel than tiles, so smaller rects
+// only pay off when they get filled, and they cover up more filaments
+#define SUBDIV_MIN_SIZE 64
+
+typedef struct subdiv_rect subdiv_rect;
+
+typedef struct {
+    thread_pool* tp;
+    mandelbrot_args args;
+    mandelbrot_tile_func* tile_func;
+
+    subdiv_rect* rects;
+    u32 max_rects;
+    volatile u32 num_rects;
+} subdiv_sched;
+
+// [x0, x1) x [y0, y1), border included
+struct subdiv_rect {
+    subdiv_sched* sched;
+
+    u32 x0, y0;
+    u32 x1, y1;
+};
+
+static b32 subdiv_border_interior(const subdiv_rect* rect, f32 interior) {
+    const f32* out = rect->sched->args.out;
+    u32 width = rect->sched->args.img_width;
+
+    for (u32 x = rect->x0; x < rect->x1; x++) {
+        if (out[x + rect->y0 * width] != interior ||
+            out[x + (rect->y1 - 1) * width] != interior) {
+            return false;
+        }
+    }
+    for (u32 y = rect->y0; y < rect->y1; y++) {
+        if (out[rect->x0 + y * width] != interior ||
+            out[rect->x1 - 1 + y * width] != interior) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void subdiv_fill(const subdiv_rect* rect, f32 interior) {
+    f32* out = rect->sched->args.out;
+    u32 width = rect->sched->args.img_width;
+
+    for (u32 y = rect->y0 + 1; y < rect->y1 - 1; y++) {
+        for (u32 x = rect->x0 + 1; x < rect->x1 - 1; x++) {
+            out[x + y * width] = interior;
+        }
+    }
+}
+
+static void subdiv_process(subdiv_rect rect);
+
+static void subdiv_task(void* void_rect) {
+    TRACE_ZONE_BEGIN(zone, "subdivide");
+    subdiv_process(*(subdiv_rect*)void_rect);
+    TRACE_ZONE_END(zone);
+}
+
+static void subdiv_process(subdiv_rect rect) {
+    subdiv_sched* sched = rect.sched;
+    const mandelbrot_args* args = &sched->args;
+    // The count every kernel writes for pixels that never escaped
+    const f32 interior = (f32)args->iterations - 1.0f;
+
+    while (true) {
+        u32 w = rect.x1 - rect.x0;
+        u32 h = rect.y1 - rect.y0;
+
+        if (w <= 2 || h <= 2) {
+            return;
+        }
+
+        if (subdiv_border_interior(&rect, interior)) {
+            subdiv_fill(&rect, interior);
+            return;
+        }
+        if (w <= SUBDIV_MIN_SIZE && h <= SUBDIV_MIN_SIZE) {
+            sched->tile_func(args, rect.x0 + 1, rect.y0 + 1, rect.x1 - 1, rect.y1 - 1);
+            return;
+        }
+
+        subdiv_rect first = rect;
+        subdiv_rect second = rect;
+
+        if (w >= h) {
+            u32 mid_x = rect.x0 + w / 2;
+            sched->tile_func(args, mid_x, rect.y0 + 1, mid_x + 1, rect.y1 - 1);
+
+            first.x1 = mid_x + 1;
+            second.x0 = mid_x;
+        } else {
+            u32 mid_y = rect.y0 + h / 2;
+            sched->tile_func(args, rect.x0 + 1, mid_y, rect.x1 - 1, mid_y + 1);
+
+            first.y1 = mid_y + 1;
+            second.y0 = mid_y;
+        }
+
+        // Running out of rects only means the half is processed here instead
+        u32 index = atomic_add_u32(&sched->num_rects, 1);
+        if (index < sched->max_rects) {
+            sched->rects[index] = first;
+
+            thread_pool_add_task(
+                sched->tp,
+                (thread_task){
+                    .func = subdiv_task,
+                    .arg = &sched->rects[index]
+                }
+            );
+        } else {
+            subdiv_process(first);
+        }
+
+        rect = second;
+    }
+}
+
+void render_subdivide(thread_pool* tp, const mandelbrot_args* args, mandelbrot_tile_func* tile_func) {
+    mga_temp scratch = mga_scratch_get(NULL, 0);
+
+    u32 width = args->img_width;
+    u32 height = args->img_height;
+
+    // About one rect per SUBDIV_MIN_SIZE / 2 square cell,
+    // which covers every view that does not split all the way down
+    u32 cells_x = (width + SUBDIV_MIN_SIZE / 2 - 1) / (SUBDIV_MIN_SIZE / 2);
+    u32 cells_y = (height + SUBDIV_MIN_SIZE / 2 - 1) / (SUBDIV_MIN_SIZE / 2);
+
+    subdiv_sched* sched = MGA_PUSH_ZERO_STRUCT(scratch.arena, subdiv_sched);
+    *sched = (subdiv_sched){
+        .tp = tp,
+        .args = *args,
+        .tile_func = tile_func,
+        .max_rects = cells_x * cells_y + 1
+    };
+    sched->rects = MGA_PUSH_ARRAY(scratch.arena, subdiv_rect, sched->max_rects);
+
+    // The image border seeds the first rect
+    tile_func(args, 0, 0, width, 1);
+    if (height > 1) {
+        tile_func(args, 0, height - 1, width, height);
+    }
+    if (height > 2) {
+        tile_func(args, 0, 1, 1, height - 1);
+        if (width > 1) {
+            tile_func(args, width - 1, 1, width, height - 1);
+        }
+    }
+
+    sched->rects[0] = (subdiv_rect){
+        .sched = sched,
+        .x0 = 0, .y0 = 0,
+        .x1 = width, .y1 = height
+    };
+    sched->num_rects = 1;
+
+    thread_pool_add_task(
+        tp,
+        (thread_task){
+            .func = subdiv_task,
+            .arg = &sched->rects[0]
+        }
+    );
+
+    thread_pool_wait(tp);
+
+    mga_scratch_release(scratch);
+}
@@ -15,6 +15,7 @@
 // Only tested with -fno-strict-aliasing (which the Linux kernel uses, and MSVC's default).
 //
 #include "fpng.h"
+#include "trace/trace.h"
 #include <assert.h>
 #include <string.h>
 
@@ -302,20 +303,41 @@ static void do_cpuid(uint32_t eax, uint32_t ecx, uint32_t* regs)
 
     regs[0] = eax; regs[1] = ebx; regs[2] = ecx; regs[3] = edx;
 }
+
+static uint64_t do_xgetbv(uint32_t index)
+{
+    uint32_t eax = 0, edx = 0;
+    __asm__("xgetbv;" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((uint64_t)edx << 32) | eax;
+}
 #endif
 
 typedef struct {
-    bool m_initialized, m_has_fpu, m_has_mmx, m_has_sse, m_has_sse2, m_has_sse3, m_has_ssse3, m_has_sse41, m_has_sse42, m_has_avx, m_has_avx2, m_has_pclmulqdq;
+    bool m_initialized, m_has_fpu, m_has_mmx, m_has_sse, m_has_sse2, m_has_sse3, m_has_ssse3, m_has_sse41, m_has_sse42, m_has_avx, m_has_avx2, m_has_avx512f, m_has_fma, m_has_pclmulqdq;
+    // Set when the OS saves the YMM/ZMM register state on context switches (checked through XGETBV)
+    bool m_os_ymm, m_os_zmm;
 } cpu_info;
 
 static void extract_x86_flags(cpu_info* info, uint32_t ecx, uint32_t edx)
 {
     info->m_has_fpu = (edx & (1 << 0)) != 0;    info->m_has_mmx = (edx & (1 << 23)) != 0;    info->m_has_sse = (edx & (1 << 25)) != 0; info->m_has_sse2 = (edx & (1 << 26)) != 0;
     info->m_has_sse3 = (ecx & (1 << 0)) != 0; info->m_has_ssse3 = (ecx & (1 << 9)) != 0; info->m_has_sse41 = (ecx & (1 << 19)) != 0; info->m_has_sse42 = (ecx & (1 << 20)) != 0;
-    info->m_has_pclmulqdq = (ecx & (1 << 1)) != 0; info->m_has_avx = (ecx & (1 << 28)) != 0;
+    info->m_has_pclmulqdq = (ecx & (1 << 1)) != 0; info->m_has_avx = (ecx & (1 << 28)) != 0; info->m_has_fma = (ecx & (1 << 12)) != 0;
+
+    // OSXSAVE
+    if ((ecx & (1 << 27)) != 0)
+    {
+#ifdef _MSC_VER
+        uint64_t xcr0 = _xgetbv(0);
+#else
+        uint64_t xcr0 = do_xgetbv(0);
+#endif
+        info->m_os_ymm = (xcr0 & 0x06) == 0x06;
+        info->m_os_zmm = (xcr0 & 0xe6) == 0xe6;
+    }
 }
 
-static void extract_x86_extended_flags(cpu_info* info, uint32_t ebx) { info->m_has_avx2 = (ebx & (1 << 5)) != 0; }
+static void extract_x86_extended_flags(cpu_info* info, uint32_t ebx) { info->m_has_avx2 = (ebx & (1 << 5)) != 0; info->m_has_avx512f = (ebx & (1 << 16)) != 0; }
 
 
 static void cpu_info_init(cpu_info* info)
@@ -361,6 +383,12 @@ static bool cpu_info_can_use_sse41(const cpu_info* info) {
 static bool cpu_info_can_use_pclmul(const cpu_info* info) {
     return info->m_has_pclmulqdq && cpu_info_can_use_sse41(info);
 }
+static bool cpu_info_can_use_avx2(const cpu_info* info) {
+    return info->m_has_avx && info->m_has_avx2 && info->m_has_fma && info->m_os_ymm;
+}
+static bool cpu_info_can_use_avx512(const cpu_info* info) {
+    return info->m_has_avx512f && info->m_os_zmm && cpu_info_can_use_avx2(info);
+}
 
 
 cpu_info g_cpu_info = { 0 };
@@ -385,6 +413,26 @@ bool fpng_cpu_supports_sse41()
 #endif
 }
 
+bool fpng_cpu_supports_avx2()
+{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
+    assert(g_cpu_info.m_initialized);
+    return cpu_info_can_use_avx2(&g_cpu_info);
+#else
+    return false;
+#endif
+}
+
+bool fpng_cpu_supports_avx512()
+{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
+    assert(g_cpu_info.m_initialized);
+    return cpu_info_can_use_avx512(&g_cpu_info);
+#else
+    return false;
+#endif
+}
+
 uint32_t fpng_crc32(const void* pData, size_t size, uint32_t prev_crc32)
 {
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
@@ -1094,16 +1142,32 @@ static uint32_t pixel_deflate_dyn_3_rle(
     return dst_ofs;
 }
 
+// The one pass compressors can also write one band of rows of a larger stream.
+// Every band but the first leaves out the zlib header, every band but the last
+// clears BFINAL and ends on a sync flush (an empty stored block), so the bands
+// can be compressed separately and concatenated. Only a whole image gets an adler32.
+enum
+{
+    FPNG_BAND_FIRST = 1,
+    FPNG_BAND_LAST = 2,
+    FPNG_BAND_WHOLE = FPNG_BAND_FIRST | FPNG_BAND_LAST
+};
+
 static uint32_t pixel_deflate_dyn_3_rle_one_pass(
     const uint8_t* pImg, uint32_t w, uint32_t h,
-    uint8_t* pDst, uint32_t dst_buf_size)
+    uint8_t* pDst, uint32_t dst_buf_size, uint32_t band_flags)
 {
     const uint32_t bpl = 1 + w * 3;
 
-    if (dst_buf_size < sizeof(g_dyn_huff_3))
+    const uint32_t hdr_ofs = (band_flags & FPNG_BAND_FIRST) ? 0 : 2;
+
+    if (dst_buf_size < sizeof(g_dyn_huff_3) - hdr_ofs)
         return false;
-    memcpy(pDst, g_dyn_huff_3, sizeof(g_dyn_huff_3));
-    uint32_t dst_ofs = sizeof(g_dyn_huff_3);
+    memcpy(pDst, g_dyn_huff_3 + hdr_ofs, sizeof(g_dyn_huff_3) - hdr_ofs);
+    uint32_t dst_ofs = sizeof(g_dyn_huff_3) - hdr_ofs;
+
+    if ((band_flags & FPNG_BAND_LAST) == 0)
+        pDst[2 - hdr_ofs] &= ~1;
 
     uint64_t bit_buf = DYN_HUFF_3_BITBUF;
     int bit_buf_size = DYN_HUFF_3_BITBUF_SIZE;
@@ -1111,7 +1175,7 @@ static uint32_t pixel_deflate_dyn_3_rle_one_pass(
     const uint8_t* pSrc = pImg;
     uint32_t src_ofs = 0;
 
-    uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
+    uint32_t src_adler32 = (band_flags == FPNG_BAND_WHOLE) ? fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT) : 0;
 
     for (uint32_t y = 0; y < h; y++)
     {
@@ -1182,8 +1246,22 @@ static uint32_t pixel_deflate_dyn_3_rle_one_pass(
 
     PUT_BITS_CZ(g_dyn_huff_3_codes[256].m_code, g_dyn_huff_3_codes[256].m_code_size);
 
+    if ((band_flags & FPNG_BAND_LAST) == 0)
+        PUT_BITS(0, 3);
+
     PUT_BITS_FORCE_FLUSH;
 
+    if ((band_flags & FPNG_BAND_LAST) == 0)
+    {
+        if ((dst_ofs + 4) > dst_buf_size)
+            return 0;
+        WRITE_LE32(pDst + dst_ofs, 0xFFFF0000);
+        dst_ofs += 4;
+    }
+
+    if (band_flags != FPNG_BAND_WHOLE)
+        return dst_ofs;
+
     // Write zlib adler32
     for (uint32_t i = 0; i < 4; i++)
     {
@@ -1389,14 +1467,19 @@ static uint32_t pixel_deflate_dyn_4_rle(
 
 static uint32_t pixel_deflate_dyn_4_rle_one_pass(
     const uint8_t* pImg, uint32_t w, uint32_t h,
-    uint8_t* pDst, uint32_t dst_buf_size)
+    uint8_t* pDst, uint32_t dst_buf_size, uint32_t band_flags)
 {
     const uint32_t bpl = 1 + w * 4;
 
-    if (dst_buf_size < sizeof(g_dyn_huff_4))
+    const uint32_t hdr_ofs = (band_flags & FPNG_BAND_FIRST) ? 0 : 2;
+
+    if (dst_buf_size < sizeof(g_dyn_huff_4) - hdr_ofs)
         return false;
-    memcpy(pDst, g_dyn_huff_4, sizeof(g_dyn_huff_4));
-    uint32_t dst_ofs = sizeof(g_dyn_huff_4);
+    memcpy(pDst, g_dyn_huff_4 + hdr_ofs, sizeof(g_dyn_huff_4) - hdr_ofs);
+    uint32_t dst_ofs = sizeof(g_dyn_huff_4) - hdr_ofs;
+
+    if ((band_flags & FPNG_BAND_LAST) == 0)
+        pDst[2 - hdr_ofs] &= ~1;
 
     uint64_t bit_buf = DYN_HUFF_4_BITBUF;
     int bit_buf_size = DYN_HUFF_4_BITBUF_SIZE;
@@ -1404,7 +1487,7 @@ static uint32_t pixel_deflate_dyn_4_rle_one_pass(
     const uint8_t* pSrc = pImg;
     uint32_t src_ofs = 0;
 
-    uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
+    uint32_t src_adler32 = (band_flags == FPNG_BAND_WHOLE) ? fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT) : 0;
 
     for (uint32_t y = 0; y < h; y++)
     {
@@ -1504,8 +1587,22 @@ do_literals:
 
     PUT_BITS_CZ(g_dyn_huff_4_codes[256].m_code, g_dyn_huff_4_codes[256].m_code_size);
 
+    if ((band_flags & FPNG_BAND_LAST) == 0)
+        PUT_BITS(0, 3);
+
     PUT_BITS_FORCE_FLUSH;
 
+    if ((band_flags & FPNG_BAND_LAST) == 0)
+    {
+        if ((dst_ofs + 4) > dst_buf_size)
+            return 0;
+        WRITE_LE32(pDst + dst_ofs, 0xFFFF0000);
+        dst_ofs += 4;
+    }
+
+    if (band_flags != FPNG_BAND_WHOLE)
+        return dst_ofs;
+
     // Write zlib adler32
     for (uint32_t i = 0; i < 4; i++)
     {
@@ -1599,6 +1696,55 @@ static void apply_filter(uint32_t filter, int w, int h, uint32_t num_chans, uint
         out->size = (new_size); \
     } while (0)
 const uint32_t FPNG_CRC32_INIT = 0;
+static const uint32_t PNG_HEADER_SIZE = 58;
+
+// out holds PNG_HEADER_SIZE bytes of space followed by the zlib stream.
+// Fills in the header, the fdEC and IDAT chunks, and appends the IEND chunk
+static void write_png_chunks(mg_arena* arena, const fpng_img* img, string8* out)
+{
+    int i;
+
+    const uint32_t idat_len = (uint32_t)(out->size) - PNG_HEADER_SIZE;
+
+    // Write real PNG header, fdEC chunk, and the beginning of the IDAT chunk
+    {
+        static const uint8_t s_color_type[] = { 0x00, 0x00, 0x04, 0x02, 0x06 };
+
+        uint8_t pnghdr[58] = { 
+            0x89,0x50,0x4e,0x47,0x0d,0x0a,0x1a,0x0a,   // PNG sig
+            0x00,0x00,0x00,0x0d, 'I','H','D','R',  // IHDR chunk len, type
+            0,0,(uint8_t)(img->width >> 8),(uint8_t)img->width, // width
+            0,0,(uint8_t)(img->height >> 8),(uint8_t)img->height, // height
+            8,   //bit_depth
+            s_color_type[img->channels], // color_type
+            0, // compression
+            0, // filter
+            0, // interlace
+            0, 0, 0, 0, // IHDR crc32
+            0, 0, 0, 5, 'f', 'd', 'E', 'C', 82, 36, 147, 227, FPNG_FDEC_VERSION,   0xE5, 0xAB, 0x62, 0x99, // our custom private, ancillary, do not copy, fdEC chunk
+          (uint8_t)(idat_len >> 24),(uint8_t)(idat_len >> 16),(uint8_t)(idat_len >> 8),(uint8_t)idat_len, 'I','D','A','T' // IDATA chunk len, type
+        }; 
+
+        // Compute IHDR CRC32
+        uint32_t c = (uint32_t)fpng_crc32(pnghdr + 12, 17, FPNG_CRC32_INIT);
+        for (i = 0; i < 4; ++i, c <<= 8)
+            ((uint8_t*)(pnghdr + 29))[i] = (uint8_t)(c >> 24);
+
+        memcpy(out->str, pnghdr, PNG_HEADER_SIZE);
+    }
+
+    // Write IDAT chunk's CRC32 and a 0 length IEND chunk
+    const char* data = "\0\0\0\0\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82"; // IDAT CRC32, followed by the IEND chunk
+    uint64_t temp_size = out->size;
+    ENCODER_RESIZE_OUT(out->size + 16);
+    memcpy(out->str + temp_size, data, 16);
+
+    // Compute IDAT crc32
+    uint32_t c = (uint32_t)fpng_crc32(out->str + PNG_HEADER_SIZE - 4, idat_len + 4, FPNG_CRC32_INIT);
+    
+    for (i = 0; i < 4; ++i, c <<= 8)
+        (out->str + out->size - 16)[i] = (uint8_t)(c >> 24);
+}
 
 bool fpng_encode_image_to_memory(
     mg_arena* arena,
@@ -1626,7 +1772,7 @@ bool fpng_encode_image_to_memory(
     u32 arena_align = mga_get_align(arena);
     arena->_align = 1;
 
-    int i, bpl = img->width * img->channels;
+    int bpl = img->width * img->channels;
     uint32_t y;
 
     mga_temp scratch = mga_scratch_get(&arena, 1);
@@ -1650,8 +1796,6 @@ bool fpng_encode_image_to_memory(
         temp_buf_ofs += 1 + bpl;
     }
 
-    const uint32_t PNG_HEADER_SIZE = 58;
-            
     uint32_t out_ofs = PNG_HEADER_SIZE;
             
     uint64_t init_out_size = (out_ofs + (bpl + 1) * img->height + 7) & ~7;
@@ -1666,14 +1810,14 @@ bool fpng_encode_image_to_memory(
             if (flags & FPNG_ENCODE_SLOWER)
                 defl_size = pixel_deflate_dyn_3_rle(temp_buf.data, img->width, img->height, &(out->str[out_ofs]), (uint32_t)(out->size) - out_ofs);
             else
-                defl_size = pixel_deflate_dyn_3_rle_one_pass(temp_buf.data, img->width, img->height, &(out->str[out_ofs]), (uint32_t)(out->size) - out_ofs);
+                defl_size = pixel_deflate_dyn_3_rle_one_pass(temp_buf.data, img->width, img->height, &(out->str[out_ofs]), (uint32_t)(out->size) - out_ofs, FPNG_BAND_WHOLE);
         }
         else
         {
             if (flags & FPNG_ENCODE_SLOWER)
                 defl_size = pixel_deflate_dyn_4_rle(temp_buf.data, img->width, img->height, &(out->str[out_ofs]), (uint32_t)(out->size) - out_ofs);
             else
-                defl_size = pixel_deflate_dyn_4_rle_one_pass(temp_buf.data, img->width, img->height, &(out->str[out_ofs]), (uint32_t)(out->size) - out_ofs);
+                defl_size = pixel_deflate_dyn_4_rle_one_pass(temp_buf.data, img->width, img->height, &(out->str[out_ofs]), (uint32_t)(out->size) - out_ofs, FPNG_BAND_WHOLE);
         }
     }
 
@@ -1720,47 +1864,177 @@ bool fpng_encode_image_to_memory(
 
     ENCODER_RESIZE_OUT(out_ofs + zlib_size);
 
-    const uint32_t idat_len = (uint32_t)(out->size) - PNG_HEADER_SIZE;
+    write_png_chunks(arena, img, out);
 
-    // Write real PNG header, fdEC chunk, and the beginning of the IDAT chunk
+    arena->_align = arena_align;
+    mga_scratch_release(scratch);
+
+    return true;
+}
+
+// Smallest band worth its block header and task
+#define FPNG_MIN_BAND_ROWS 32
+
+typedef struct
+{
+    const fpng_img* img;
+    uint32_t y0, y1;
+    uint32_t band_flags;
+
+    // Rows y0 to y1 of the filtered image
+    uint8_t* filtered;
+
+    uint8_t* out;
+    uint32_t out_capacity;
+    uint32_t out_size;
+
+    uint32_t adler;
+} fpng_band;
+
+// zlib's adler32_combine, the adler32 of a concatenation from the adler32s of its parts
+static uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, uint64_t len2)
+{
+    const uint32_t K = 65521;
+
+    uint32_t rem = (uint32_t)(len2 % K);
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % K);
+
+    sum1 += (adler2 & 0xFFFF) + K - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + K - rem;
+
+    if (sum1 >= K) sum1 -= K;
+    if (sum1 >= K) sum1 -= K;
+    if (sum2 >= (K << 1)) sum2 -= (K << 1);
+    if (sum2 >= K) sum2 -= K;
+
+    return sum1 | (sum2 << 16);
+}
+
+static void fpng_encode_band(fpng_band* band)
+{
+    const fpng_img* img = band->img;
+    const uint32_t bpl = img->width * img->channels;
+
+    TRACE_ZONE_BEGIN(zone, "png band");
+
+    // The up filter reaches into the previous band's pixels, which is fine
+    // because it only reads the unfiltered image
+    for (uint32_t y = band->y0; y < band->y1; y++)
     {
-        static const uint8_t s_color_type[] = { 0x00, 0x00, 0x04, 0x02, 0x06 };
+        const uint8_t* pSrc = img->data + (uint64_t)y * bpl;
+        const uint8_t* pPrev_src = y ? (pSrc - bpl) : NULL;
+        uint8_t* pDst = band->filtered + (uint64_t)(y - band->y0) * (bpl + 1);
 
-        uint8_t pnghdr[58] = { 
-            0x89,0x50,0x4e,0x47,0x0d,0x0a,0x1a,0x0a,   // PNG sig
-            0x00,0x00,0x00,0x0d, 'I','H','D','R',  // IHDR chunk len, type
-            0,0,(uint8_t)(img->width >> 8),(uint8_t)img->width, // width
-            0,0,(uint8_t)(img->height >> 8),(uint8_t)img->height, // height
-            8,   //bit_depth
-            s_color_type[img->channels], // color_type
-            0, // compression
-            0, // filter
-            0, // interlace
-            0, 0, 0, 0, // IHDR crc32
-            0, 0, 0, 5, 'f', 'd', 'E', 'C', 82, 36, 147, 227, FPNG_FDEC_VERSION,   0xE5, 0xAB, 0x62, 0x99, // our custom private, ancillary, do not copy, fdEC chunk
-          (uint8_t)(idat_len >> 24),(uint8_t)(idat_len >> 16),(uint8_t)(idat_len >> 8),(uint8_t)idat_len, 'I','D','A','T' // IDATA chunk len, type
-        }; 
+        apply_filter(y ? 2 : 0, img->width, img->height, img->channels, bpl, pSrc, pPrev_src, pDst);
+    }
 
-        // Compute IHDR CRC32
-        uint32_t c = (uint32_t)fpng_crc32(pnghdr + 12, 17, FPNG_CRC32_INIT);
-        for (i = 0; i < 4; ++i, c <<= 8)
-            ((uint8_t*)(pnghdr + 29))[i] = (uint8_t)(c >> 24);
+    const uint32_t rows = band->y1 - band->y0;
+    band->adler = fpng_adler32(band->filtered, (size_t)rows * (bpl + 1), FPNG_ADLER32_INIT);
 
-        memcpy(out->str, pnghdr, PNG_HEADER_SIZE);
+    if (img->channels == 3)
+        band->out_size = pixel_deflate_dyn_3_rle_one_pass(band->filtered, img->width, rows, band->out, band->out_capacity, band->band_flags);
+    else
+        band->out_size = pixel_deflate_dyn_4_rle_one_pass(band->filtered, img->width, rows, band->out, band->out_capacity, band->band_flags);
+
+    TRACE_ZONE_END(zone);
+}
+
+static void fpng_encode_bands(void* ctx, uint64_t begin, uint64_t end)
+{
+    fpng_band* bands = (fpng_band*)ctx;
+
+    for (uint64_t i = begin; i < end; i++)
+        fpng_encode_band(&bands[i]);
+}
+
+bool fpng_encode_image_to_memory_mt(
+    mg_arena* arena,
+    const fpng_img* img, string8* out,
+    uint32_t flags, thread_pool* tp
+) {
+    const uint32_t num_threads = tp ? thread_pool_num_threads(tp) : 1;
+
+    // Aim for a couple of bands per thread, so an uneven band does not hold up the rest
+    uint32_t band_rows = (img->height + num_threads * 2 - 1) / (num_threads * 2);
+    if (band_rows < FPNG_MIN_BAND_ROWS)
+        band_rows = FPNG_MIN_BAND_ROWS;
+
+    const uint32_t num_bands = (img->height + band_rows - 1) / band_rows;
+
+    // The slower and uncompressed modes only exist as whole image encoders
+    if ((num_threads < 2) || (num_bands < 2) || (flags & (FPNG_ENCODE_SLOWER | FPNG_FORCE_UNCOMPRESSED)) ||
+        ((img->channels != 3) && (img->channels != 4)) ||
+        (img->width * (uint64_t)img->height > UINT32_MAX) || (img->width > FPNG_MAX_SUPPORTED_DIM) || (img->height > FPNG_MAX_SUPPORTED_DIM))
+    {
+        return fpng_encode_image_to_memory(arena, img, out, flags);
     }
 
-    // Write IDAT chunk's CRC32 and a 0 length IEND chunk
-    const char* data = "\0\0\0\0\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82"; // IDAT CRC32, followed by the IEND chunk
-    uint64_t temp_size = out->size;
-    ENCODER_RESIZE_OUT(out->size + 16);
-    memcpy(out->str + temp_size, data, 16);
+    mga_temp scratch = mga_scratch_get(&arena, 1);
+
+    const uint64_t bpl = (uint64_t)img->width * img->channels;
+
+    // The compressors read up to 7 bytes past the end of their rows
+    uint8_t* filtered = MGA_PUSH_ARRAY(scratch.arena, uint8_t, (bpl + 1) * img->height + 7);
+
+    fpng_band* bands = MGA_PUSH_ZERO_ARRAY(scratch.arena, fpng_band, num_bands);
+    for (uint32_t i = 0; i < num_bands; i++)
+    {
+        fpng_band* band = &bands[i];
+
+        band->img = img;
+        band->y0 = i * band_rows;
+        band->y1 = MIN(img->height, band->y0 + band_rows);
+        band->band_flags = (i == 0 ? FPNG_BAND_FIRST : 0) | (i == num_bands - 1 ? FPNG_BAND_LAST : 0);
+        band->filtered = filtered + band->y0 * (bpl + 1);
+
+        // Same budget as the whole image encoder, anything larger falls back to it
+        band->out_capacity = (uint32_t)(((bpl + 1) * (band->y1 - band->y0) + 64 + 7) & ~7);
+        band->out = MGA_PUSH_ARRAY(scratch.arena, uint8_t, band->out_capacity);
+    }
+
+    thread_pool_parallel_for(tp, 0, num_bands, 1, fpng_encode_bands, bands);
+
+    uint64_t zlib_size = 4;
+    uint32_t adler = FPNG_ADLER32_INIT;
+    for (uint32_t i = 0; i < num_bands; i++)
+    {
+        if (!bands[i].out_size)
+        {
+            // A band did not compress, the whole image encoder can store it raw
+            mga_scratch_release(scratch);
+            return fpng_encode_image_to_memory(arena, img, out, flags);
+        }
+
+        zlib_size += bands[i].out_size;
+        adler = adler32_combine(adler, bands[i].adler, (bands[i].y1 - bands[i].y0) * (bpl + 1));
+    }
+
+    if (PNG_HEADER_SIZE + zlib_size > UINT32_MAX)
+    {
+        mga_scratch_release(scratch);
+        return fpng_encode_image_to_memory(arena, img, out, flags);
+    }
+
+    u32 arena_align = mga_get_align(arena);
+    arena->_align = 1;
+
+    out->size = PNG_HEADER_SIZE + zlib_size;
+    out->str = MGA_PUSH_ARRAY(arena, uint8_t, out->size);
+
+    uint8_t* pDst = out->str + PNG_HEADER_SIZE;
+    for (uint32_t i = 0; i < num_bands; i++)
+    {
+        memcpy(pDst, bands[i].out, bands[i].out_size);
+        pDst += bands[i].out_size;
+    }
+
+    // zlib adler32, big endian
+    for (uint32_t i = 0; i < 4; i++)
+        pDst[i] = (uint8_t)(adler >> (24 - i * 8));
+
+    write_png_chunks(arena, img, out);
 
-    // Compute IDAT crc32
-    uint32_t c = (uint32_t)fpng_crc32(out->str + PNG_HEADER_SIZE - 4, idat_len + 4, FPNG_CRC32_INIT);
-    
-    for (i = 0; i < 4; ++i, c <<= 8)
-        (out->str + out->size - 16)[i] = (uint8_t)(c >> 24);
-            
     arena->_align = arena_align;
     mga_scratch_release(scratch);
 
@@ -2078,6 +2352,46 @@ static bool prepare_dynamic_block(
     return true;
 }
     
+// Moves on to the next block at the start of a scanline.
+// fpng_encode_image_to_memory_mt ends every band but the last with a sync flush,
+// so the only thing allowed between two blocks is an empty stored block
+static bool fpng_next_block(
+    const uint8_t* pSrc, uint32_t src_len, uint32_t* src_ofs,
+    uint32_t* bit_buf_size, uint64_t* bit_buf,
+    uint32_t* pLit_table, uint32_t num_chans, uint32_t* bfinal)
+{
+    if (*bfinal)
+        return false;
+
+    // EOB of the current block
+    uint32_t eob_len = (pLit_table[*bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)] >> 9) & 15;
+    SKIP_BITS_PTR(eob_len);
+
+    uint32_t stored_hdr;
+    GET_BITS_PTR(stored_hdr, 3);
+    if (stored_hdr != 0)
+        return false;
+
+    // Stored blocks start on a byte boundary
+    uint32_t align_bits = *bit_buf_size & 7;
+    if (align_bits)
+        SKIP_BITS_PTR(align_bits);
+
+    uint32_t len, nlen;
+    GET_BITS_PTR(len, 16);
+    GET_BITS_PTR(nlen, 16);
+    if ((len != 0) || (nlen != 0xFFFF))
+        return false;
+
+    uint32_t btype;
+    GET_BITS_PTR(*bfinal, 1);
+    GET_BITS_PTR(btype, 2);
+    if (btype != 2)
+        return false;
+
+    return prepare_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, pLit_table, num_chans);
+}
+
 static bool fpng_pixel_zlib_raw_decompress(
     const uint8_t* pSrc, uint32_t src_len, uint32_t zlib_len,
     uint8_t* pDst, uint32_t w, uint32_t h,
@@ -2213,8 +2527,8 @@ static bool fpng_pixel_zlib_decompress_3(
     GET_BITS(bfinal, 1);
     GET_BITS(btype, 2);
 
-    // Must be the final block or it's not valid, and type=2 (dynamic)
-    if ((bfinal != 1) || (btype != 2))
+    // Must be type=2 (dynamic), only the last block of a banded stream is final
+    if (btype != 2)
         return false;
     
     uint32_t lit_table[FPNG_DECODER_TABLE_SIZE];
@@ -2226,6 +2540,14 @@ static bool fpng_pixel_zlib_decompress_3(
 
     for (uint32_t y = 0; y < h; y++)
     {
+        // An EOB instead of a filter literal means the next band starts here
+        assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
+        if ((lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)] & 511) == 256)
+        {
+            if (!fpng_next_block(pSrc, src_len, &src_ofs, &bit_buf_size, &bit_buf, lit_table, 3, &bfinal))
+                return false;
+        }
+
         // At start of PNG scanline, so read the filter literal
         assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
         uint32_t filter = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
@@ -2530,7 +2852,10 @@ static bool fpng_pixel_zlib_decompress_3(
 
     } // y
 
-    // The last symbol should be EOB
+    // The last symbol should be EOB, of the final block
+    if (bfinal != 1)
+        return false;
+
     assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
     uint32_t lit0 = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
     uint32_t lit0_len = (lit0 >> 9) & 15;
@@ -2591,8 +2916,8 @@ static bool fpng_pixel_zlib_decompress_4(
     GET_BITS(bfinal, 1);
     GET_BITS(btype, 2);
 
-    // Must be the final block or it's not valid, and type=2 (dynamic)
-    if ((bfinal != 1) || (btype != 2))
+    // Must be type=2 (dynamic), only the last block of a banded stream is final
+    if (btype != 2)
         return false;
 
     uint32_t lit_table[FPNG_DECODER_TABLE_SIZE];
@@ -2604,6 +2929,14 @@ static bool fpng_pixel_zlib_decompress_4(
 
     for (uint32_t y = 0; y < h; y++)
     {
+        // An EOB instead of a filter literal means the next band starts here
+        assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
+        if ((lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)] & 511) == 256)
+        {
+            if (!fpng_next_block(pSrc, src_len, &src_ofs, &bit_buf_size, &bit_buf, lit_table, 4, &bfinal))
+                return false;
+        }
+
         // At start of PNG scanline, so read the filter literal
         assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
         uint32_t filter = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
@@ -2846,7 +3179,10 @@ static bool fpng_pixel_zlib_decompress_4(
         pCur_scanline += dst_bpl;
     } // y
 
-    // The last symbol should be EOB
+    // The last symbol should be EOB, of the final block
+    if (bfinal != 1)
+        return false;
+
     assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
     uint32_t lit0 = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
     uint32_t lit0_len = (lit0 >> 9) & 15;
@@ -2911,10 +3247,10 @@ static int fpng_get_info_internal(const void* pImage, uint32_t image_size, uint3
         return false;
     }
             
-    width = 0;
-    height = 0;
-    channels_in_file = 0;
-    idat_ofs = 0, idat_len = 0;
+    *width = 0;
+    *height = 0;
+    *channels_in_file = 0;
+    *idat_ofs = 0, *idat_len = 0;
             
     // Ensure the file has at least a minimum possible size
     if (image_size < (sizeof(s_png_sig) + sizeof(png_ihdr) + sizeof(png_chunk_prefix) + 1 + sizeof(uint32_t) + sizeof(png_iend)))
@@ -2937,7 +3273,7 @@ static int fpng_get_info_internal(const void* pImage, uint32_t image_size, uint3
     *width = READ_BE32(&ihdr->m_width);
     *height = READ_BE32(&ihdr->m_height);
             
-    if (!width || !height || (*width > FPNG_MAX_SUPPORTED_DIM) || (*height > FPNG_MAX_SUPPORTED_DIM))
+    if (!*width || !*height || (*width > FPNG_MAX_SUPPORTED_DIM) || (*height > FPNG_MAX_SUPPORTED_DIM))
         return FPNG_DECODE_FAILED_INVALID_DIMENSIONS;
 
     uint64_t total_pixels = (uint64_t)(*width) * (*height);
@@ -2952,7 +3288,7 @@ static int fpng_get_info_internal(const void* pImage, uint32_t image_size, uint3
     else if (ihdr->m_color_type == 6)
         *channels_in_file = 4;
 
-    if (!channels_in_file)
+    if (!*channels_in_file)
         return FPNG_DECODE_NOT_FPNG;
 
     // Scan all the chunks. Look for one IDAT, IEND, and our custom fdEC chunk that indicates the file was compressed by us. Skip any ancillary chunks.
@@ -3003,7 +3339,7 @@ static int fpng_get_info_internal(const void* pImage, uint32_t image_size, uint3
         else if (is_idat)
         {
             // If there were multiple IDAT's, or we didn't find the fdEC chunk, then it's not FPNG.
-            if ((idat_ofs) || (!found_fdec_chunk))
+            if ((*idat_ofs) || (!found_fdec_chunk))
                 return FPNG_DECODE_NOT_FPNG;
 
             *idat_ofs = (uint32_t)src_ofs;
@@ -3044,7 +3380,7 @@ static int fpng_get_info_internal(const void* pImage, uint32_t image_size, uint3
         pImage_u8 += sizeof(png_chunk_prefix) + chunk_len + sizeof(uint32_t);
     }
 
-    if ((!found_fdec_chunk) || (!idat_ofs))
+    if ((!found_fdec_chunk) || (!*idat_ofs))
         return FPNG_DECODE_NOT_FPNG;
     
     return FPNG_DECODE_SUCCESS;
@@ -3085,7 +3421,7 @@ int fpng_decode_memory(mg_arena* arena, string8 file, fpng_img* img, uint32_t de
     //out.resize(mem_needed);
     img->data = MGA_PUSH_ZERO_ARRAY(arena, uint8_t, mem_needed);
     
-    const uint8_t* pIDAT_data = (const uint8_t*)(img->data) + idat_ofs + sizeof(uint32_t) * 2;
+    const uint8_t* pIDAT_data = (const uint8_t*)(file.str) + idat_ofs + sizeof(uint32_t) * 2;
     const uint32_t src_len = file.size - (idat_ofs + sizeof(uint32_t) * 2);
 
     bool decomp_status;
@@ -11,6 +11,7 @@ This is a stripped down version of fpng that is adapted to work with in C with t
 #include "mg_arena/mg_arena.h"
 
 #include "base/base.h"
+#include "os/os_thread_pool.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -38,6 +39,11 @@ void fpng_init();
 // fpng_init() must have been called first, or it'll assert and return false.
 bool fpng_cpu_supports_sse41();
 
+// Returns true if the CPU and OS support AVX2 with FMA (or AVX-512F for the second function).
+// These are not used by fpng itself, they are exposed so the renderer can share the cpuid probing.
+bool fpng_cpu_supports_avx2();
+bool fpng_cpu_supports_avx512();
+
 // ---- Compression
 enum
 {
@@ -53,6 +59,12 @@ enum
 // image channels must be 3 or 4. 
 bool fpng_encode_image_to_memory(mg_arena* arena, const fpng_img* img, string8* out, uint32_t flags);
 
+// Same output format, but the image is split into bands of rows that are filtered and compressed
+// as separate Deflate blocks on the thread pool, then joined with sync flushes and a combined adler32.
+// Waits on the pool, so nothing else may use it during the call.
+// FPNG_ENCODE_SLOWER, FPNG_FORCE_UNCOMPRESSED and small images fall back to fpng_encode_image_to_memory().
+bool fpng_encode_image_to_memory_mt(mg_arena* arena, const fpng_img* img, string8* out, uint32_t flags, thread_pool* tp);
+
 // ---- Decompression
         
 enum
@@ -0,0 +1,193 @@
+#include "trace.h"
+
+#ifdef TRACE_ENABLED
+
+#include "os/os.h"
+
+#include <stdio.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#    define TRACE_THREAD_VAR __declspec(thread)
+#else
+#    define TRACE_THREAD_VAR __thread
+#endif
+
+typedef struct {
+    const char* name;
+    u64 start;
+    u64 end;
+} trace_event;
+
+typedef struct {
+    trace_event* events;
+
+    // Zones recorded so far, only written by the thread that owns the ring
+    volatile u64 head;
+    // head at the last flush, only used by trace_flush
+    u64 flushed;
+
+    // Can be NULL
+    const char* volatile name;
+
+    // Every thread writes to its own cache line
+    u8 _pad[32];
+} trace_ring;
+
+static struct {
+    volatile u32 initialized;
+    u64 mask;
+
+    trace_ring rings[TRACE_MAX_THREADS];
+    // Can go past TRACE_MAX_THREADS, those threads get no ring
+    volatile u32 num_rings;
+
+    // Ticks and time of trace_init, to convert ticks to microseconds
+    u64 start_ticks;
+    u64 start_usec;
+} trace_state = { 0 };
+
+// NULL until the first zone of the thread, and for threads without a ring
+static TRACE_THREAD_VAR trace_ring* thread_ring = NULL;
+static TRACE_THREAD_VAR b32 thread_registered = false;
+
+void trace_init(u32 events_per_thread) {
+    u64 capacity = 2;
+    while (capacity < events_per_thread) {
+        capacity <<= 1;
+    }
+
+    trace_state.mask = capacity - 1;
+    trace_state.start_ticks = TRACE_NOW();
+    trace_state.start_usec = os_now_usec();
+
+    atomic_store_u32(&trace_state.initialized, 1);
+}
+
+static trace_ring* trace_get_ring(void) {
+    if (thread_registered) {
+        return thread_ring;
+    }
+    thread_registered = true;
+
+    u32 index = atomic_add_u32(&trace_state.num_rings, 1);
+    if (index >= TRACE_MAX_THREADS) {
+        return NULL;
+    }
+
+    // Rings are only touched by threads that record zones, so each one
+    // gets an arena of its own instead of a lock around a shared one.
+    // They are never freed, threads can record until the process exits
+    u64 size = sizeof(trace_event) * (trace_state.mask + 1);
+    mg_arena* arena = mga_create(&(mga_desc){
+        .desired_max_size = MGA_KiB(64) + size,
+        .desired_block_size = MGA_KiB(64)
+    });
+
+    trace_ring* ring = &trace_state.rings[index];
+    ring->events = MGA_PUSH_ARRAY(arena, trace_event, trace_state.mask + 1);
+    thread_ring = ring;
+
+    return ring;
+}
+
+void trace_thread_name(const char* name) {
+    if (!atomic_load_u32(&trace_state.initialized)) {
+        return;
+    }
+
+    trace_ring* ring = trace_get_ring();
+    if (ring != NULL) {
+        ring->name = name;
+    }
+}
+
+void trace_zone_end(const trace_zone* zone) {
+    if (!atomic_load_u32(&trace_state.initialized)) {
+        return;
+    }
+
+    trace_ring* ring = trace_get_ring();
+    if (ring == NULL) {
+        return;
+    }
+
+    u64 head = ring->head;
+    ring->events[head & trace_state.mask] = (trace_event){
+        .name = zone->name,
+        .start = zone->start,
+        .end = TRACE_NOW()
+    };
+
+    // The event is in place before the flush can see it
+    atomic_store_u64(&ring->head, head + 1);
+}
+
+b32 trace_flush(const char* path) {
+    if (!atomic_load_u32(&trace_state.initialized)) {
+        return false;
+    }
+
+#ifdef PLATFORM_WIN32
+    FILE* f = NULL;
+    fopen_s(&f, path, "wb");
+#else
+    FILE* f = fopen(path, "wb");
+#endif
+
+    if (f == NULL) {
+        return false;
+    }
+
+    // The tick rate is measured over the whole trace, which is
+    // as long as any zone in it can be
+    u64 elapsed_ticks = TRACE_NOW() - trace_state.start_ticks;
+    u64 elapsed_usec = os_now_usec() - trace_state.start_usec;
+    f64 usec_per_tick = elapsed_ticks == 0 ? 1.0 : (f64)MAX(elapsed_usec, 1) / (f64)elapsed_ticks;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    b32 first = true;
+    u32 num_rings = MIN(atomic_load_u32(&trace_state.num_rings), TRACE_MAX_THREADS);
+
+    for (u32 i = 0; i < num_rings; i++) {
+        trace_ring* ring = &trace_state.rings[i];
+
+        const char* name = ring->name;
+        if (name != NULL) {
+            fprintf(
+                f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", i, name
+            );
+            first = false;
+        }
+
+        // A ring that wrapped around since the last flush only has its latest zones
+        u64 head = atomic_load_u64(&ring->head);
+        u64 start = MAX(ring->flushed, head > trace_state.mask ? head - trace_state.mask - 1 : 0);
+
+        for (u64 e = start; e < head; e++) {
+            const trace_event* event = &ring->events[e & trace_state.mask];
+
+            // Zones that began before trace_init
+            if (event->start < trace_state.start_ticks) {
+                continue;
+            }
+
+            fprintf(
+                f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                first ? "" : ",\n", event->name, i,
+                (f64)(event->start - trace_state.start_ticks) * usec_per_tick,
+                (f64)(event->end - event->start) * usec_per_tick
+            );
+            first = false;
+        }
+
+        ring->flushed = head;
+    }
+
+    fprintf(f, "\n]}\n");
+
+    return fclose(f) == 0;
+}
+
+#endif // TRACE_ENABLED
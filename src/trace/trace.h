@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "base/base.h"
+
+// Timeline tracing
+// Scoped zones record when a piece of work started and ended on the thread that ran it.
+// Every thread writes its zones into a ring of its own, so recording never takes a lock,
+// and the ring keeps the latest events_per_thread zones once it wraps around.
+// trace_flush writes the zones recorded since the last flush to a Chrome trace file,
+// which chrome://tracing or ui.perfetto.dev show as a timeline per thread.
+// Timestamps are cycle counts on x64, and are converted to microseconds when they are written.
+//
+// Tracing is only compiled in with TRACE_ENABLED defined (premake --trace),
+// otherwise every macro below expands to nothing:
+//     TRACE_ZONE_BEGIN(zone, "encode");
+//     ...
+//     TRACE_ZONE_END(zone);
+// Names are not copied, they have to be string literals
+
+#ifdef TRACE_ENABLED
+
+#if defined(_M_X64) || defined(__x86_64__)
+#    if defined(_MSC_VER) && !defined(__clang__)
+#        include <intrin.h>
+#    else
+#        include <x86intrin.h>
+#    endif
+#    define TRACE_NOW() __rdtsc()
+#else
+#    include "os/os.h"
+#    define TRACE_NOW() os_now_usec()
+#endif
+
+typedef struct {
+    const char* name;
+    u64 start;
+} trace_zone;
+
+// Zones on threads beyond this are dropped
+#define TRACE_MAX_THREADS 256
+
+// Zones recorded before this are dropped
+void trace_init(u32 events_per_thread);
+// Shown instead of the thread index, only for the calling thread
+void trace_thread_name(const char* name);
+void trace_zone_end(const trace_zone* zone);
+// Zones that are recorded while this runs may or may not be written.
+// Returns false if the file cannot be written
+b32 trace_flush(const char* path);
+
+#define TRACE_INIT(events_per_thread) trace_init(events_per_thread)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#define TRACE_ZONE_BEGIN(zone, zone_name) trace_zone zone = { .name = (zone_name), .start = TRACE_NOW() }
+#define TRACE_ZONE_END(zone) trace_zone_end(&(zone))
+#define TRACE_FLUSH(path) trace_flush(path)
+
+#else
+
+#define TRACE_INIT(events_per_thread)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_ZONE_BEGIN(zone, zone_name)
+#define TRACE_ZONE_END(zone)
+#define TRACE_FLUSH(path)
+
+#endif // TRACE_ENABLED
+
+#endif // TRACE_H